@@ -0,0 +1,54 @@
+import time
+import concurrent.futures
+
+import numpy as np
+import pyscan
+
+# Runs the same batch of scans one after another and then from a pool of python threads. The scans release the GIL,
+# so the pooled run should finish close to workers times faster on a machine with that many cores. Statistics are
+# the built in ones (pyscan.KULLDORF, pyscan.DISC, ...), since the bindings do not accept Python callables.
+#
+# This is an example, not a test, and it has not been run against a build of the bindings. The C++ tests
+# max_disk.concurrent_calls and max_rectangle.concurrent_calls check that concurrent scans match serial ones.
+
+n_pts = 2000
+n_scans = 16
+workers = 4
+
+
+def make_scan(seed):
+    rng = np.random.default_rng(seed)
+    red = rng.random((n_pts, 2))
+    blue = rng.random((n_pts, 2))
+    net = rng.random((50, 2))
+    return net, red, blue
+
+
+def run_disk(args):
+    net, red, blue = args
+    return pyscan.max_disk(net, red, blue, pyscan.KULLDORF)
+
+
+def run_rect(args):
+    net, red, blue = args
+    return pyscan.max_rectangle(red, blue, .05, 1.0, 1.0)
+
+
+def timed(scan, inputs, pool):
+    start = time.time()
+    if pool is None:
+        results = [scan(args) for args in inputs]
+    else:
+        results = list(pool.map(scan, inputs))
+    return time.time() - start, results
+
+
+if __name__ == "__main__":
+    inputs = [make_scan(seed) for seed in range(n_scans)]
+    with concurrent.futures.ThreadPoolExecutor(max_workers=workers) as pool:
+        for scan in [run_disk, run_rect]:
+            serial_t, serial_res = timed(scan, inputs, None)
+            pooled_t, pooled_res = timed(scan, inputs, pool)
+            assert all(abs(a[1] - b[1]) < 1e-9 for a, b in zip(serial_res, pooled_res))
+            print("{:16} serial {:7.3f}s  {} threads {:7.3f}s  speedup {:5.2f}".format(
+                scan.__name__, serial_t, workers, pooled_t, serial_t / pooled_t))
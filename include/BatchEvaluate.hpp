@@ -0,0 +1,58 @@
+#ifndef PYSCAN_BATCHEVALUATE_HPP
+#define PYSCAN_BATCHEVALUATE_HPP
+
+#include "Disk.hpp"
+#include "HalfSpaceScan.hpp"
+#include "Point.hpp"
+#include "RectangleScan.hpp"
+#include "Trajectory.hpp"
+
+namespace pyscan {
+
+    /*
+     * Evaluates f on every range against the same red and blue sets, so entry i is evaluate_range(ranges[i], red,
+     * blue, f). Each set is put into a KD-tree once. A range then skips the subtrees it misses and takes the
+     * stored weight of the subtrees it contains, and only tests single points (or trajectories) along its boundary.
+     * The ranges are answered on threads workers (0 means all hardware threads).
+     *
+     * Labeled points count each label once with the weight of its first point in the range, as range_weight does.
+     * Trajectories count when they intersect the range. The weights are summed in tree order, so values can
+     * differ from evaluate_range in the last bit.
+     */
+    std::vector<double> evaluate_ranges(const std::vector<Disk> &ranges,
+            const wpoint_list_t &red, const wpoint_list_t &blue,
+            const discrepancy_func_t &f, size_t threads = 1);
+
+    std::vector<double> evaluate_ranges(const std::vector<Rectangle> &ranges,
+            const wpoint_list_t &red, const wpoint_list_t &blue,
+            const discrepancy_func_t &f, size_t threads = 1);
+
+    std::vector<double> evaluate_ranges(const std::vector<halfspace2_t> &ranges,
+            const wpoint_list_t &red, const wpoint_list_t &blue,
+            const discrepancy_func_t &f, size_t threads = 1);
+
+    std::vector<double> evaluate_ranges(const std::vector<Disk> &ranges,
+            const lpoint_list_t &red, const lpoint_list_t &blue,
+            const discrepancy_func_t &f, size_t threads = 1);
+
+    std::vector<double> evaluate_ranges(const std::vector<Rectangle> &ranges,
+            const lpoint_list_t &red, const lpoint_list_t &blue,
+            const discrepancy_func_t &f, size_t threads = 1);
+
+    std::vector<double> evaluate_ranges(const std::vector<halfspace2_t> &ranges,
+            const lpoint_list_t &red, const lpoint_list_t &blue,
+            const discrepancy_func_t &f, size_t threads = 1);
+
+    std::vector<double> evaluate_ranges(const std::vector<Disk> &ranges,
+            const trajectory_set_t &red, const trajectory_set_t &blue,
+            const discrepancy_func_t &f, size_t threads = 1);
+
+    std::vector<double> evaluate_ranges(const std::vector<Rectangle> &ranges,
+            const trajectory_set_t &red, const trajectory_set_t &blue,
+            const discrepancy_func_t &f, size_t threads = 1);
+
+    std::vector<double> evaluate_ranges(const std::vector<halfspace2_t> &ranges,
+            const trajectory_set_t &red, const trajectory_set_t &blue,
+            const discrepancy_func_t &f, size_t threads = 1);
+}
+#endif //PYSCAN_BATCHEVALUATE_HPP
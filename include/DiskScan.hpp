@@ -4,6 +4,8 @@
 #include "Common.hpp"
 #include "Point.hpp"
 #include "Disk.hpp"
+#include "PointArray.hpp"
+#include "Gridding.hpp"
 
 namespace pyscan {
 
@@ -31,13 +33,26 @@ namespace pyscan {
 //            const lpoint_list_t &blue,
 //            const discrepancy_func_t &f);
 
-
+    /*
+     * The scale restricted disk scans split the work over the non-empty cells of the net grid.
+     * threads sets the number of worker threads (0 uses every hardware thread). The returned disk
+     * does not depend on the number of threads.
+     */
     std::tuple<Disk, double> max_disk_scale(
             const point_list_t &point_net,
             const wpoint_list_t &red,
             const wpoint_list_t &blue,
             double min_res,
-            const discrepancy_func_t &f);
+            const discrepancy_func_t &f,
+            size_t threads = 1);
+
+    std::tuple<Disk, double> max_disk_scale(
+            const point_list_t &point_net,
+            const PointArray &red,
+            const PointArray &blue,
+            double min_res,
+            const discrepancy_func_t &f,
+            size_t threads = 1);
 
     std::tuple<Disk, double> max_disk_scale_labeled(
             const lpoint_list_t &point_net,
@@ -45,14 +60,99 @@ namespace pyscan {
             const lpoint_list_t &blue,
             bool compress,
             double min_res,
-            const discrepancy_func_t &f);
+            const discrepancy_func_t &f,
+            size_t threads = 1);
 
     std::tuple<Disk, double> max_disk_scale_labeled_alt(
             const point_list_t &point_net,
             const lpoint_list_t &red,
             const lpoint_list_t &blue,
             double min_res,
-            const discrepancy_func_t &f);
+            const discrepancy_func_t &f,
+            size_t threads = 1);
+
+    /*
+     * Maintains the result of max_disk_scale while weighted red and blue points arrive and leave in batches. The
+     * net, and so the set of candidate disks, is fixed at construction.
+     *
+     * Every non-empty net cell keeps the (red, blue) weights of its candidate disks, one disk for each distinct pair.
+     * The weights of a disk only change when a point within 4 cells of the cell of its pivot is added or removed,
+     * so an update rescans just those cells and re-evaluates the stored weights of the others against the new
+     * totals. This matches max_disk_scale for any statistic.
+     *
+     * A candidate disk passes through three net points, so a cell stores at most |cell| * m^2 candidates, where m
+     * is the number of net points within 4 cells, however many points have been inserted. The red and blue points
+     * themselves are kept for the rescans, and removed ones stay until they make up half of their array. Memory is
+     * therefore linear in the number of live points plus the candidates of the net, and a stream that only inserts
+     * grows without bound; remove or update the old points to keep a fixed window.
+     */
+    class DiskScanner {
+    public:
+        DiskScanner(const point_list_t &point_net, double min_res, discrepancy_func_t f, size_t threads = 1);
+
+        void insert(const wpoint_list_t &red, const wpoint_list_t &blue);
+        void insert(const PointArray &red, const PointArray &blue);
+
+        /*
+         * Removes one previously inserted copy of each of the given points. Points are matched on their
+         * coordinates and weight.
+         */
+        void remove(const wpoint_list_t &red, const wpoint_list_t &blue);
+        void remove(const PointArray &red, const PointArray &blue);
+
+        /*
+         * Removes the old points and inserts the new ones with a single rescan, which is what a sliding window
+         * needs.
+         */
+        void update(const PointArray &new_red, const PointArray &new_blue,
+                    const PointArray &old_red, const PointArray &old_blue);
+
+        std::tuple<Disk, double> current_max() const {
+            return std::make_tuple(max_disk, max_stat);
+        }
+
+        double get_red_total() const {
+            return red_tot;
+        }
+
+        double get_blue_total() const {
+            return blue_tot;
+        }
+
+    private:
+        struct CellCandidates {
+            std::vector<double> red;
+            std::vector<double> blue;
+            std::vector<Disk> disks;
+        };
+
+        void add_points(const PointArray &new_red, const PointArray &new_blue, std::vector<uint64_t> &touched);
+        void drop_points(const PointArray &old_red, const PointArray &old_blue, std::vector<uint64_t> &touched);
+        void refresh(std::vector<uint64_t> touched);
+        void rescan(const std::vector<size_t> &dirty);
+
+        double min_res;
+        discrepancy_func_t f;
+        size_t threads;
+        //Net bounding box grown by the diameter of the largest disk. Points outside of it are in no candidate disk.
+        bbox_t bb;
+        SparseGrid<pt2_t> grid_net;
+        //Points that were removed stay in red and blue, flagged, until they make up half of the array.
+        PointArray red;
+        PointArray blue;
+        std::vector<bool> red_removed;
+        std::vector<bool> blue_removed;
+        size_t red_removed_count = 0;
+        size_t blue_removed_count = 0;
+        SparseGrid<size_t> grid_red;
+        SparseGrid<size_t> grid_blue;
+        double red_tot = 0.0;
+        double blue_tot = 0.0;
+        //The candidates of each cell of grid_net.cells().
+        std::vector<CellCandidates> cell_candidates;
+        Disk max_disk;
+        double max_stat = 0.0;
+    };
 
     std::tuple<Disk, double> max_disk_scale_slow(
             const point_list_t &point_net,
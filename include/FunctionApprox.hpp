@@ -70,6 +70,15 @@ namespace pyscan {
 	        	std::function<double(Vec2)> phi, //function to maximize
 	            std::function<Vec2(Vec2)> lineMaxF);
 
+	/*
+	 * The same refinement driven one level at a time. Every direction that a level decides to refine is handed to
+	 * lineMaxBatch in a single call, which returns the extreme point for each direction in order, so the oracle
+	 * can answer the whole batch concurrently or in one shared pass.
+	 */
+	double approximateHullBatch(double eps,
+	        std::function<double(Vec2)> phi, //function to maximize
+	        std::function<std::vector<Vec2>(std::vector<Vec2> const&)> lineMaxBatch);
+
 	std::vector<Vec2> eps_core_set(double eps,
 								   std::function<Vec2(Vec2)> lineMaxF);
 
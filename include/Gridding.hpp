@@ -6,6 +6,7 @@
 #include <map>
 #include <algorithm>
 #include <vector>
+#include <iterator>
 #include <type_traits>
 #include <cmath>
 
@@ -141,29 +142,76 @@ private:
 
 };
 
+/*
+ * A grid that buckets items by cell in compressed sparse row form. The items are kept in one array sorted by cell
+ * code (items in the same cell stay in insertion order) and each occupied cell maps to a contiguous range of it,
+ * so walking a cell or the whole grid reads contiguous memory.
+ */
 template <typename T>
-class SparseGrid : public Grid<SparseGrid<T>, std::multimap<uint64_t, T>> {
+class SparseGrid : public Grid<SparseGrid<T>, std::vector<std::pair<uint64_t, T>>> {
 public:
     using bbox_t = std::tuple<double, double, double, double>;
 
-    using iterator_t = typename std::multimap<uint64_t, T>::const_iterator;
+    using iterator_t = typename std::vector<std::pair<uint64_t, T>>::const_iterator;
 
 
     SparseGrid(bbox_t bb, const std::vector<T>& items, double min_res) :
-        Grid<SparseGrid<T>, std::multimap<uint64_t, T>>(std::get<0>(bb), std::get<1>(bb),
+        Grid<SparseGrid<T>, std::vector<std::pair<uint64_t, T>>>(std::get<0>(bb), std::get<1>(bb),
                 std::max(std::abs(std::get<0>(bb) - std::get<2>(bb)),
                        std::abs(std::get<1>(bb) - std::get<3>(bb))),
                        min_res) {
+        std::vector<std::pair<uint64_t, T>> coded;
+        coded.reserve(items.size());
         for (auto& pt: items) {
-            z_pts.emplace(this->get_code(pt), pt);
+            coded.emplace_back(this->get_code(pt), pt);
         }
+        assign(std::move(coded));
     }
 
     SparseGrid(bbox_t bb, double min_res) :
-        Grid<SparseGrid<T>, std::multimap<uint64_t, T>>(std::get<0>(bb), std::get<1>(bb),
+        Grid<SparseGrid<T>, std::vector<std::pair<uint64_t, T>>>(std::get<0>(bb), std::get<1>(bb),
                 std::max(std::abs(std::get<0>(bb) - std::get<2>(bb)),
                        std::abs(std::get<1>(bb) - std::get<3>(bb))),
                        min_res) {
+        offsets.push_back(0);
+    }
+
+    /*
+     * Replaces the contents of the grid with the given (cell code, item) pairs.
+     */
+    void assign(std::vector<std::pair<uint64_t, T>> coded) {
+        std::stable_sort(coded.begin(), coded.end(), [](const std::pair<uint64_t, T>& a, const std::pair<uint64_t, T>& b) {
+            return a.first < b.first;
+        });
+        z_pts = std::move(coded);
+        index_cells();
+    }
+
+    /*
+     * Adds the given (cell code, item) pairs to the grid. New items are placed after the items already stored in
+     * their cell, so this is a linear merge rather than a full re-sort of the grid.
+     */
+    void insert(std::vector<std::pair<uint64_t, T>> coded) {
+        auto code_lt = [](const std::pair<uint64_t, T>& a, const std::pair<uint64_t, T>& b) {
+            return a.first < b.first;
+        };
+        std::stable_sort(coded.begin(), coded.end(), code_lt);
+        std::vector<std::pair<uint64_t, T>> merged;
+        merged.reserve(z_pts.size() + coded.size());
+        std::merge(z_pts.begin(), z_pts.end(), coded.begin(), coded.end(), std::back_inserter(merged), code_lt);
+        z_pts = std::move(merged);
+        index_cells();
+    }
+
+    /*
+     * Removes every item for which pred(item) holds.
+     */
+    template <typename Pred>
+    void erase_if(Pred pred) {
+        z_pts.erase(std::remove_if(z_pts.begin(), z_pts.end(), [&](const std::pair<uint64_t, T>& el) {
+            return pred(el.second);
+        }), z_pts.end());
+        index_cells();
     }
 
     std::pair<iterator_t, iterator_t> operator()(uint32_t i, uint32_t j) const {
@@ -171,11 +219,23 @@ public:
             return std::make_pair(z_pts.end(), z_pts.end());
         }
         uint64_t code = j * this->r + i;
-        return z_pts.equal_range(code);
+        return (*this)(code);
     }
 
     std::pair<iterator_t, iterator_t> operator()(uint64_t code) const {
-        return z_pts.equal_range(code);
+        auto it = std::lower_bound(cell_codes.begin(), cell_codes.end(), code);
+        if (it == cell_codes.end() || *it != code) {
+            return std::make_pair(z_pts.end(), z_pts.end());
+        }
+        size_t c = it - cell_codes.begin();
+        return std::make_pair(z_pts.begin() + offsets[c], z_pts.begin() + offsets[c + 1]);
+    }
+
+    /*
+     * The codes of the non-empty cells in increasing order.
+     */
+    const std::vector<uint64_t>& cells() const {
+        return cell_codes;
     }
 
     iterator_t implement_begin() const {
@@ -184,7 +244,24 @@ public:
     iterator_t implement_end() const {
         return z_pts.cend();
     }
-    std::multimap<uint64_t, T> z_pts;
+
+private:
+    void index_cells() {
+        cell_codes.clear();
+        offsets.clear();
+        for (size_t i = 0; i < z_pts.size(); ++i) {
+            if (cell_codes.empty() || cell_codes.back() != z_pts[i].first) {
+                cell_codes.push_back(z_pts[i].first);
+                offsets.push_back(i);
+            }
+        }
+        offsets.push_back(z_pts.size());
+    }
+
+    std::vector<std::pair<uint64_t, T>> z_pts;
+    std::vector<uint64_t> cell_codes;
+    //Cell c owns z_pts[offsets[c], offsets[c + 1]).
+    std::vector<size_t> offsets;
 };
 
 
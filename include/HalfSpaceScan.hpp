@@ -10,6 +10,7 @@
 
 #include "Range.hpp"
 #include "Point.hpp"
+#include "PointArray.hpp"
 
 namespace pyscan {
 
@@ -104,11 +105,24 @@ namespace pyscan {
     lpt2_t drop_point(const pt3_t& fixed_point, const lpt3_t& p);
     pt3_t lift_half_space(const halfspace2_t& h, const pt3_t& p);
 
+    /*
+     * The exact halfplane and halfspace scans sweep around every point of the net. threads sets the number of
+     * worker threads the pivots are spread over (0 uses every hardware thread). The result does not depend on
+     * the number of threads.
+     */
     std::tuple<halfspace2_t, double> max_halfplane(
             const point_list_t& point_net,
             const wpoint_list_t &red,
             const wpoint_list_t &blue,
-            const discrepancy_func_t &f);
+            const discrepancy_func_t &f,
+            size_t threads = 1);
+
+    std::tuple<halfspace2_t, double> max_halfplane(
+            const point_list_t& point_net,
+            const PointArray &red,
+            const PointArray &blue,
+            const discrepancy_func_t &f,
+            size_t threads = 1);
 
     std::tuple<halfspace2_t, double> max_halfplane_simple(
             const point_list_t &point_net,
@@ -126,7 +140,8 @@ namespace pyscan {
             const point3_list_t &point_net,
             const wpoint3_list_t &red,
             const wpoint3_list_t &blue,
-            const discrepancy_func_t &f);
+            const discrepancy_func_t &f,
+            size_t threads = 1);
 
     std::tuple<halfspace3_t, double> max_halfspace_simple(
         const point3_list_t &point_net,
@@ -138,7 +153,8 @@ namespace pyscan {
             const point_list_t& point_net,
             const lpoint_list_t& red,
             const lpoint_list_t& blue,
-            const discrepancy_func_t &f);
+            const discrepancy_func_t &f,
+            size_t threads = 1);
 
     std::tuple<halfspace2_t, double> max_halfplane_labeled_simple(
             const point_list_t &point_net,
@@ -150,7 +166,8 @@ namespace pyscan {
             const point3_list_t &point_net,
             const lpoint3_list_t &red,
             const lpoint3_list_t &blue,
-            const discrepancy_func_t &f);
+            const discrepancy_func_t &f,
+            size_t threads = 1);
 
     std::tuple<halfspace3_t, double> max_halfspace_labeled_simple(
         const point3_list_t &point_net,
@@ -180,6 +180,20 @@ namespace pyscan {
 
 
 
+    /*
+     * The value, gradient and Hessian of a likelihood in (p, q).
+     */
+    struct PQDerivatives {
+        double value;
+        double dp, dq;
+        double dpp, dpq, dqq;
+    };
+
+    /*
+     * The Bernoulli kernel likelihood of a center. The kernel values fr of every point are computed once per center
+     * (by set_radii or written straight into m_fr and b_fr) and every evaluation of the likelihood or its gradient
+     * is then a pass over contiguous arrays.
+     */
     class Bernoulli_Disk {
     public:
         Bernoulli_Disk(double m_tot,
@@ -190,23 +204,16 @@ namespace pyscan {
 
 
         double alternative_hyp(double p, double q) const {
-            double m_total = this->m_total;
-            double b_total = this->b_total;
             double val = 0;
             for (size_t i = 0; i < mr.size(); i++) {
-                double fr = kernel(m_radii[i], bandwidth);
-                //std::cout << fr << " " << m_radii[i] << std::endl;
-                double gr = fr * p + (1 - fr) * q;
+                double gr = q + m_fr[i] * (p - q);
                 val += mr[i] * log(gr);
-                m_total -= mr[i];
             }
             for (size_t i = 0; i < br.size(); i++) {
-                double fr = kernel(b_radii[i], bandwidth);
-                double gr = fr * p + (1 - fr) * q;
+                double gr = q + b_fr[i] * (p - q);
                 val += br[i] * log(1 - gr);
-                b_total -= br[i];
             }
-            val += m_total * log(q) + b_total * log(1 - q);
+            val += (m_total - m_weight) * log(q) + (b_total - b_weight) * log(1 - q);
 
             return val;
         }
@@ -218,54 +225,94 @@ namespace pyscan {
 
 
         inline std::tuple<double, double> mass_conserve(double p, double q) const {
-            double m_total_tmp = this->m_total;
-            double b_total_tmp = this->b_total;
-            double m_total = this->m_total;
-            double b_total = this->b_total;
-
-
             double mass_sum1 = 0.0;
             double mass_sum2 = 0.0;
             for (size_t i = 0; i < mr.size(); i++) {
-                double fr = kernel(m_radii[i], bandwidth);
-                double gr = fr * p + (1 - fr) * q;
-                mass_sum1 += mr[i] * 1 / gr;
-                m_total -= mr[i];
+                double gr = q + m_fr[i] * (p - q);
+                mass_sum1 += mr[i] / gr;
             }
 
             for (size_t i = 0; i < br.size(); i++) {
-                double fr = kernel(b_radii[i], bandwidth);
-                double gr = fr * p + (1 - fr) * q;
-                mass_sum2 += br[i] * 1/(1 - gr);
-                b_total -= br[i];
+                double gr = q + b_fr[i] * (p - q);
+                mass_sum2 += br[i] / (1 - gr);
             }
-            mass_sum1 += m_total / q;
-            mass_sum2 += b_total / (1 - q);
-            return std::make_tuple(mass_sum1 - m_total_tmp - b_total_tmp, mass_sum2 - b_total_tmp - m_total_tmp);
+            mass_sum1 += (m_total - m_weight) / q;
+            mass_sum2 += (b_total - b_weight) / (1 - q);
+            return std::make_tuple(mass_sum1 - m_total - b_total, mass_sum2 - b_total - m_total);
         }
+
         inline std::tuple<double, double> diff(double p, double q) const {
-            double m_total = this->m_total;
-            double b_total = this->b_total;
+            auto [val, dp, dq] = value_diff(p, q);
+            (void)val;
+            return std::make_tuple(dp, dq);
+        }
+
+        /*
+         * The alternative hypothesis and its gradient in (p, q) from one pass over the points.
+         */
+        inline std::tuple<double, double, double> value_diff(double p, double q) const {
+            double val = 0.0;
             double dp = 0.0;
             double dq = 0.0;
             for (size_t i = 0; i < mr.size(); i++) {
-                double fr = kernel(m_radii[i], bandwidth);
-                double gr = fr * p + (1 - fr) * q;
-                dp += mr[i] * fr / gr;
-                dq += mr[i] * (1 - fr) / gr;
+                double fr = m_fr[i];
+                double gr = q + fr * (p - q);
+                double w = mr[i] / gr;
+                val += mr[i] * log(gr);
+                dp += w * fr;
+                dq += w * (1 - fr);
+            }
+
+            for (size_t i = 0; i < br.size(); i++) {
+                double fr = b_fr[i];
+                double gr = q + fr * (p - q);
+                double w = br[i] / (1 - gr);
+                val += br[i] * log(1 - gr);
+                dp -= w * fr;
+                dq -= w * (1 - fr);
+            }
+            val += (m_total - m_weight) * log(q) + (b_total - b_weight) * log(1 - q);
+            dq += (m_total - m_weight) / q - (b_total - b_weight) / (1 - q);
+            return std::make_tuple(val, dp, dq);
+        }
 
-                m_total -= mr[i];
+        /*
+         * The alternative hypothesis with its gradient and Hessian in (p, q), again from one pass over the points.
+         * The likelihood is a sum of logs of affine functions of (p, q), so the Hessian is negative semidefinite.
+         */
+        inline PQDerivatives value_diff_hessian(double p, double q) const {
+            PQDerivatives d{0.0, 0.0, 0.0, 0.0, 0.0, 0.0};
+            for (size_t i = 0; i < mr.size(); i++) {
+                double fr = m_fr[i];
+                double gr = q + fr * (p - q);
+                double w = mr[i] / gr;
+                double w2 = w / gr;
+                d.value += mr[i] * log(gr);
+                d.dp += w * fr;
+                d.dq += w * (1 - fr);
+                d.dpp -= w2 * fr * fr;
+                d.dpq -= w2 * fr * (1 - fr);
+                d.dqq -= w2 * (1 - fr) * (1 - fr);
             }
 
             for (size_t i = 0; i < br.size(); i++) {
-                double fr = kernel(b_radii[i], bandwidth);
-                double gr = fr * p + (1 - fr) * q;
-                dp += -br[i] * fr / (1 - gr);
-                dq += -br[i] * (1 - fr) / (1 - gr);
-                b_total -= br[i];
+                double fr = b_fr[i];
+                double gr = q + fr * (p - q);
+                double w = br[i] / (1 - gr);
+                double w2 = w / (1 - gr);
+                d.value += br[i] * log(1 - gr);
+                d.dp -= w * fr;
+                d.dq -= w * (1 - fr);
+                d.dpp -= w2 * fr * fr;
+                d.dpq -= w2 * fr * (1 - fr);
+                d.dqq -= w2 * (1 - fr) * (1 - fr);
             }
-            dq += m_total / q - b_total / (1 - q);
-            return std::make_tuple(dp, dq);
+            double m_out = m_total - m_weight;
+            double b_out = b_total - b_weight;
+            d.value += m_out * log(q) + b_out * log(1 - q);
+            d.dq += m_out / q - b_out / (1 - q);
+            d.dqq -= m_out / (q * q) + b_out / ((1 - q) * (1 - q));
+            return d;
         }
 
         inline double lrt(double p, double q) const {
@@ -276,12 +323,52 @@ namespace pyscan {
                        std::vector<double> b) {
             mr = std::move(m);
             br = std::move(b);
+            m_weight = 0.0;
+            b_weight = 0.0;
+            for (auto w : mr) m_weight += w;
+            for (auto w : br) b_weight += w;
+            m_fr.resize(mr.size());
+            b_fr.resize(br.size());
+        }
+
+        /*
+         * Empties the points of the current center so the near ones can be appended with add_measured and
+         * add_baseline. Every point that is not added is part of the background terms of the likelihood, which is
+         * the same as giving it a kernel value of 0. The buffers keep their capacity between centers.
+         */
+        void clear_points() {
+            mr.clear();
+            br.clear();
+            m_fr.clear();
+            b_fr.clear();
+            m_weight = 0.0;
+            b_weight = 0.0;
+        }
+
+        void add_measured(double w, double fr) {
+            mr.push_back(w);
+            m_fr.push_back(fr);
+            m_weight += w;
+        }
+
+        void add_baseline(double w, double fr) {
+            br.push_back(w);
+            b_fr.push_back(fr);
+            b_weight += w;
         }
 
         void set_radii(std::vector<double> mr_temp,
                          std::vector<double> br_temp) {
             m_radii = std::move(mr_temp);
             b_radii = std::move(br_temp);
+            m_fr.resize(m_radii.size());
+            b_fr.resize(b_radii.size());
+            for (size_t i = 0; i < m_radii.size(); i++) {
+                m_fr[i] = kernel(m_radii[i], bandwidth);
+            }
+            for (size_t i = 0; i < b_radii.size(); i++) {
+                b_fr[i] = kernel(b_radii[i], bandwidth);
+            }
         }
 
 
@@ -289,12 +376,27 @@ namespace pyscan {
         std::vector<double> br;
         std::vector<double> m_radii;
         std::vector<double> b_radii;
+        //Kernel value of every point for the current center.
+        std::vector<double> m_fr;
+        std::vector<double> b_fr;
         double m_total;
         double b_total;
+        //Total weight of mr and br.
+        double m_weight = 0.0;
+        double b_weight = 0.0;
         double bandwidth;
         kernel_func_t kernel;
     };
 
+    /*
+     * The p and q maximizing the alternative hypothesis of disc_f over [1e-4, 1 - 1e-4]^2, starting from p_init
+     * and q_init, together with the likelihood ratio there.
+     */
+    std::tuple<double, double, double> find_pq_poi(
+            double p_init,
+            double q_init,
+            const Bernoulli_Disk& disc_f);
+
     std::tuple<double, double, double> measure_kernel(
             const pt2_t& center,
             const wpoint_list_t &measured,
@@ -308,6 +410,21 @@ namespace pyscan {
             double disk_r,
             double bandwidth);
 
+    /*
+     * max_kernel_slow with its Gaussian kernel cut off at distance cutoff (4 * bandwidth leaves out kernel values
+     * below 1e-7). The points within cutoff of a center are fetched from a grid of cells of side cutoff and all the
+     * others are folded into the background terms of the likelihood, so a center costs time proportional to the
+     * number of points near it instead of n. Returns the best disk, its truncated statistic and the absolute
+     * difference between that statistic and the exact kernel statistic of the same center, p and q.
+     */
+    std::tuple<Disk, double, double> max_kernel_truncated(
+            const wpoint_list_t &measured,
+            const wpoint_list_t &baseline,
+            double grid_res,
+            double disk_r,
+            double bandwidth,
+            double cutoff);
+
     point_list_t kernel_centers_approximate(
             const wpoint_list_t &measured,
             const wpoint_list_t &baseline,
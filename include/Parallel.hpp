@@ -0,0 +1,95 @@
+#ifndef PYSCAN_PARALLEL_HPP
+#define PYSCAN_PARALLEL_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <memory>
+#include <thread>
+#include <vector>
+
+namespace pyscan {
+
+    /*
+     * Maps a requested thread count onto the number of workers we actually start.
+     * A value of 0 means use every hardware thread.
+     */
+    inline size_t resolve_thread_count(size_t threads) {
+        if (threads == 0) {
+            threads = std::thread::hardware_concurrency();
+        }
+        return threads == 0 ? 1 : threads;
+    }
+
+    /*
+     * Runs body(task, worker) for every task in [0, task_count) on a fixed set of worker threads.
+     *
+     * The task range is split into one contiguous block per worker. A worker claims grain sized
+     * pieces from the front of its own block and, once that is exhausted, steals pieces from the
+     * blocks of the other workers. This keeps neighbouring tasks (and their memory) on the same
+     * thread while still balancing uneven task costs.
+     *
+     * The worker index is in [0, workers) and can be used to address per thread scratch space.
+     * Callers that need deterministic output should store a result per task and reduce them in
+     * task order afterwards. The first exception thrown by a task is rethrown on the calling thread.
+     */
+    template <typename F>
+    void parallel_for(size_t task_count, size_t threads, F&& body, size_t grain = 1) {
+        size_t workers = std::min(resolve_thread_count(threads), task_count);
+        if (grain == 0) grain = 1;
+        if (workers <= 1) {
+            for (size_t i = 0; i < task_count; ++i) {
+                body(i, 0);
+            }
+            return;
+        }
+
+        struct alignas(64) Block {
+            std::atomic<size_t> next;
+            size_t end;
+        };
+        std::unique_ptr<Block[]> blocks(new Block[workers]);
+        for (size_t w = 0; w < workers; ++w) {
+            blocks[w].next.store(task_count * w / workers, std::memory_order_relaxed);
+            blocks[w].end = task_count * (w + 1) / workers;
+        }
+
+        std::atomic<bool> failed(false);
+        std::exception_ptr error;
+
+        auto run = [&](size_t worker) {
+            try {
+                for (size_t offset = 0; offset < workers && !failed.load(std::memory_order_relaxed); ++offset) {
+                    Block& block = blocks[(worker + offset) % workers];
+                    for (;;) {
+                        size_t start = block.next.fetch_add(grain, std::memory_order_relaxed);
+                        if (start >= block.end) break;
+                        size_t stop = std::min(start + grain, block.end);
+                        for (size_t i = start; i < stop; ++i) {
+                            body(i, worker);
+                        }
+                    }
+                }
+            } catch (...) {
+                if (!failed.exchange(true)) {
+                    error = std::current_exception();
+                }
+            }
+        };
+
+        std::vector<std::thread> pool;
+        pool.reserve(workers - 1);
+        for (size_t w = 1; w < workers; ++w) {
+            pool.emplace_back(run, w);
+        }
+        run(0);
+        for (auto& t : pool) {
+            t.join();
+        }
+        if (error) {
+            std::rethrow_exception(error);
+        }
+    }
+
+}
+#endif //PYSCAN_PARALLEL_HPP
@@ -0,0 +1,64 @@
+#ifndef PYSCAN_PERMUTATIONTEST_HPP
+#define PYSCAN_PERMUTATIONTEST_HPP
+
+#include "Point.hpp"
+
+namespace pyscan {
+
+    /*
+     * Monte Carlo permutation tests of the maximum scan statistic. The red and blue points are pooled and every
+     * replicate draws |red| of them as the red set, then records the maximum of the scan over the relabeled sets.
+     *
+     * Each returns (observed maximum, sorted null distribution, p-value) with
+     * p = (1 + #{replicates >= observed}) / (replicates + 1).
+     *
+     * Replicate i shuffles with a generator seeded from (seed, i), so the result only depends on the seed and not
+     * on the number of threads. The scans inside a replicate run single threaded; the replicates are spread over
+     * the worker threads. Everything that does not depend on the labels (the pooled points, the net and the rank
+     * mapping of the rectangle scan) is built once and shared by all of the replicates.
+     *
+     * The kernel test only shares the pooled points. max_kernel builds its coarse grids, centers and per center
+     * distances from the red and blue sets, so every replicate reruns the whole scan.
+     */
+    using permutation_result_t = std::tuple<double, std::vector<double>, double>;
+
+    permutation_result_t permutation_test_rectangle(
+            const wpoint_list_t &red,
+            const wpoint_list_t &blue,
+            double eps,
+            double a,
+            double b,
+            size_t replicates,
+            uint64_t seed,
+            size_t threads = 1);
+
+    permutation_result_t permutation_test_disk(
+            const point_list_t &point_net,
+            const wpoint_list_t &red,
+            const wpoint_list_t &blue,
+            double min_res,
+            const discrepancy_func_t &f,
+            size_t replicates,
+            uint64_t seed,
+            size_t threads = 1);
+
+    permutation_result_t permutation_test_halfplane(
+            const point_list_t &point_net,
+            const wpoint_list_t &red,
+            const wpoint_list_t &blue,
+            const discrepancy_func_t &f,
+            size_t replicates,
+            uint64_t seed,
+            size_t threads = 1);
+
+    permutation_result_t permutation_test_kernel(
+            const wpoint_list_t &red,
+            const wpoint_list_t &blue,
+            double grid_res,
+            double radius_size,
+            double bandwidth,
+            size_t replicates,
+            uint64_t seed,
+            size_t threads = 1);
+}
+#endif //PYSCAN_PERMUTATIONTEST_HPP
@@ -374,6 +374,40 @@ namespace pyscan {
     };
 
 
+    template<int dim = 2>
+    class TPoint : public WPoint<dim> {
+    public:
+        template<typename ...Coords>
+        TPoint(double time, double weight, Coords... rest)
+                : WPoint<dim>(weight, rest...), time(time) {}
+
+        TPoint()
+                : WPoint<dim>(), time(0.0) {}
+
+        virtual ~TPoint() = default;
+
+        inline double get_time() const {
+            return time;
+        }
+
+        friend std::ostream &operator<<(std::ostream &os, TPoint const &pt) {
+            os << "TPoint(" << pt.time << ", " << pt.get_weight() << ", ";
+            for (auto &el: pt.coords) {
+                os << el << ", ";
+            }
+            os << ")";
+            return os;
+        }
+
+        virtual void set_time(double t) {
+            time = t;
+        }
+
+    protected:
+        double time;
+    };
+
+
     Point<2> correct_orientation(const Point<2>& pivot, const Point<2>& p);
 
     Point<2> intersection(const Point<2> &p1, const Point<2> &p2);
@@ -409,6 +443,9 @@ namespace pyscan {
     using wpoint_it_t = wpoint_list_t::iterator;
     using cwpoint_it_t = wpoint_list_t::const_iterator;
 
+    using tpt2_t = TPoint<2>;
+    using tpoint_list_t = std::vector<TPoint<2>>;
+
     using lpoint_list_t = std::vector<LPoint<2>>;
     using lpoint_it_t = lpoint_list_t::iterator;
     using clpoint_it_t = lpoint_list_t::const_iterator;
@@ -470,7 +507,7 @@ namespace pyscan {
     }
 
     template<typename Pt, typename ...Args>
-    std::optional<bbox_t> bbox(std::vector<Pt> const& pts, Args ...rest) {
+    std::optional<bbox_t> bbox(std::vector<Pt> const& pts, Args const& ...rest) {
         if (!pts.empty()) {
             auto opt_bbox = bbox(rest...);
             auto opt_bbox2 = bbox(pts);
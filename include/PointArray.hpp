@@ -0,0 +1,168 @@
+#ifndef PYSCAN_POINTARRAY_HPP
+#define PYSCAN_POINTARRAY_HPP
+
+#include <vector>
+#include <optional>
+#include <unordered_set>
+
+#include "Point.hpp"
+
+namespace pyscan {
+
+    /*
+     * Packed structure of arrays storage for weighted (and optionally labeled) planar points.
+     *
+     * A WPoint<2> carries a vtable pointer and a homogeneous coordinate next to the two coordinates and the
+     * weight. The scan kernels only ever read x, y and the weight, so storing these as separate arrays halves
+     * the memory they stream through and lets the compiler vectorize the per point arithmetic.
+     * Coordinates are stored in euclidean form, so points are expected to have a positive homogeneous coordinate.
+     */
+    class PointArray {
+    public:
+        PointArray() = default;
+
+        explicit PointArray(const wpoint_list_t& pts) {
+            reserve(pts.size());
+            for (auto& pt : pts) {
+                push_back(pt(0), pt(1), pt.get_weight());
+            }
+        }
+
+        explicit PointArray(const lpoint_list_t& pts) {
+            reserve(pts.size());
+            for (auto& pt : pts) {
+                push_back(pt(0), pt(1), pt.get_weight(), pt.get_label());
+            }
+        }
+
+        PointArray(std::vector<double> xs, std::vector<double> ys, std::vector<double> ws) :
+            x(std::move(xs)), y(std::move(ys)), w(std::move(ws)) {
+            assert(x.size() == y.size() && y.size() == w.size());
+        }
+
+        PointArray(std::vector<double> xs, std::vector<double> ys, std::vector<double> ws, std::vector<size_t> ls) :
+            x(std::move(xs)), y(std::move(ys)), w(std::move(ws)), label(std::move(ls)) {
+            assert(x.size() == y.size() && y.size() == w.size() && w.size() == label.size());
+        }
+
+        inline size_t size() const {
+            return x.size();
+        }
+
+        inline bool empty() const {
+            return x.empty();
+        }
+
+        inline bool has_labels() const {
+            return !label.empty();
+        }
+
+        void reserve(size_t n) {
+            x.reserve(n);
+            y.reserve(n);
+            w.reserve(n);
+        }
+
+        void clear() {
+            x.clear();
+            y.clear();
+            w.clear();
+            label.clear();
+        }
+
+        inline void push_back(double px, double py, double pw) {
+            x.push_back(px);
+            y.push_back(py);
+            w.push_back(pw);
+        }
+
+        inline void push_back(double px, double py, double pw, size_t pl) {
+            push_back(px, py, pw);
+            label.push_back(pl);
+        }
+
+        /*
+         * Appends point i of other. Labels are copied when this array carries labels.
+         */
+        inline void push_back(const PointArray& other, size_t i) {
+            push_back(other.x[i], other.y[i], other.w[i]);
+            if (!other.label.empty()) {
+                label.push_back(other.label[i]);
+            }
+        }
+
+        inline wpt2_t get_wpoint(size_t i) const {
+            return wpt2_t(w[i], x[i], y[i], 1.0);
+        }
+
+        inline lpt2_t get_lpoint(size_t i) const {
+            return lpt2_t(label.empty() ? i : label[i], w[i], x[i], y[i], 1.0);
+        }
+
+        wpoint_list_t to_wpoints() const {
+            wpoint_list_t pts;
+            pts.reserve(size());
+            for (size_t i = 0; i < size(); ++i) {
+                pts.emplace_back(get_wpoint(i));
+            }
+            return pts;
+        }
+
+        lpoint_list_t to_lpoints() const {
+            lpoint_list_t pts;
+            pts.reserve(size());
+            for (size_t i = 0; i < size(); ++i) {
+                pts.emplace_back(get_lpoint(i));
+            }
+            return pts;
+        }
+
+        std::vector<double> x;
+        std::vector<double> y;
+        std::vector<double> w;
+        //Empty when the points are unlabeled.
+        std::vector<size_t> label;
+    };
+
+    inline double computeTotal(const PointArray& pts) {
+        double res = 0.0;
+        if (pts.label.empty()) {
+            for (auto weight : pts.w) res += weight;
+        } else {
+            std::unordered_set<size_t> seen;
+            for (size_t i = 0; i < pts.size(); ++i) {
+                if (seen.emplace(pts.label[i]).second) {
+                    res += pts.w[i];
+                }
+            }
+        }
+        return res;
+    }
+
+    inline std::optional<bbox_t> bbox(PointArray const& pts) {
+        if (pts.empty()) {
+            return std::nullopt;
+        }
+        auto [mnx, mxx] = std::minmax_element(pts.x.begin(), pts.x.end());
+        auto [mny, mxy] = std::minmax_element(pts.y.begin(), pts.y.end());
+        return std::make_tuple(*mnx, *mny, *mxx, *mxy);
+    }
+
+    template<typename ...Args>
+    std::optional<bbox_t> bbox(PointArray const& pts, Args const& ...rest) {
+        auto opt_bbox = bbox(rest...);
+        auto opt_bbox2 = bbox(pts);
+        if (opt_bbox.has_value() && opt_bbox2.has_value()) {
+            auto[mnx1, mny1, mxx1, mxy1] = opt_bbox.value();
+            auto[mnx2, mny2, mxx2, mxy2] = opt_bbox2.value();
+            return std::make_tuple(std::min(mnx1, mnx2), std::min(mny1, mny2), std::max(mxx1, mxx2),
+                                   std::max(mxy1, mxy2));
+        } else if (opt_bbox.has_value()) {
+            return opt_bbox;
+        } else {
+            return opt_bbox2;
+        }
+    }
+}
+
+#endif //PYSCAN_POINTARRAY_HPP
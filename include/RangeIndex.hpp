@@ -0,0 +1,210 @@
+#ifndef PYSCAN_RANGEINDEX_HPP
+#define PYSCAN_RANGEINDEX_HPP
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include "Disk.hpp"
+#include "HalfSpaceScan.hpp"
+#include "Point.hpp"
+#include "RectangleScan.hpp"
+#include "Trajectory.hpp"
+
+namespace pyscan {
+
+    struct Box {
+        double lx, ly, ux, uy;
+    };
+
+    enum class Overlap {
+        DISJOINT,
+        PARTIAL,
+        INSIDE
+    };
+
+    /*
+     * The box tests below only have to be conservative. A box is called DISJOINT or INSIDE only when every point of
+     * it is outside or inside the range, anything else is PARTIAL and is settled by the range's own predicate on
+     * the single items, so the result never depends on these tests. The disk and halfplane tests keep a relative
+     * margin because contains accepts points that are a few ulps outside.
+     */
+    const double BOX_MARGIN = 1e-9;
+
+    inline Overlap overlap(const Rectangle &rect, const Box &box) {
+        if (box.ux < rect.lowX() || box.lx > rect.upX() || box.uy < rect.lowY() || box.ly > rect.upY()) {
+            return Overlap::DISJOINT;
+        }
+        if (rect.lowX() <= box.lx && box.ux < rect.upX() && rect.lowY() <= box.ly && box.uy < rect.upY()) {
+            return Overlap::INSIDE;
+        }
+        return Overlap::PARTIAL;
+    }
+
+    inline Overlap overlap(const Disk &disk, const Box &box) {
+        auto origin = disk.getOrigin();
+        double x = origin(0), y = origin(1);
+        double r2 = disk.getRadius() * disk.getRadius();
+
+        double nx = std::max(box.lx - x, std::max(0.0, x - box.ux));
+        double ny = std::max(box.ly - y, std::max(0.0, y - box.uy));
+        if (nx * nx + ny * ny > r2 * (1 + BOX_MARGIN)) {
+            return Overlap::DISJOINT;
+        }
+        double fx = std::max(std::abs(box.lx - x), std::abs(box.ux - x));
+        double fy = std::max(std::abs(box.ly - y), std::abs(box.uy - y));
+        if (fx * fx + fy * fy < r2 * (1 - BOX_MARGIN)) {
+            return Overlap::INSIDE;
+        }
+        return Overlap::PARTIAL;
+    }
+
+    inline Overlap overlap(const halfspace2_t &plane, const Box &box) {
+        auto line = plane.get_coords();
+        double a = line[0], b = line[1], c = line[2];
+        //The line is linear over the box, so its extremes are at the corners.
+        double lo = c + std::min(a * box.lx, a * box.ux) + std::min(b * box.ly, b * box.uy);
+        double hi = c + std::max(a * box.lx, a * box.ux) + std::max(b * box.ly, b * box.uy);
+        double margin = BOX_MARGIN * (std::abs(a) * std::max(std::abs(box.lx), std::abs(box.ux)) +
+                                      std::abs(b) * std::max(std::abs(box.ly), std::abs(box.uy)) + std::abs(c));
+        if (hi < -margin) {
+            return Overlap::DISJOINT;
+        }
+        if (lo > margin) {
+            return Overlap::INSIDE;
+        }
+        return Overlap::PARTIAL;
+    }
+
+    /*
+     * A KD-tree over the bounding boxes of a set of items (points are boxes of size zero). Every node stores the
+     * box around its items and their total weight, and the items of a node are the contiguous run
+     * order[first, last).
+     */
+    class RangeIndex {
+    public:
+        struct Node {
+            Box box;
+            double weight;
+            size_t first, last;
+            size_t left, right;
+        };
+
+        RangeIndex(std::vector<Box> const &boxes, std::vector<double> const &weights);
+
+        /*
+         * Calls on_node(node) for the nodes inside the range and on_item(item) for the items of partially covered
+         * leaves that test(item) accepts.
+         */
+        template <typename Range, typename Test, typename OnNode, typename OnItem>
+        void query(const Range &range, Test &&test, OnNode &&on_node, OnItem &&on_item) const {
+            if (nodes.empty()) {
+                return;
+            }
+            size_t stack[64];
+            size_t top = 0;
+            stack[top++] = 0;
+            while (top > 0) {
+                const Node &node = nodes[stack[--top]];
+                auto o = overlap(range, node.box);
+                if (o == Overlap::DISJOINT) {
+                    continue;
+                } else if (o == Overlap::INSIDE) {
+                    on_node(node);
+                } else if (node.left == 0) {
+                    for (size_t i = node.first; i < node.last; i++) {
+                        if (test(order[i])) {
+                            on_item(order[i]);
+                        }
+                    }
+                } else {
+                    stack[top++] = node.right;
+                    stack[top++] = node.left;
+                }
+            }
+        }
+
+        size_t item(size_t i) const {
+            return order[i];
+        }
+
+        double weight(size_t item) const {
+            return weights[item];
+        }
+
+    private:
+        static const size_t LEAF_SIZE = 16;
+
+        size_t build(size_t first, size_t last);
+
+        std::vector<Box> boxes;
+        std::vector<double> weights;
+        std::vector<size_t> order;
+        std::vector<Node> nodes;
+    };
+
+    RangeIndex point_index(const wpoint_list_t &pts);
+
+    RangeIndex point_index(const lpoint_list_t &pts);
+
+    //Empty trajectories never intersect a range, so they are left out and items index the non empty ones.
+    RangeIndex trajectory_index(const trajectory_set_t &trajs, std::vector<size_t> &items);
+
+    /*
+     * A static index over a point or trajectory set for repeated range counting. It is built once in O(n log n)
+     * and a rectangle, disk or halfplane query then costs about O(sqrt(n)) plus the items near the range boundary.
+     * The weight of a range is the total weight of the points it contains, or of the trajectories it intersects,
+     * and matches range_weight up to the order of summation. inside returns the input indices of those items in
+     * increasing order.
+     */
+    class SpatialIndex {
+    public:
+        explicit SpatialIndex(const wpoint_list_t &pts);
+
+        explicit SpatialIndex(const point_list_t &pts);
+
+        explicit SpatialIndex(const trajectory_set_t &trajs);
+
+        double weight(const Disk &range) const;
+        double weight(const Rectangle &range) const;
+        double weight(const halfspace2_t &range) const;
+
+        size_t count(const Disk &range) const;
+        size_t count(const Rectangle &range) const;
+        size_t count(const halfspace2_t &range) const;
+
+        std::vector<size_t> inside(const Disk &range) const;
+        std::vector<size_t> inside(const Rectangle &range) const;
+        std::vector<size_t> inside(const halfspace2_t &range) const;
+
+        double get_total_weight() const {
+            return total_weight;
+        }
+
+        size_t size() const {
+            return item_count;
+        }
+
+    private:
+        template <typename R>
+        bool accepts(const R &range, size_t item) const;
+
+        template <typename R>
+        double weight_internal(const R &range) const;
+
+        template <typename R>
+        size_t count_internal(const R &range) const;
+
+        template <typename R>
+        std::vector<size_t> inside_internal(const R &range) const;
+
+        wpoint_list_t points;
+        trajectory_set_t trajectories;
+        //The input index of every indexed item.
+        std::vector<size_t> items;
+        RangeIndex index;
+        size_t item_count;
+        double total_weight;
+    };
+}
+#endif //PYSCAN_RANGEINDEX_HPP
@@ -161,9 +161,10 @@ namespace pyscan {
     }
 
 
-    Subgrid max_subgrid_convex(Grid const &grid, double eps, discrepancy_func_t const &f);
+    Subgrid max_subgrid_convex(Grid const &grid, double eps, discrepancy_func_t const &f, size_t threads = 1);
     Subgrid max_subgrid_linear(Grid const &grid, double a, double b);
-    Subgrid max_subgrid(Grid const &grid, discrepancy_func_t const &func);
+    std::vector<Subgrid> max_subgrid_linear(Grid const &grid, std::vector<std::tuple<double, double>> const& coeffs);
+    Subgrid max_subgrid(Grid const &grid, discrepancy_func_t const &func, size_t threads = 1);
 
     //////////////////////////////////////////////////////////////
     /////Max Labeled rectangle code///////////////////////////////
@@ -171,6 +172,10 @@ namespace pyscan {
 
     std::tuple<Rectangle, double> max_rect_labeled(size_t r, double max_w, lpoint_list_t const& m_points, lpoint_list_t const& b_points, const discrepancy_func_t& func);
 
+    /*
+     * Runs max_rect_labeled over the neighbourhood of every occupied cell of an alpha grid over the net. The cells
+     * are scanned on threads workers (0 means all hardware threads) and the result does not depend on the count.
+     */
     std::tuple<Rectangle, double> max_rect_labeled_scale(
             size_t r,
             double max_r,
@@ -178,7 +183,8 @@ namespace pyscan {
             const point_list_t &net,
             const lpoint_list_t &red,
             const lpoint_list_t &blue,
-            const discrepancy_func_t &f);
+            const discrepancy_func_t &f,
+            size_t threads = 1);
 
 
 
@@ -329,27 +335,56 @@ namespace pyscan {
     }
 
 
+    /*
+     * A read only run [first, last) of one of the buffers of a SlabArena. The run keeps a pointer to the buffer
+     * itself rather than into its memory, so it stays valid when the buffer grows or is repacked.
+     */
+    template <typename T>
+    class SlabRun {
+    public:
+        SlabRun() : buffer(nullptr), first(0), last(0) {}
+        SlabRun(const std::vector<T>* buffer, size_t first, size_t last) : buffer(buffer), first(first), last(last) {}
+
+        using const_iterator = typename std::vector<T>::const_iterator;
+
+        const_iterator begin() const { return buffer == nullptr ? const_iterator() : buffer->cbegin() + first; }
+        const_iterator end() const { return buffer == nullptr ? const_iterator() : buffer->cbegin() + last; }
+        size_t size() const { return last - first; }
+        bool empty() const { return first == last; }
+        const T& operator[](size_t i) const { return (*buffer)[first + i]; }
+
+        friend std::ostream& operator<<(std::ostream& os, SlabRun const& run) {
+            os << "[";
+            for (auto it = run.begin(); it != run.end(); ++it) {
+                os << (it == run.begin() ? "" : ", ") << *it;
+            }
+            os << "]";
+            return os;
+        }
+
+    private:
+        const std::vector<T>* buffer;
+        size_t first;
+        size_t last;
+    };
+
     class Slab {
 
     public:
         //This is the union of m_merges and b_merges and all child m_merges and b_merges.
-        std::vector<size_t> global_split_offset;
+        SlabRun<size_t> global_split_offset;
 
-        epoint_list_t m_merges;
-        epoint_list_t b_merges;
+        SlabRun<ept_t> m_merges;
+        SlabRun<ept_t> b_merges;
 
         size_t top_y;
         size_t bottom_y;
 
-        std::weak_ptr<Slab> parent;
-        std::shared_ptr<Slab> up;
-        std::shared_ptr<Slab> down;
+        Slab* parent = nullptr;
+        Slab* up = nullptr;
+        Slab* down = nullptr;
 
-        Slab(std::weak_ptr<Slab> p,
-             epoint_list_t m_m,
-             epoint_list_t b_m,
-             size_t ty,
-             size_t by);
+        Slab(Slab* p, size_t ty, size_t by) : top_y(ty), bottom_y(by), parent(p) {}
 
         size_t get_mid() const {
             size_t midpoint;
@@ -365,7 +400,7 @@ namespace pyscan {
             return down != nullptr || up != nullptr;
         }
 
-        friend std::ostream& operator<<(std::ostream& os, std::shared_ptr<Slab> el) {
+        friend std::ostream& operator<<(std::ostream& os, Slab const* el) {
             if (el == nullptr) {
                 os << "[]";
             } else {
@@ -377,9 +412,18 @@ namespace pyscan {
         double measure_interval(size_t mxx, size_t mnx, double a, double b) const;
     };
 
-    using slab_ptr = std::shared_ptr<Slab>;
-    using wslab_ptr = std::weak_ptr<Slab>;
-    using slab_it_t = std::vector<Slab>::const_iterator;
+    using slab_ptr = Slab*;
+
+    /*
+     * The storage shared by a SlabTree and every subtree view taken from it. The slabs are allocated once and link
+     * to each other with plain pointers, and their merge lists and split offsets are runs of three flat buffers.
+     */
+    struct SlabArena {
+        std::vector<Slab> slabs;
+        epoint_list_t m_points;
+        epoint_list_t b_points;
+        std::vector<size_t> splits;
+    };
 
     class SlabTree {
 
@@ -390,17 +434,29 @@ namespace pyscan {
         }
 
         slab_ptr get_containing(size_t upY, size_t lowY) const;
-        SlabTree(slab_ptr child, double tm, double tb) : root(child), total_m(tm), total_b(tb) {}
+        SlabTree(std::shared_ptr<SlabArena> arena, slab_ptr child, double tm, double tb) :
+            arena(std::move(arena)), root(child), total_m(tm), total_b(tb) {}
 
         SlabTree(epoint_list_t ms, epoint_list_t bs, double max_w);
+        /*
+         * The same tree as SlabTree(ms, bs, max_w) followed by even_compress(even_w), except that each slab's merges
+         * are compressed as the slab is built, so the uncompressed lists of the whole tree never exist at once.
+         */
+        SlabTree(epoint_list_t ms, epoint_list_t bs, double max_w, double even_w);
         SlabTree(std::vector<size_t> vert_decomp, epoint_list_t ms, epoint_list_t bs);
 
         //Useful for debuging the structure so you can define a non compressed version with fixed decomposition.
-        void init(epoint_list_t mpts, epoint_list_t bpts, std::vector<size_t> const& vert_decomp);
+        //An even_w above 0 even compresses every slab as it is built.
+        void init(epoint_list_t mpts, epoint_list_t bpts, std::vector<size_t> const& vert_decomp, double even_w = 0);
 
         double measure_rect(ERectangle const &rect, double a, double b) const;
         std::tuple<ERectangle, double> max_rectangle_midpoint(double m_a, double b_b);
-        std::tuple<ERectangle, double> max_rectangle(double m_a, double b_b);
+        /*
+         * Scans every subtree with max_rectangle_midpoint. With more than one thread (0 means all hardware threads)
+         * the midpoint recursions are split into independent frames and run in parallel. The result does not
+         * depend on the thread count.
+         */
+        std::tuple<ERectangle, double> max_rectangle(double m_a, double b_b, size_t threads = 1);
 
         std::tuple<ERectangle, double> max_rectangle_slow(double m_a, double b_a);
 
@@ -430,12 +486,13 @@ namespace pyscan {
             return os;
         }
 
+        //Subtrees are views that share the slabs and buffers of this tree.
         SlabTree get_upper_tree() const {
-            return SlabTree(root->up, total_m, total_b);
+            return SlabTree(arena, root->up, total_m, total_b);
         }
 
         SlabTree get_lower_tree() const {
-            return SlabTree(root->down, total_m, total_b);
+            return SlabTree(arena, root->down, total_m, total_b);
         }
 
         void reset_splits();
@@ -450,6 +507,12 @@ namespace pyscan {
         std::tuple<epoint_list_t, epoint_list_t> dyadic_approx(size_t upper, size_t lower) const;
 
     private:
+        std::vector<slab_ptr> get_slabs() const;
+
+        template <typename Compress>
+        void compress_merges(Compress compress);
+
+        std::shared_ptr<SlabArena> arena;
         slab_ptr root;
         double total_m;
         double total_b;
@@ -515,12 +578,20 @@ namespace pyscan {
     }
 
     std::vector<MaxIntervalAlt> insert_updates(std::vector<MaxIntervalAlt> const& max_intervals,
-                                               epoint_list_t const& updates, double scale);
+                                               SlabRun<ept_t> const& updates, double scale);
 
     std::vector<MaxIntervalAlt> reduce_merges(std::vector<MaxIntervalAlt> const& max_intervals,
-                                              std::vector<size_t> const& curr_splits);
+                                              SlabRun<size_t> const& curr_splits);
+
+    std::tuple<Rectangle, double> max_rectangle(const wpoint_list_t& m_points, const wpoint_list_t& b_points, double eps, double a, double b,
+            size_t threads = 1);
 
-    std::tuple<Rectangle, double> max_rectangle(const wpoint_list_t& m_points, const wpoint_list_t& b_points, double eps, double a, double b);
+    /*
+     * The scan behind max_rectangle for points that are already mapped to ranks by to_epoints. This lets callers
+     * rank a point set once and scan many subsets of it.
+     */
+    std::tuple<ERectangle, double> max_erectangle(const epoint_list_t& m_points, const epoint_list_t& b_points, double eps, double a, double b,
+            size_t threads = 1);
 
 
 
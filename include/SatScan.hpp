@@ -7,25 +7,69 @@
 
 #ifndef PYSCAN_SATSCAN_HPP
 #define PYSCAN_SATSCAN_HPP
+
+#include "Disk.hpp"
+#include "Point.hpp"
+#include "PointArray.hpp"
+
 namespace pyscan {
 
     /*
      * These methods use disks that are defined by points in a grid or
      * as points in the measured and baseline sets.
+     *
+     * Every center of a grid_res grid over the points (grown by disk_r) is tried with every disk of radius at most
+     * disk_r, so only the points within disk_r of a center are fetched and sorted. The columns of centers are
+     * scanned on threads workers (0 means all hardware threads) and the result does not depend on the thread count.
+     * A PointArray with labels is scanned as a labeled set.
      */
     std::tuple<Disk, double> satscan_grid(
             const wpoint_list_t &measured,
             const wpoint_list_t &baseline,
             double grid_res,
             double disk_r,
-            discrepancy_func_t const& func);
+            discrepancy_func_t const& func,
+            size_t threads = 1);
+
+    std::tuple<Disk, double> satscan_grid(
+            const PointArray &measured,
+            const PointArray &baseline,
+            double grid_res,
+            double disk_r,
+            discrepancy_func_t const& func,
+            size_t threads = 1);
 
     std::tuple<Disk, double> satscan_grid_labeled(
             const lpoint_list_t &measured,
             const lpoint_list_t &baseline,
             double grid_res,
             double disk_r,
-            discrepancy_func_t const& func);
+            discrepancy_func_t const& func,
+            size_t threads = 1);
+
+    /*
+     * The number of grid columns and rows of centers satscan_grid tries on these sets.
+     */
+    std::tuple<size_t, size_t> satscan_grid_shape(
+            const PointArray &measured,
+            const PointArray &baseline,
+            double grid_res,
+            double disk_r);
+
+    /*
+     * Runs satscan_grid and also writes the best disk of every center to out, which must hold
+     * 4 * columns * rows doubles for the shape given by satscan_grid_shape. Center (c, r) is written at
+     * out[4 * (c * rows + r)] as its x, y, best radius and best statistic. A center with no point within disk_r
+     * gets radius 0 and statistic -inf.
+     */
+    std::tuple<Disk, double> satscan_grid_profile(
+            const PointArray &measured,
+            const PointArray &baseline,
+            double grid_res,
+            double disk_r,
+            discrepancy_func_t const& func,
+            double* out,
+            size_t threads = 1);
 
 }
 #endif //PYSCAN_SATSCAN_HPP
@@ -0,0 +1,93 @@
+#ifndef PYSCAN_SIMD_HPP
+#define PYSCAN_SIMD_HPP
+
+/*
+ * A thin wrapper over the widest vector unit the build targets, shared by the kernels that vectorize by hand.
+ * PYSCAN_SIMD is defined when one is available; code without it has to fall back to a scalar loop.
+ */
+#if defined(__AVX512F__) || defined(__AVX2__)
+#define PYSCAN_SIMD 1
+#include <immintrin.h>
+#endif
+
+#include <cstddef>
+#include <cstdint>
+
+namespace pyscan {
+
+#if defined(PYSCAN_SIMD)
+#if defined(__AVX512F__)
+    struct Simd {
+        using vec = __m512d;
+        using ivec = __m512i;
+        using mask = __mmask8;
+        static constexpr size_t width = 8;
+
+        static inline vec load(const double* p) { return _mm512_loadu_pd(p); }
+        static inline void store(double* p, vec a) { _mm512_storeu_pd(p, a); }
+        static inline vec set1(double a) { return _mm512_set1_pd(a); }
+        static inline vec add(vec a, vec b) { return _mm512_add_pd(a, b); }
+        static inline vec sub(vec a, vec b) { return _mm512_sub_pd(a, b); }
+        static inline vec mul(vec a, vec b) { return _mm512_mul_pd(a, b); }
+        static inline vec div(vec a, vec b) { return _mm512_div_pd(a, b); }
+        static inline vec abs(vec a) { return _mm512_abs_pd(a); }
+
+        static inline mask lt(vec a, vec b) { return _mm512_cmp_pd_mask(a, b, _CMP_LT_OQ); }
+        static inline mask le(vec a, vec b) { return _mm512_cmp_pd_mask(a, b, _CMP_LE_OQ); }
+        static inline mask gt(vec a, vec b) { return _mm512_cmp_pd_mask(a, b, _CMP_GT_OQ); }
+        static inline mask ge(vec a, vec b) { return _mm512_cmp_pd_mask(a, b, _CMP_GE_OQ); }
+        static inline mask m_and(mask a, mask b) { return a & b; }
+        static inline mask m_or(mask a, mask b) { return a | b; }
+        static inline mask m_not(mask a) { return static_cast<mask>(~a); }
+        static inline mask m_none() { return 0; }
+        static inline unsigned bits(mask a) { return a; }
+        //a where m is set, b elsewhere.
+        static inline vec select(mask m, vec a, vec b) { return _mm512_mask_blend_pd(m, b, a); }
+
+        static inline ivec as_int(vec a) { return _mm512_castpd_si512(a); }
+        static inline vec as_double(ivec a) { return _mm512_castsi512_pd(a); }
+        static inline ivec iset1(int64_t a) { return _mm512_set1_epi64(a); }
+        static inline ivec iand(ivec a, ivec b) { return _mm512_and_si512(a, b); }
+        static inline ivec ior(ivec a, ivec b) { return _mm512_or_si512(a, b); }
+        static inline ivec srl52(ivec a) { return _mm512_srli_epi64(a, 52); }
+    };
+#else
+    struct Simd {
+        using vec = __m256d;
+        using ivec = __m256i;
+        using mask = __m256d;
+        static constexpr size_t width = 4;
+
+        static inline vec load(const double* p) { return _mm256_loadu_pd(p); }
+        static inline void store(double* p, vec a) { _mm256_storeu_pd(p, a); }
+        static inline vec set1(double a) { return _mm256_set1_pd(a); }
+        static inline vec add(vec a, vec b) { return _mm256_add_pd(a, b); }
+        static inline vec sub(vec a, vec b) { return _mm256_sub_pd(a, b); }
+        static inline vec mul(vec a, vec b) { return _mm256_mul_pd(a, b); }
+        static inline vec div(vec a, vec b) { return _mm256_div_pd(a, b); }
+        static inline vec abs(vec a) { return _mm256_andnot_pd(_mm256_set1_pd(-0.0), a); }
+
+        static inline mask lt(vec a, vec b) { return _mm256_cmp_pd(a, b, _CMP_LT_OQ); }
+        static inline mask le(vec a, vec b) { return _mm256_cmp_pd(a, b, _CMP_LE_OQ); }
+        static inline mask gt(vec a, vec b) { return _mm256_cmp_pd(a, b, _CMP_GT_OQ); }
+        static inline mask ge(vec a, vec b) { return _mm256_cmp_pd(a, b, _CMP_GE_OQ); }
+        static inline mask m_and(mask a, mask b) { return _mm256_and_pd(a, b); }
+        static inline mask m_or(mask a, mask b) { return _mm256_or_pd(a, b); }
+        static inline mask m_not(mask a) { return _mm256_xor_pd(a, _mm256_castsi256_pd(_mm256_set1_epi64x(-1))); }
+        static inline mask m_none() { return _mm256_setzero_pd(); }
+        static inline unsigned bits(mask a) { return static_cast<unsigned>(_mm256_movemask_pd(a)); }
+        //a where m is set, b elsewhere.
+        static inline vec select(mask m, vec a, vec b) { return _mm256_blendv_pd(b, a, m); }
+
+        static inline ivec as_int(vec a) { return _mm256_castpd_si256(a); }
+        static inline vec as_double(ivec a) { return _mm256_castsi256_pd(a); }
+        static inline ivec iset1(int64_t a) { return _mm256_set1_epi64x(a); }
+        static inline ivec iand(ivec a, ivec b) { return _mm256_and_si256(a, b); }
+        static inline ivec ior(ivec a, ivec b) { return _mm256_or_si256(a, b); }
+        static inline ivec srl52(ivec a) { return _mm256_srli_epi64(a, 52); }
+    };
+#endif
+#endif
+}
+
+#endif //PYSCAN_SIMD_HPP
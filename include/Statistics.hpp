@@ -7,6 +7,9 @@
 #include <cmath>
 #include <limits>
 #include <iostream>
+#include <functional>
+
+#include "Point.hpp"
 
 
 namespace pyscan {
@@ -63,10 +66,48 @@ namespace pyscan {
     }
 
 
-    inline discrepancy_func_t get_bernoulli(double rho) {
-        //G = 1.0;
-        auto bernoulli = [rho] (double m_sub, double m_total, double b_sub, double b_total) {
+    /*
+     * The built in statistics as plain function objects. A discrepancy_func_t constructed from one of these
+     * can be recognized with target<T>(), which is how evaluate_batch finds its vectorized kernels.
+     */
+    struct KulldorffStat {
+        double rho;
+        inline double operator()(double m_sub, double m_total, double b_sub, double b_total) const {
+            return kulldorff(m_sub / m_total, b_sub / b_total, rho);
+        }
+    };
+
+    struct RegularizedKulldorffStat {
+        double rho;
+        inline double operator()(double m_sub, double m_total, double b_sub, double b_total) const {
+            return regularized_kulldorff(m_sub / m_total, b_sub / b_total, rho);
+        }
+    };
+
+    struct GammaStat {
+        double rho;
+        inline double operator()(double m_sub, double m_total, double b_sub, double b_total) const {
+            return gamma(m_sub / m_total, b_sub / b_total, rho);
+        }
+    };
+
+    struct DiscStat {
+        inline double operator()(double m_sub, double m_total, double b_sub, double b_total) const {
+            return std::abs(m_sub / m_total - b_sub / b_total);
+        }
+    };
 
+    struct LinearStat {
+        double a;
+        double b;
+        inline double operator()(double m_sub, double m_total, double b_sub, double b_total) const {
+            return a * m_sub / m_total + b * b_sub / b_total;
+        }
+    };
+
+    struct BernoulliStat {
+        double rho;
+        inline double operator()(double m_sub, double m_total, double b_sub, double b_total) const {
             double p = m_sub / (b_sub + m_sub);
             double q = (m_total - m_sub) / (b_total - b_sub + m_total - m_sub);
             return m_sub * log(p)
@@ -75,14 +116,12 @@ namespace pyscan {
                    + (b_total - b_sub) * log(1 - q)
                    - m_total * log(m_total / (b_total + m_total))
                    - b_total * log(1 - m_total/ (m_total + b_total));
-        };
-        discrepancy_func_t b_f = bernoulli;
-        return b_f;
-    }
+        }
+    };
 
-    inline discrepancy_func_t get_bernoulli_single_sample(double rho) {
-        //G = 1.0;
-        auto bernoulli = [rho] (double m_sub, double m_total, double b_sub, double b_total) {
+    struct BernoulliSingleSampleStat {
+        double rho;
+        inline double operator()(double m_sub, double m_total, double b_sub, double b_total) const {
             //Bound the function.
             // This changes the behaviour when the region is very large or small to prevent the function's lipshitz
             // parameter from blowing up.
@@ -93,8 +132,6 @@ namespace pyscan {
             //n_z = m_sub
             //n_G = m_total
             //mu(G) = b_total
-            //double m_r = m_sub / m_total;
-            //double b_r = b_sub / b_total;
             double p = m_sub / (b_sub);
             double q = (m_total - m_sub) / (b_total - b_sub);
 
@@ -104,11 +141,94 @@ namespace pyscan {
                    + (b_total - m_total -(b_sub - m_sub)) * log(1 - q)
                    - m_total * log(m_total / b_total)
                    - (b_total - m_total) * log(1 - m_total / b_total);
-        };
-        discrepancy_func_t b_f = bernoulli;
-        return b_f;
+        }
+    };
+
+    inline discrepancy_func_t get_bernoulli(double rho) {
+        //G = 1.0;
+        return discrepancy_func_t(BernoulliStat{rho});
+    }
+
+    inline discrepancy_func_t get_bernoulli_single_sample(double rho) {
+        //G = 1.0;
+        return discrepancy_func_t(BernoulliSingleSampleStat{rho});
+    }
+
+    /*
+     * Calls body with the statistic held by f as its concrete type, so a scan written as a template over the
+     * statistic gets an instantiation with the statistic inlined. Anything that is not one of the built in
+     * statistics is passed through as the std::function.
+     */
+    template <typename F>
+    decltype(auto) dispatch_statistic(const discrepancy_func_t& f, F&& body) {
+        if (auto stat = f.target<KulldorffStat>()) {
+            return body(*stat);
+        } else if (auto stat = f.target<RegularizedKulldorffStat>()) {
+            return body(*stat);
+        } else if (auto stat = f.target<GammaStat>()) {
+            return body(*stat);
+        } else if (auto stat = f.target<DiscStat>()) {
+            return body(*stat);
+        } else if (auto stat = f.target<LinearStat>()) {
+            return body(*stat);
+        } else if (auto stat = f.target<BernoulliStat>()) {
+            return body(*stat);
+        } else if (auto stat = f.target<BernoulliSingleSampleStat>()) {
+            return body(*stat);
+        } else {
+            return body(f);
+        }
     }
 
+    /*
+     * Evaluates f(m_sub[i], m_total, b_sub[i], b_total) into out[i] for i in [0, n).
+     *
+     * When f holds one of the statistics above the whole array goes through a SIMD kernel (AVX-512 or AVX2,
+     * whichever the build targets). A custom discrepancy_func_t falls back to one call per entry.
+     * The kernels use their own vectorized log, so values can differ from the scalar path in the last bit.
+     */
+    void evaluate_batch(const discrepancy_func_t& f,
+            const double* m_sub, const double* b_sub, size_t n,
+            double m_total, double b_total,
+            double* out);
+
+    /*
+     * The same for a statistic whose type is known at compile time. This is instantiated for each of the
+     * statistic structs above.
+     */
+    template <typename Stat>
+    void evaluate_batch(const Stat& stat,
+            const double* m_sub, const double* b_sub, size_t n,
+            double m_total, double b_total,
+            double* out);
+
+    /*
+     * A statistic with the totals bound. Sweeps that only see the (m_sub, b_sub) pairs take one of these
+     * wrapped in a std::function<double(double, double)> and still reach the batch kernels.
+     */
+    class BoundStatistic {
+    public:
+        BoundStatistic(discrepancy_func_t f, double m_total, double b_total) :
+            f(std::move(f)), m_total(m_total), b_total(b_total) {}
+
+        inline double operator()(double m_sub, double b_sub) const {
+            return f(m_sub, m_total, b_sub, b_total);
+        }
+
+        void evaluate(const double* m_sub, const double* b_sub, size_t n, double* out) const {
+            evaluate_batch(f, m_sub, b_sub, n, m_total, b_total, out);
+        }
+
+    private:
+        discrepancy_func_t f;
+        double m_total;
+        double b_total;
+    };
+
+    void evaluate_batch(const std::function<double(double, double)>& f,
+            const double* m_sub, const double* b_sub, size_t n,
+            double* out);
+
     inline double linear(double mr, double br) {
         return  fabs(mr - br);
     }
@@ -0,0 +1,43 @@
+#ifndef PYSCAN_TEMPORALSCAN_HPP
+#define PYSCAN_TEMPORALSCAN_HPP
+
+#include "Disk.hpp"
+#include "Point.hpp"
+#include "RectangleScan.hpp"
+
+namespace pyscan {
+
+    /*
+     * Space time scans over timestamped points. The windows are [t, t + window) for t = t_min, t_min + stride, ...
+     * where t_min is the earliest timestamp, up to the last timestamp. One (t, region, value) entry is returned
+     * for every window and each entry is the same region the spatial scan would find on the points in that window.
+     */
+
+    /*
+     * Slides a DiskScanner over the windows, so each step only removes the points that left the window, inserts
+     * the ones that entered it and rescans the grid cells around them.
+     */
+    std::vector<std::tuple<double, Disk, double>> max_disk_scale_windows(
+            const point_list_t &point_net,
+            const tpoint_list_t &red,
+            const tpoint_list_t &blue,
+            double min_res,
+            double window,
+            double stride,
+            const discrepancy_func_t &f,
+            size_t threads = 1);
+
+    /*
+     * Ranks all of the points once with to_epoints and builds the SlabTree of each window from the already ranked
+     * points, so the coordinates are never sorted again.
+     */
+    std::vector<std::tuple<double, Rectangle, double>> max_rectangle_windows(
+            const tpoint_list_t &red,
+            const tpoint_list_t &blue,
+            double eps,
+            double a,
+            double b,
+            double window,
+            double stride);
+}
+#endif //PYSCAN_TEMPORALSCAN_HPP
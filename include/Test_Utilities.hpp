@@ -26,6 +26,8 @@ namespace pyscantest {
 
 	auto randomLPoints2(size_t test_size, size_t label_count) -> std::vector<pyscan::LPoint<>>;
 
+	auto randomTPoints2(size_t test_size, double max_time) -> std::vector<pyscan::TPoint<>>;
+
     auto randomPoints3(size_t test_size) -> std::vector<pyscan::Point<3>>;
 
     auto randomWPoints3(size_t test_size) -> std::vector<pyscan::WPoint<3>>;
@@ -38,16 +38,48 @@ def my_sample(samp, count):
     return random.sample(samp, min(len(samp), int(count + .5)))
 
 
+def evaluate_index(range, m_index, b_index, disc_f):
+    """
+    Evaluates this range against two prebuilt SpatialIndex objects. Each call only touches the part of the indices
+    near the range boundary, so this is the way to evaluate many ranges against the same sets.
+
+    :param range: A disk, halfplane or rectangle.
+    :param m_index: SpatialIndex over the measured set.
+    :param b_index: SpatialIndex over the baseline set.
+    :param disc_f: Discrepancy function.
+    :return: Discrepancy function value.
+    """
+    return evaluate(disc_f, m_index.weight(range), m_index.get_total_weight(),
+                    b_index.weight(range), b_index.get_total_weight())
+
+
+def split_by_range(items, index, reg):
+    """
+    Splits items into the ones inside reg and the ones outside of it.
+
+    :param items: The list the index was built over.
+    :param index: SpatialIndex over items.
+    :param reg: A disk, halfplane or rectangle.
+    :return: items inside reg, items outside of reg.
+    """
+    mask = [False] * len(items)
+    for i in index.inside(reg):
+        mask[i] = True
+    return [item for item, m in zip(items, mask) if m], [item for item, m in zip(items, mask) if not m]
+
+
 def evaluate_range(range, mp, bp, disc_f):
     """
     Evaluates this range to compute the total discrepancy over a set of points.
 
     :param range: Some arbitrary range.
-    :param mp: measured set
-    :param bp: baseline set
+    :param mp: measured set, or a SpatialIndex built over it
+    :param bp: baseline set, or a SpatialIndex built over it
     :param disc_f: Discrepancy function.
     :return: Discrepancy function value.
     """
+    if isinstance(mp, SpatialIndex) and isinstance(bp, SpatialIndex):
+        return evaluate_index(range, mp, bp, disc_f)
     if not mp and not bp:
         return evaluate(disc_f, 0, 0, 0, 0)
     elif not mp:
@@ -77,12 +109,14 @@ def evaluate_range_trajectory(range, mp, bp, disc_f):
     Evaluates this range to compute the total discrepancy over a set of trajectories.
 
     :param range: Some arbitrary range.
-    :param mp: measured set
-    :param bp: baseline set
+    :param mp: measured set, or a SpatialIndex built over it
+    :param bp: baseline set, or a SpatialIndex built over it
     :param disc_f: Discrepancy function.
     :return: Discrepancy function value.
     """
 
+    if isinstance(mp, SpatialIndex) and isinstance(bp, SpatialIndex):
+        return evaluate_index(range, mp, bp, disc_f)
     if not mp and not bp:
         return evaluate(disc_f, 0, 0, 0, 0)
     if isinstance(range, Disk):
@@ -95,6 +129,41 @@ def evaluate_range_trajectory(range, mp, bp, disc_f):
         raise ValueError()
 
 
+def evaluate_ranges(ranges, mp, bp, disc_f, threads=1):
+    """
+    Evaluates a list of ranges of one type against the same point or trajectory sets in a single call.
+
+    :param ranges: List of disks, halfplanes or rectangles.
+    :param mp: measured set
+    :param bp: baseline set
+    :param disc_f: Discrepancy function.
+    :param threads: Number of worker threads, 0 uses every hardware thread.
+    :return: numpy array with the discrepancy function value of each range.
+    """
+    if len(ranges) == 0:
+        return evaluate_disks([], [], [], disc_f)
+    if len(mp) == 0 and len(bp) == 0:
+        return evaluate_disks([Disk(0, 0, 0)] * len(ranges), [], [], disc_f)
+    pt_obj = mp[0] if len(mp) > 0 else bp[0]
+
+    if isinstance(pt_obj, LPoint):
+        suffix = "_labeled"
+    elif isinstance(pt_obj, WPoint):
+        suffix = ""
+    else:
+        suffix = "_trajectory"
+
+    if isinstance(ranges[0], Disk):
+        name = "evaluate_disks"
+    elif isinstance(ranges[0], Halfplane):
+        name = "evaluate_halfplanes"
+    elif isinstance(ranges[0], Rectangle):
+        name = "evaluate_rectangles"
+    else:
+        raise ValueError()
+    return getattr(lp, name + suffix)(ranges, mp, bp, disc_f, threads)
+
+
 def split_set(pts, rate):
     red_set = my_sample(pts, len(pts) * rate)
     red_set_set = set(red_set)
@@ -170,13 +239,14 @@ def plant_full_square(trajectories, r, p, q, max_count=32):
             return None
 
     seed_pt = random.choice(traj)
+    index = SpatialIndex([Trajectory(traj) for traj in trajectories])
     upper_bound = 1.0
     lower_bound = 0.0
     num = 0
     while num < max_count:
         size = (upper_bound + lower_bound) / 2
         reg = Rectangle(seed_pt[0] + size / 2, seed_pt[1] + size / 2, seed_pt[0] - size / 2, seed_pt[1] - size / 2)
-        count = sum(1 for traj in trajectories if reg.intersects_trajectory(Trajectory(traj)))
+        count = index.count(reg)
         if abs(count - r * len(trajectories)) <= 2:
             break
         if count - r * len(trajectories) > 0:
@@ -186,9 +256,8 @@ def plant_full_square(trajectories, r, p, q, max_count=32):
         num += 1
 
 
-    inside_rect = [traj for traj in trajectories if reg.intersects_trajectory(Trajectory(traj))]
+    inside_rect, outside_rect = split_by_range(trajectories, index, reg)
     red_in, blue_in = split_set([tuple(traj) for traj in inside_rect], q)
-    outside_rect = [traj for traj in trajectories if not reg.intersects_trajectory(Trajectory(traj))]
     red_out, blue_out = split_set([tuple(traj) for traj in outside_rect], p)
 
     diff = evaluate(disc, len(red_in), len(red_in) + len(red_out), len(blue_in), len(blue_in) + len(blue_out))
@@ -251,8 +320,7 @@ def plant_partial_halfplane(trajectories, r, p, q, eps):
     lc = pt[0] * rand_direc[0] + pt[1] * rand_direc[1]
     plant_region = Halfplane(Point(rand_direc[0], rand_direc[1], -lc))
 
-    inside_disk = [traj for traj in trajectory_obj if plant_region.intersects_trajectory(traj)]
-    outside_disk = [traj for traj in trajectory_obj if not plant_region.intersects_trajectory(traj)]
+    inside_disk, outside_disk = split_by_range(trajectory_obj, SpatialIndex(trajectory_obj), plant_region)
 
     red_in, blue_in = split_set(inside_disk, q)
     red_out, blue_out = split_set(outside_disk, p)
@@ -316,8 +384,7 @@ def plant_partial_disk(trajectories, r, p, q, eps):
 
     disk_boundary = trajectories[int(r * len(all_pts))]
     max_disk = Disk(origin[0], origin[1], origin.dist(disk_boundary))
-    inside_disk = [traj for traj in trajectory_obj if max_disk.intersects_trajectory(traj)]
-    outside_disk = [traj for traj in trajectory_obj if not max_disk.intersects_trajectory(traj)]
+    inside_disk, outside_disk = split_by_range(trajectory_obj, SpatialIndex(trajectory_obj), max_disk)
 
     red_in, blue_in = split_set(inside_disk, q)
     red_out, blue_out = split_set(outside_disk, p)
@@ -409,14 +476,7 @@ def plant_rectangle(pts, r, p, q):
     """
 
     rect = random_rect(pts, r)
-
-    inside_rect = []
-    outside_rect = []
-    for pt in pts:
-        if rect.contains(pt):
-            inside_rect.append(pt)
-        else:
-            outside_rect.append(pt)
+    inside_rect, outside_rect = split_by_range(pts, SpatialIndex(pts), rect)
 
     red_in, blue_in = split_set(inside_rect, q)
     red_out, blue_out = split_set(outside_rect, p)
@@ -499,8 +559,7 @@ def plant_partial_rectangle(trajectories, r, p, q, eps):
     trajectory_obj = [Trajectory(pts) for pts in trajectories]
     all_pts = uniform_sample(trajectory_obj, int(1 / eps ** 2 + 1), False)
     _, _, rect = plant_rectangle(all_pts, r, p, q)
-    inside_rect = [traj for traj in trajectory_obj if rect.intersects_trajectory(traj)]
-    outside_rect = [traj for traj in trajectory_obj if not rect.intersects_trajectory(traj)]
+    inside_rect, outside_rect = split_by_range(trajectory_obj, SpatialIndex(trajectory_obj), rect)
     red_in, blue_in = split_set(inside_rect, q)
     red_out, blue_out = split_set(outside_rect, p)
 
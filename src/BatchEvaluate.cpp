@@ -0,0 +1,199 @@
+#include <unordered_map>
+
+#include "BatchEvaluate.hpp"
+#include "Parallel.hpp"
+#include "RangeIndex.hpp"
+#include "Statistics.hpp"
+
+namespace pyscan {
+
+    /*
+     * The labels of a labeled point set renamed to 0..L-1, so the per range label sets can be flat arrays.
+     */
+    static std::vector<size_t> compact_labels(const lpoint_list_t &pts, size_t &label_count) {
+        std::unordered_map<size_t, size_t> ids;
+        std::vector<size_t> labels;
+        labels.reserve(pts.size());
+        for (auto &pt : pts) {
+            labels.push_back(ids.emplace(pt.get_label(), ids.size()).first->second);
+        }
+        label_count = ids.size();
+        return labels;
+    }
+
+    /*
+     * For each label the smallest index of a point in the range, kept as generation stamped flat arrays so a new
+     * range does not have to clear them.
+     */
+    struct LabelScratch {
+        std::vector<size_t> stamp;
+        std::vector<size_t> first;
+        std::vector<size_t> touched;
+        size_t generation = 0;
+
+        explicit LabelScratch(size_t label_count) : stamp(label_count, 0), first(label_count, 0) {}
+    };
+
+    template <typename R>
+    static double labeled_weight(const R &range, const lpoint_list_t &pts, const RangeIndex &index,
+            const std::vector<size_t> &labels, LabelScratch &scratch) {
+        scratch.generation++;
+        scratch.touched.clear();
+        auto visit = [&](size_t item) {
+            size_t label = labels[item];
+            if (scratch.stamp[label] != scratch.generation) {
+                scratch.stamp[label] = scratch.generation;
+                scratch.first[label] = item;
+                scratch.touched.push_back(label);
+            } else if (item < scratch.first[label]) {
+                scratch.first[label] = item;
+            }
+        };
+        index.query(range,
+                [&](size_t item) { return range.contains(pts[item]); },
+                [&](RangeIndex::Node const &node) {
+                    for (size_t i = node.first; i < node.last; i++) {
+                        visit(index.item(i));
+                    }
+                },
+                visit);
+        double weight = 0;
+        for (size_t label : scratch.touched) {
+            weight += pts[scratch.first[label]].get_weight();
+        }
+        return weight;
+    }
+
+    template <typename R>
+    static std::vector<double> evaluate_ranges_internal(const std::vector<R> &ranges,
+            const wpoint_list_t &red, const wpoint_list_t &blue,
+            const discrepancy_func_t &f, size_t threads) {
+        auto red_index = point_index(red);
+        auto blue_index = point_index(blue);
+        std::vector<double> m_sub(ranges.size()), b_sub(ranges.size());
+        auto weight = [](const R &range, const wpoint_list_t &pts, const RangeIndex &index) {
+            double w = 0;
+            index.query(range,
+                    [&](size_t item) { return range.contains(pts[item]); },
+                    [&](RangeIndex::Node const &node) { w += node.weight; },
+                    [&](size_t item) { w += index.weight(item); });
+            return w;
+        };
+        parallel_for(ranges.size(), threads, [&](size_t i, size_t) {
+            m_sub[i] = weight(ranges[i], red, red_index);
+            b_sub[i] = weight(ranges[i], blue, blue_index);
+        }, 64);
+
+        std::vector<double> values(ranges.size());
+        evaluate_batch(f, m_sub.data(), b_sub.data(), ranges.size(), computeTotal(red), computeTotal(blue),
+                values.data());
+        return values;
+    }
+
+    template <typename R>
+    static std::vector<double> evaluate_ranges_internal(const std::vector<R> &ranges,
+            const lpoint_list_t &red, const lpoint_list_t &blue,
+            const discrepancy_func_t &f, size_t threads) {
+        auto red_index = point_index(red);
+        auto blue_index = point_index(blue);
+        size_t red_labels, blue_labels;
+        auto red_ids = compact_labels(red, red_labels);
+        auto blue_ids = compact_labels(blue, blue_labels);
+
+        size_t workers = std::max<size_t>(std::min(resolve_thread_count(threads), ranges.size()), 1);
+        std::vector<LabelScratch> red_scratch(workers, LabelScratch(red_labels));
+        std::vector<LabelScratch> blue_scratch(workers, LabelScratch(blue_labels));
+        std::vector<double> m_sub(ranges.size()), b_sub(ranges.size());
+        parallel_for(ranges.size(), workers, [&](size_t i, size_t worker) {
+            m_sub[i] = labeled_weight(ranges[i], red, red_index, red_ids, red_scratch[worker]);
+            b_sub[i] = labeled_weight(ranges[i], blue, blue_index, blue_ids, blue_scratch[worker]);
+        }, 64);
+
+        std::vector<double> values(ranges.size());
+        evaluate_batch(f, m_sub.data(), b_sub.data(), ranges.size(), computeTotal(red), computeTotal(blue),
+                values.data());
+        return values;
+    }
+
+    template <typename R>
+    static std::vector<double> evaluate_ranges_internal(const std::vector<R> &ranges,
+            const trajectory_set_t &red, const trajectory_set_t &blue,
+            const discrepancy_func_t &f, size_t threads) {
+        std::vector<size_t> red_items, blue_items;
+        auto red_index = trajectory_index(red, red_items);
+        auto blue_index = trajectory_index(blue, blue_items);
+        std::vector<double> m_sub(ranges.size()), b_sub(ranges.size());
+        auto weight = [](const R &range, const trajectory_set_t &trajs, const std::vector<size_t> &items,
+                const RangeIndex &index) {
+            double w = 0;
+            index.query(range,
+                    [&](size_t item) { return range.intersects_trajectory(trajs[items[item]]); },
+                    [&](RangeIndex::Node const &node) { w += node.weight; },
+                    [&](size_t item) { w += index.weight(item); });
+            return w;
+        };
+        parallel_for(ranges.size(), threads, [&](size_t i, size_t) {
+            m_sub[i] = weight(ranges[i], red, red_items, red_index);
+            b_sub[i] = weight(ranges[i], blue, blue_items, blue_index);
+        }, 64);
+
+        std::vector<double> values(ranges.size());
+        evaluate_batch(f, m_sub.data(), b_sub.data(), ranges.size(), computeTotal(red), computeTotal(blue),
+                values.data());
+        return values;
+    }
+
+    std::vector<double> evaluate_ranges(const std::vector<Disk> &ranges,
+            const wpoint_list_t &red, const wpoint_list_t &blue,
+            const discrepancy_func_t &f, size_t threads) {
+        return evaluate_ranges_internal(ranges, red, blue, f, threads);
+    }
+
+    std::vector<double> evaluate_ranges(const std::vector<Rectangle> &ranges,
+            const wpoint_list_t &red, const wpoint_list_t &blue,
+            const discrepancy_func_t &f, size_t threads) {
+        return evaluate_ranges_internal(ranges, red, blue, f, threads);
+    }
+
+    std::vector<double> evaluate_ranges(const std::vector<halfspace2_t> &ranges,
+            const wpoint_list_t &red, const wpoint_list_t &blue,
+            const discrepancy_func_t &f, size_t threads) {
+        return evaluate_ranges_internal(ranges, red, blue, f, threads);
+    }
+
+    std::vector<double> evaluate_ranges(const std::vector<Disk> &ranges,
+            const lpoint_list_t &red, const lpoint_list_t &blue,
+            const discrepancy_func_t &f, size_t threads) {
+        return evaluate_ranges_internal(ranges, red, blue, f, threads);
+    }
+
+    std::vector<double> evaluate_ranges(const std::vector<Rectangle> &ranges,
+            const lpoint_list_t &red, const lpoint_list_t &blue,
+            const discrepancy_func_t &f, size_t threads) {
+        return evaluate_ranges_internal(ranges, red, blue, f, threads);
+    }
+
+    std::vector<double> evaluate_ranges(const std::vector<halfspace2_t> &ranges,
+            const lpoint_list_t &red, const lpoint_list_t &blue,
+            const discrepancy_func_t &f, size_t threads) {
+        return evaluate_ranges_internal(ranges, red, blue, f, threads);
+    }
+
+    std::vector<double> evaluate_ranges(const std::vector<Disk> &ranges,
+            const trajectory_set_t &red, const trajectory_set_t &blue,
+            const discrepancy_func_t &f, size_t threads) {
+        return evaluate_ranges_internal(ranges, red, blue, f, threads);
+    }
+
+    std::vector<double> evaluate_ranges(const std::vector<Rectangle> &ranges,
+            const trajectory_set_t &red, const trajectory_set_t &blue,
+            const discrepancy_func_t &f, size_t threads) {
+        return evaluate_ranges_internal(ranges, red, blue, f, threads);
+    }
+
+    std::vector<double> evaluate_ranges(const std::vector<halfspace2_t> &ranges,
+            const trajectory_set_t &red, const trajectory_set_t &blue,
+            const discrepancy_func_t &f, size_t threads) {
+        return evaluate_ranges_internal(ranges, red, blue, f, threads);
+    }
+}
@@ -2,6 +2,8 @@
 #include "HalfSpaceScan.hpp"
 #include "Gridding.hpp"
 #include "Range.hpp"
+#include "Parallel.hpp"
+#include "Statistics.hpp"
 
 #include <unordered_map>
 #include <iostream>
@@ -71,6 +73,31 @@ namespace pyscan {
 
     }
 
+    /*
+     * Evaluates the statistic for every net disk in one batch, given the measured and baseline weight of each disk,
+     * and returns the last disk attaining the maximum.
+     */
+    inline static std::tuple<Disk, double> max_net_disk(
+            const std::vector<Disk> &net_disks,
+            const std::vector<double> &red_weights,
+            const std::vector<double> &blue_weights,
+            double red_tot, double blue_tot,
+            const discrepancy_func_t &f) {
+
+        std::vector<double> stats(net_disks.size());
+        evaluate_batch(f, red_weights.data(), blue_weights.data(), net_disks.size(), red_tot, blue_tot, stats.data());
+
+        Disk cur_max;
+        double max_stat = 0.0;
+        for (size_t i = 0; i < net_disks.size(); ++i) {
+            if (max_stat <= stats[i]) {
+                cur_max = net_disks[i];
+                max_stat = stats[i];
+            }
+        }
+        return std::make_tuple(cur_max, max_stat);
+    }
+
     inline static std::tuple<Disk, double> max_disk_restricted(
             const pt2_t &p1, const pt2_t &p2,
             const point_list_t &net,
@@ -81,7 +108,6 @@ namespace pyscan {
             const discrepancy_func_t &f) {
 
         Disk cur_max;
-        double max_stat = 0.0;
         if (p1.approx_eq(p2)) {
             return std::make_tuple(cur_max, 0.0);
         }
@@ -135,12 +161,193 @@ namespace pyscan {
         for (size_t i = 0; i < net_disks.size(); ++i) {
             red_weight += red_delta[i];
             blue_weight += blue_delta[i];
-            double new_stat = f(red_weight, red_tot, blue_weight, blue_tot);
-            if (max_stat <= new_stat) {
-                cur_max = net_disks[i];
-                max_stat = new_stat;
+            red_delta[i] = red_weight;
+            blue_delta[i] = blue_weight;
+        }
+        return max_net_disk(net_disks, red_delta, blue_delta, red_tot, blue_tot, f);
+    }
+
+    /*
+     * Coordinates of a chunk of points relative to the pivot p1 of the restricted scans, together with the lifted
+     * coordinate |p - p1|^2. These only depend on p1, so they are computed once per pivot and shared by every p2
+     * that the pivot is paired with.
+     */
+    struct PivotChunk {
+        std::vector<double> vx;
+        std::vector<double> vy;
+        std::vector<double> vv;
+
+        //xs and ys may be vx and vy themselves, in which case the coordinates are translated in place.
+        void assign(const pt2_t &p1, const double *xs, const double *ys, size_t n) {
+            double x1 = p1(0), y1 = p1(1);
+            vx.resize(n);
+            vy.resize(n);
+            vv.resize(n);
+            for (size_t i = 0; i < n; ++i) {
+                vx[i] = xs[i] - x1;
+                vy[i] = ys[i] - y1;
+                vv[i] = vx[i] * vx[i] + vy[i] * vy[i];
+            }
+        }
+
+        void assign(const pt2_t &p1, const PointArray &pts) {
+            assign(p1, pts.x.data(), pts.y.data(), pts.size());
+        }
+
+        void assign(const pt2_t &p1, const point_list_t &pts) {
+            vx.resize(pts.size());
+            vy.resize(pts.size());
+            for (size_t i = 0; i < pts.size(); ++i) {
+                vx[i] = pts[i](0);
+                vy[i] = pts[i](1);
+            }
+            assign(p1, vx.data(), vy.data(), pts.size());
+        }
+    };
+
+    /*
+     * Buffers used by the restricted scans of one worker.
+     */
+    struct RestrictedScratch {
+        PivotChunk net;
+        PivotChunk red;
+        PivotChunk blue;
+        std::vector<std::pair<double, size_t>> net_order;
+        std::vector<double> orderV;
+        std::vector<double> red_weights;
+        std::vector<double> blue_weights;
+        std::vector<double> stats;
+    };
+
+    /*
+     * Same sweep as above for points stored in a PointArray, with the chunks already translated so that p1 is the
+     * origin. With u = p2 - p1 the disk through p1, p2 and a point v has its center at u / 2 + t * (u_y, -u_x) with
+     * t = (|v|^2 - <u, v>) / (2 * det(u, v)), so the order of every point is a handful of multiplications on the
+     * cached coordinates.
+     * Leaves the net disks in sweep order in scratch.net_order, together with the red and blue weight of each of
+     * them in scratch.red_weights and scratch.blue_weights, and returns the number of net disks.
+     */
+    inline static size_t restricted_disk_weights(
+            const pt2_t &p1, const pt2_t &p2,
+            const point_list_t &net,
+            const PointArray &red,
+            const PointArray &blue,
+            double min_dist, double max_dist,
+            RestrictedScratch &scratch) {
+
+        if (p1.approx_eq(p2)) {
+            return 0;
+        }
+
+        double ux = p2(0) - p1(0);
+        double uy = p2(1) - p1(1);
+        double uu = ux * ux + uy * uy;
+
+        // Returns false for the points that are colinear with or equal to p1 and p2.
+        auto get_order = [ux, uy, uu](double vx, double vy, double vv, double &order) {
+            double det = uy * vx - ux * vy;
+            if (util::aeq(det, 0.0) ||
+                util::aeq(std::abs(vx) + std::abs(vy), 0.0) ||
+                util::aeq(std::abs(vx - ux) + std::abs(vy - uy), 0.0)) {
+                return false;
+            }
+            order = uu * (vv - (ux * vx + uy * vy)) / (2 * det);
+            return true;
+        };
+
+        auto &net_order = scratch.net_order;
+        net_order.clear();
+        for (size_t i = 0; i < net.size(); ++i) {
+            double order;
+            if (get_order(scratch.net.vx[i], scratch.net.vy[i], scratch.net.vv[i], order)) {
+                double radius = std::sqrt(uu / 4 + order * order / uu);
+                if (min_dist <= radius && radius <= max_dist) {
+                    net_order.emplace_back(order, i);
+                }
+            }
+        }
+
+        if (net_order.empty()) {
+            return 0;
+        }
+        std::sort(net_order.begin(), net_order.end());
+        auto &orderV = scratch.orderV;
+        orderV.resize(net_order.size());
+        for (size_t i = 0; i < net_order.size(); ++i) {
+            orderV[i] = net_order[i].first;
+        }
+
+        double start_t = orderV[0] / uu;
+        double start_x = ux / 2 + start_t * uy;
+        double start_y = uy / 2 - start_t * ux;
+        double start_r2 = uu / 4 + orderV[0] * orderV[0] / uu;
+
+        auto compute_delta = [&](const PivotChunk &v, const PointArray &list, std::vector<double> &delta) {
+            delta.assign(orderV.size(), 0.0);
+            double weight = 0.0;
+            for (size_t i = 0; i < list.size(); ++i) {
+                double dx = start_x - v.vx[i];
+                double dy = start_y - v.vy[i];
+                bool inside = util::alte(dx * dx + dy * dy, start_r2);
+                if (inside) weight += list.w[i];
+
+                double order;
+                if (!get_order(v.vx[i], v.vy[i], v.vv[i], order)) {
+                    continue;
+                }
+                auto lb = std::lower_bound(orderV.begin(), orderV.end(), order);
+                if (lb == orderV.end()) continue;
+                if (inside) {
+                    delta[lb - orderV.begin()] -= list.w[i];
+                } else delta[lb - orderV.begin()] += list.w[i];
+            }
+            delta[0] = 0.0;
+            return weight;
+        };
+
+        auto &red_weights = scratch.red_weights;
+        auto &blue_weights = scratch.blue_weights;
+        double red_weight = compute_delta(scratch.red, red, red_weights);
+        double blue_weight = compute_delta(scratch.blue, blue, blue_weights);
+        for (size_t i = 0; i < orderV.size(); ++i) {
+            red_weight += red_weights[i];
+            blue_weight += blue_weights[i];
+            red_weights[i] = red_weight;
+            blue_weights[i] = blue_weight;
+        }
+        return orderV.size();
+    }
+
+    /*
+     * Only the disk that attains the maximum is ever constructed.
+     */
+    inline static std::tuple<Disk, double> max_disk_restricted(
+            const pt2_t &p1, const pt2_t &p2,
+            const point_list_t &net,
+            const PointArray &red,
+            const PointArray &blue,
+            double min_dist, double max_dist,
+            double red_tot, double blue_tot,
+            const discrepancy_func_t &f,
+            RestrictedScratch &scratch) {
+
+        Disk cur_max;
+        size_t n = restricted_disk_weights(p1, p2, net, red, blue, min_dist, max_dist, scratch);
+        auto &stats = scratch.stats;
+        stats.resize(n);
+        evaluate_batch(f, scratch.red_weights.data(), scratch.blue_weights.data(), n, red_tot, blue_tot, stats.data());
+
+        double max_stat = 0.0;
+        size_t max_ix = n;
+        for (size_t i = 0; i < n; ++i) {
+            if (max_stat <= stats[i]) {
+                max_ix = i;
+                max_stat = stats[i];
             }
         }
+        if (max_ix != n) {
+            cur_max = Disk(p1, p2, net[scratch.net_order[max_ix].second]);
+        }
         return std::make_tuple(cur_max, max_stat);
     }
 
@@ -183,10 +390,9 @@ namespace pyscan {
             const discrepancy_func_t &f) {
 
         Disk cur_max;
-        double max_stat = 0.0;
 
         if (net.size() < 3 || p1.approx_eq(p2)) {
-            return std::make_tuple(cur_max, max_stat);
+            return std::make_tuple(cur_max, 0.0);
         }
 
         double orthoX = p2(1) - p1(1);
@@ -250,16 +456,14 @@ namespace pyscan {
         double red_weight = compute_delta(red, red_deltaR, red_deltaA, red_set);
         double blue_weight = compute_delta(blue, blue_deltaR, blue_deltaA, blue_set);
 
+        std::vector<double> red_weights(net_disks.size()), blue_weights(net_disks.size());
         for (size_t i = 0; i < net_disks.size(); ++i) {
             red_weight += update_weight(red_set, red_deltaA[i], red_deltaR[i]);
             blue_weight += update_weight(blue_set, blue_deltaA[i], blue_deltaR[i]);
-            double new_stat = f(red_weight, red_tot, blue_weight, blue_tot);
-            if (max_stat <= new_stat) {
-                cur_max = net_disks[i];
-                max_stat = new_stat;
-            }
+            red_weights[i] = red_weight;
+            blue_weights[i] = blue_weight;
         }
-        return std::make_tuple(cur_max, max_stat);
+        return max_net_disk(net_disks, red_weights, blue_weights, red_tot, blue_tot, f);
     }
 
     template<typename pt>
@@ -349,89 +553,236 @@ namespace pyscan {
 
 #endif
 
+    /*
+     * Collects everything stored in the cells within 4 cells of (i, j). Any disk with radius at most 2 * min_res
+     * that passes through a point in (i, j) is contained in this neighborhood.
+     */
+    template<typename N, typename T>
+    inline static void gather_chunks(
+            size_t i, size_t j,
+            const SparseGrid<N> &grid_net,
+            const SparseGrid<T> &grid_red,
+            const SparseGrid<T> &grid_blue,
+            std::vector<N> &net_chunk,
+            std::vector<T> &red_chunk,
+            std::vector<T> &blue_chunk) {
+
+        net_chunk.clear();
+        red_chunk.clear();
+        blue_chunk.clear();
+        size_t grid_r = grid_net.get_grid_size();
+        size_t start_k = i < 4 ? 0 : i - 4;
+        size_t start_l = j < 4 ? 0 : j - 4;
+        size_t end_k = i + 4 < grid_r ? i + 4 : grid_r;
+        size_t end_l = j + 4 < grid_r ? j + 4 : grid_r;
+
+        for (size_t k = start_k; k <= end_k; ++k) {
+            for (size_t l = start_l; l <= end_l; ++l) {
+                auto net_range = grid_net(k, l);
+                for (auto it = net_range.first; it != net_range.second; ++it) {
+                    net_chunk.emplace_back(it->second);
+                }
+
+                auto red_range = grid_red(k, l);
+                for (auto it = red_range.first; it != red_range.second; ++it)
+                    red_chunk.emplace_back(it->second);
+
+
+                auto blue_range = grid_blue(k, l);
+                for (auto it = blue_range.first; it != blue_range.second; ++it)
+                    blue_chunk.emplace_back(it->second);
+            }
+        }
+    }
+
+    /*
+     * Reduces the per cell maxima in cell order. Since every cell keeps the first disk that reached its maximum
+     * this returns exactly the disk that a single threaded scan over the cells would have returned.
+     */
+    inline static std::tuple<Disk, double> reduce_cell_maxima(const std::vector<std::tuple<Disk, double>> &cell_max) {
+        Disk cur_max;
+        double max_stat = 0.0;
+        for (auto &[disk, stat] : cell_max) {
+            if (stat > max_stat) {
+                cur_max = disk;
+                max_stat = stat;
+            }
+        }
+        return std::make_tuple(cur_max, max_stat);
+    }
+
     template<typename T>
     inline static std::tuple<Disk, double> max_disk_scale_internal(
             const point_list_t &point_net,
             const std::vector<T> &red,
             const std::vector<T> &blue,
             double min_res,
-            const discrepancy_func_t &f) {
-        Disk cur_max;
-        double max_stat = 0.0;
+            const discrepancy_func_t &f,
+            size_t threads) {
         if (point_net.empty()) {
             return std::make_tuple(Disk(), 0.0);
         }
         auto bb_op = bbox(point_net, red, blue);
         if (!bb_op.has_value()) {
-            return std::make_tuple(cur_max, max_stat);
+            return std::make_tuple(Disk(), 0.0);
         }
         auto bb = bb_op.value();
         double red_tot = computeTotal(red);
         double blue_tot = computeTotal(blue);
         SparseGrid<pt2_t> grid_net(bb, point_net, min_res);
-        auto grid_r = grid_net.get_grid_size();
         SparseGrid<T> grid_red(bb, red, min_res), grid_blue(bb, blue, min_res);
 
+        auto &cells = grid_net.cells();
+        std::vector<std::tuple<Disk, double>> cell_max(cells.size(), std::make_tuple(Disk(), 0.0));
+        size_t workers = std::min(resolve_thread_count(threads), cells.size());
+        std::vector<std::vector<pt2_t>> net_chunks(workers);
+        std::vector<std::vector<T>> red_chunks(workers), blue_chunks(workers);
+
+        parallel_for(cells.size(), workers, [&](size_t c, size_t worker) {
+            auto &net_chunk = net_chunks[worker];
+            auto &red_chunk = red_chunks[worker];
+            auto &blue_chunk = blue_chunks[worker];
+            auto [i, j] = grid_net.get_cell(cells[c]);
+            gather_chunks(i, j, grid_net, grid_red, grid_blue, net_chunk, red_chunk, blue_chunk);
+            if (net_chunk.size() < 3) {
+                return;
+            }
 
-        for (auto center_cell = grid_net.begin(); center_cell != grid_net.end();) {
-            std::vector<pt2_t> net_chunk;
-            std::vector<T> red_chunk;
-            std::vector<T> blue_chunk;
-            net_chunk.clear();
-            red_chunk.clear();
-            blue_chunk.clear();
-            size_t i, j;
-            std::tie(i, j) = grid_net.get_cell(center_cell->second);
-            size_t start_k = i < 4 ? 0 : i - 4;
-            size_t start_l = j < 4 ? 0 : j - 4;
-            size_t end_k = i + 4 < grid_r ? i + 4 : grid_r;
-            size_t end_l = j + 4 < grid_r ? j + 4 : grid_r;
-            auto range = grid_net(i, j);
-
-            for (size_t k = start_k; k <= end_k; ++k) {
-                for (size_t l = start_l; l <= end_l; ++l) {
-                    auto net_range = grid_net(k, l);
-                    for (auto it = net_range.first; it != net_range.second; ++it) {
-                        net_chunk.emplace_back(it->second);
-                    }
-
-                    auto red_range = grid_red(k, l);
-                    for (auto it = red_range.first; it != red_range.second; ++it)
-                        red_chunk.emplace_back(it->second);
+            auto &[cur_max, max_stat] = cell_max[c];
+            auto range = grid_net(cells[c]);
+            for (auto pt1 = range.first; pt1 != range.second; ++pt1) {
+                for (auto &pt2: net_chunk) {
+                    if (pt1->second.approx_eq(pt2)) continue;
 
+                    auto [local_max_disk, local_max_stat] =
+                            max_disk_restricted(pt1->second, pt2, net_chunk, red_chunk, blue_chunk,
+                                                min_res, 2 * min_res,
+                                                red_tot, blue_tot, f);
+                    if (local_max_stat > max_stat) {
+                        cur_max = local_max_disk;
+                        max_stat = local_max_stat;
+                    }
 
-                    auto blue_range = grid_blue(k, l);
-                    for (auto it = blue_range.first; it != blue_range.second; ++it)
-                        blue_chunk.emplace_back(it->second);
                 }
             }
+        });
 
-            if (net_chunk.size() >= 3) {
-                for (auto pt1 = range.first; pt1 != range.second; ++pt1) {
-                    for (auto &pt2: net_chunk) {
-                        if (pt1->second.approx_eq(pt2)) continue;
+        return reduce_cell_maxima(cell_max);
+    }
 
-                        auto [local_max_disk, local_max_stat] =
-                                max_disk_restricted(pt1->second, pt2, net_chunk, red_chunk, blue_chunk,
-                                                    min_res, 2 * min_res,
-                                                    red_tot, blue_tot, f);
-                        if (local_max_stat > max_stat) {
-                            cur_max = local_max_disk;
-                            max_stat = local_max_stat;
-                        }
+    /*
+     * Buckets the indices of the points into the grid cells.
+     */
+    inline static SparseGrid<size_t> index_grid(const bbox_t &bb, const PointArray &pts, double min_res) {
+        SparseGrid<size_t> grid(bb, min_res);
+        std::vector<std::pair<uint64_t, size_t>> coded;
+        coded.reserve(pts.size());
+        for (size_t i = 0; i < pts.size(); ++i) {
+            coded.emplace_back(grid.get_code(pts.x[i], pts.y[i]), i);
+        }
+        grid.assign(std::move(coded));
+        return grid;
+    }
 
-                    }
+    inline static void gather_chunks(
+            size_t i, size_t j,
+            const SparseGrid<pt2_t> &grid_net,
+            const SparseGrid<size_t> &grid_red,
+            const SparseGrid<size_t> &grid_blue,
+            const PointArray &red,
+            const PointArray &blue,
+            std::vector<pt2_t> &net_chunk,
+            PointArray &red_chunk,
+            PointArray &blue_chunk) {
+
+        net_chunk.clear();
+        red_chunk.clear();
+        blue_chunk.clear();
+        size_t grid_r = grid_net.get_grid_size();
+        size_t start_k = i < 4 ? 0 : i - 4;
+        size_t start_l = j < 4 ? 0 : j - 4;
+        size_t end_k = i + 4 < grid_r ? i + 4 : grid_r;
+        size_t end_l = j + 4 < grid_r ? j + 4 : grid_r;
+
+        for (size_t k = start_k; k <= end_k; ++k) {
+            for (size_t l = start_l; l <= end_l; ++l) {
+                auto net_range = grid_net(k, l);
+                for (auto it = net_range.first; it != net_range.second; ++it) {
+                    net_chunk.emplace_back(it->second);
                 }
-            }
 
+                auto red_range = grid_red(k, l);
+                for (auto it = red_range.first; it != red_range.second; ++it)
+                    red_chunk.push_back(red, it->second);
 
-            auto last = center_cell->first;
-            do {
-                ++center_cell;
-            } while (center_cell != grid_net.end() && center_cell->first == last);
+                auto blue_range = grid_blue(k, l);
+                for (auto it = blue_range.first; it != blue_range.second; ++it)
+                    blue_chunk.push_back(blue, it->second);
+            }
         }
+    }
 
-        return std::make_tuple(cur_max, max_stat);
+    inline static std::tuple<Disk, double> max_disk_scale_internal(
+            const point_list_t &point_net,
+            const PointArray &red,
+            const PointArray &blue,
+            double min_res,
+            const discrepancy_func_t &f,
+            size_t threads) {
+        if (point_net.empty()) {
+            return std::make_tuple(Disk(), 0.0);
+        }
+        auto bb_op = bbox(point_net, red, blue);
+        if (!bb_op.has_value()) {
+            return std::make_tuple(Disk(), 0.0);
+        }
+        auto bb = bb_op.value();
+        double red_tot = computeTotal(red);
+        double blue_tot = computeTotal(blue);
+        SparseGrid<pt2_t> grid_net(bb, point_net, min_res);
+        auto grid_red = index_grid(bb, red, min_res);
+        auto grid_blue = index_grid(bb, blue, min_res);
+
+        auto &cells = grid_net.cells();
+        std::vector<std::tuple<Disk, double>> cell_max(cells.size(), std::make_tuple(Disk(), 0.0));
+        size_t workers = std::min(resolve_thread_count(threads), cells.size());
+        std::vector<std::vector<pt2_t>> net_chunks(workers);
+        std::vector<PointArray> red_chunks(workers), blue_chunks(workers);
+        std::vector<RestrictedScratch> scratches(workers);
+
+        parallel_for(cells.size(), workers, [&](size_t c, size_t worker) {
+            auto &net_chunk = net_chunks[worker];
+            auto &red_chunk = red_chunks[worker];
+            auto &blue_chunk = blue_chunks[worker];
+            auto &scratch = scratches[worker];
+            auto [i, j] = grid_net.get_cell(cells[c]);
+            gather_chunks(i, j, grid_net, grid_red, grid_blue, red, blue, net_chunk, red_chunk, blue_chunk);
+            if (net_chunk.size() < 3) {
+                return;
+            }
+
+            auto &[cur_max, max_stat] = cell_max[c];
+            auto range = grid_net(cells[c]);
+            for (auto pt1 = range.first; pt1 != range.second; ++pt1) {
+                scratch.net.assign(pt1->second, net_chunk);
+                scratch.red.assign(pt1->second, red_chunk);
+                scratch.blue.assign(pt1->second, blue_chunk);
+                for (auto &pt2: net_chunk) {
+                    if (pt1->second.approx_eq(pt2)) continue;
+
+                    auto [local_max_disk, local_max_stat] =
+                            max_disk_restricted(pt1->second, pt2, net_chunk, red_chunk, blue_chunk,
+                                                min_res, 2 * min_res,
+                                                red_tot, blue_tot, f, scratch);
+                    if (local_max_stat > max_stat) {
+                        cur_max = local_max_disk;
+                        max_stat = local_max_stat;
+                    }
+                }
+            }
+        });
+
+        return reduce_cell_maxima(cell_max);
     }
 
     std::tuple<Disk, double> max_disk_scale (
@@ -439,8 +790,19 @@ namespace pyscan {
             const wpoint_list_t &red,
             const wpoint_list_t &blue,
             double min_res,
-            const discrepancy_func_t &f) {
-        return max_disk_scale_internal(point_net, red, blue, min_res, f);
+            const discrepancy_func_t &f,
+            size_t threads) {
+        return max_disk_scale_internal(point_net, PointArray(red), PointArray(blue), min_res, f, threads);
+    }
+
+    std::tuple<Disk, double> max_disk_scale(
+            const point_list_t &point_net,
+            const PointArray &red,
+            const PointArray &blue,
+            double min_res,
+            const discrepancy_func_t &f,
+            size_t threads) {
+        return max_disk_scale_internal(point_net, red, blue, min_res, f, threads);
     }
 
     std::tuple<Disk, double> max_disk_scale_labeled_alt(
@@ -448,8 +810,271 @@ namespace pyscan {
             const lpoint_list_t &red,
             const lpoint_list_t &blue,
             double min_res,
-            const discrepancy_func_t &f) {
-        return max_disk_scale_internal(point_net, red, blue, min_res, f);
+            const discrepancy_func_t &f,
+            size_t threads) {
+        return max_disk_scale_internal(point_net, red, blue, min_res, f, threads);
+    }
+
+    /*
+     * The (red, blue) weights of a candidate disk together with the three net points that define it.
+     */
+    struct DiskCandidate {
+        double red;
+        double blue;
+        const pt2_t *p1;
+        const pt2_t *p2;
+        const pt2_t *p3;
+    };
+
+    /*
+     * Keeps one candidate for every distinct (red, blue) pair. Every statistic only sees a disk through its weights
+     * and the totals, so this loses nothing whatever the statistic is.
+     */
+    inline static void unique_candidates(std::vector<DiskCandidate> &cands) {
+        std::sort(cands.begin(), cands.end(), [](const DiskCandidate &a, const DiskCandidate &b) {
+            return a.red < b.red || (a.red == b.red && a.blue < b.blue);
+        });
+        cands.erase(std::unique(cands.begin(), cands.end(), [](const DiskCandidate &a, const DiskCandidate &b) {
+            return a.red == b.red && a.blue == b.blue;
+        }), cands.end());
+    }
+
+    inline static bbox_t scanner_bbox(const point_list_t &point_net, double min_res) {
+        auto bb_op = bbox(point_net);
+        auto [mnx, mny, mxx, mxy] = bb_op.value_or(std::make_tuple(0.0, 0.0, 0.0, 0.0));
+        double pad = 4 * min_res;
+        return std::make_tuple(mnx - pad, mny - pad, mxx + pad, mxy + pad);
+    }
+
+    DiskScanner::DiskScanner(const point_list_t &point_net, double min_res, discrepancy_func_t f, size_t threads) :
+            min_res(min_res),
+            f(std::move(f)),
+            threads(threads),
+            bb(scanner_bbox(point_net, min_res)),
+            grid_net(bb, point_net, min_res),
+            grid_red(bb, min_res),
+            grid_blue(bb, min_res),
+            cell_candidates(grid_net.cells().size()) {
+    }
+
+    /*
+     * Drops the flagged points from the stored array and re-indexes the grid over the remaining ones.
+     */
+    inline static void compact_points(PointArray &stored, std::vector<bool> &removed, size_t &removed_count,
+                                      SparseGrid<size_t> &grid) {
+        PointArray live;
+        live.reserve(stored.size() - removed_count);
+        std::vector<std::pair<uint64_t, size_t>> coded;
+        coded.reserve(stored.size() - removed_count);
+        for (size_t i = 0; i < stored.size(); ++i) {
+            if (!removed[i]) {
+                coded.emplace_back(grid.get_code(stored.x[i], stored.y[i]), live.size());
+                live.push_back(stored, i);
+            }
+        }
+        grid.assign(std::move(coded));
+        stored = std::move(live);
+        removed.assign(stored.size(), false);
+        removed_count = 0;
+    }
+
+    void DiskScanner::add_points(const PointArray &new_red, const PointArray &new_blue,
+                                 std::vector<uint64_t> &touched) {
+        auto [mnx, mny, mxx, mxy] = bb;
+        auto add = [&](const PointArray &pts, PointArray &stored, std::vector<bool> &removed,
+                       SparseGrid<size_t> &grid, double &total) {
+            std::vector<std::pair<uint64_t, size_t>> coded;
+            for (size_t i = 0; i < pts.size(); ++i) {
+                total += pts.w[i];
+                if (pts.x[i] < mnx || mxx < pts.x[i] || pts.y[i] < mny || mxy < pts.y[i]) {
+                    continue;
+                }
+                uint64_t code = grid.get_code(pts.x[i], pts.y[i]);
+                coded.emplace_back(code, stored.size());
+                touched.emplace_back(code);
+                stored.push_back(pts.x[i], pts.y[i], pts.w[i]);
+                removed.push_back(false);
+            }
+            grid.insert(std::move(coded));
+        };
+        add(new_red, red, red_removed, grid_red, red_tot);
+        add(new_blue, blue, blue_removed, grid_blue, blue_tot);
+    }
+
+    void DiskScanner::drop_points(const PointArray &old_red, const PointArray &old_blue,
+                                  std::vector<uint64_t> &touched) {
+        auto [mnx, mny, mxx, mxy] = bb;
+        auto drop = [&](const PointArray &pts, PointArray &stored, std::vector<bool> &removed, size_t &removed_count,
+                        SparseGrid<size_t> &grid, double &total) {
+            size_t prev_count = removed_count;
+            for (size_t i = 0; i < pts.size(); ++i) {
+                if (pts.x[i] < mnx || mxx < pts.x[i] || pts.y[i] < mny || mxy < pts.y[i]) {
+                    total -= pts.w[i];
+                    continue;
+                }
+                uint64_t code = grid.get_code(pts.x[i], pts.y[i]);
+                auto range = grid(code);
+                for (auto it = range.first; it != range.second; ++it) {
+                    size_t ix = it->second;
+                    if (!removed[ix] && stored.x[ix] == pts.x[i] && stored.y[ix] == pts.y[i] &&
+                        stored.w[ix] == pts.w[i]) {
+                        removed[ix] = true;
+                        removed_count++;
+                        total -= pts.w[i];
+                        touched.emplace_back(code);
+                        break;
+                    }
+                }
+            }
+            if (removed_count == prev_count) {
+                return;
+            }
+            if (2 * removed_count > stored.size()) {
+                compact_points(stored, removed, removed_count, grid);
+            } else {
+                grid.erase_if([&](size_t ix) { return removed[ix]; });
+            }
+        };
+        drop(old_red, red, red_removed, red_removed_count, grid_red, red_tot);
+        drop(old_blue, blue, blue_removed, blue_removed_count, grid_blue, blue_tot);
+    }
+
+    void DiskScanner::insert(const wpoint_list_t &new_red, const wpoint_list_t &new_blue) {
+        insert(PointArray(new_red), PointArray(new_blue));
+    }
+
+    void DiskScanner::insert(const PointArray &new_red, const PointArray &new_blue) {
+        std::vector<uint64_t> touched;
+        add_points(new_red, new_blue, touched);
+        refresh(std::move(touched));
+    }
+
+    void DiskScanner::remove(const wpoint_list_t &old_red, const wpoint_list_t &old_blue) {
+        remove(PointArray(old_red), PointArray(old_blue));
+    }
+
+    void DiskScanner::remove(const PointArray &old_red, const PointArray &old_blue) {
+        std::vector<uint64_t> touched;
+        drop_points(old_red, old_blue, touched);
+        refresh(std::move(touched));
+    }
+
+    void DiskScanner::update(const PointArray &new_red, const PointArray &new_blue,
+                             const PointArray &old_red, const PointArray &old_blue) {
+        std::vector<uint64_t> touched;
+        drop_points(old_red, old_blue, touched);
+        add_points(new_red, new_blue, touched);
+        refresh(std::move(touched));
+    }
+
+    /*
+     * Rescans the net cells that can see one of the touched cells and refreshes the maximum.
+     */
+    void DiskScanner::refresh(std::vector<uint64_t> touched) {
+        std::sort(touched.begin(), touched.end());
+        touched.erase(std::unique(touched.begin(), touched.end()), touched.end());
+        auto &cells = grid_net.cells();
+        std::vector<bool> is_dirty(cells.size(), false);
+        size_t grid_r = grid_net.get_grid_size();
+        for (auto code : touched) {
+            auto [i, j] = grid_net.get_cell(code);
+            size_t start_k = i < 4 ? 0 : i - 4;
+            size_t start_l = j < 4 ? 0 : j - 4;
+            size_t end_k = std::min<size_t>(i + 4, grid_r - 1);
+            size_t end_l = std::min<size_t>(j + 4, grid_r - 1);
+            for (size_t l = start_l; l <= end_l; ++l) {
+                auto first = std::lower_bound(cells.begin(), cells.end(), l * grid_r + start_k);
+                auto last = std::upper_bound(first, cells.end(), l * grid_r + end_k);
+                for (auto it = first; it != last; ++it) {
+                    is_dirty[it - cells.begin()] = true;
+                }
+            }
+        }
+        std::vector<size_t> dirty;
+        for (size_t c = 0; c < cells.size(); ++c) {
+            if (is_dirty[c]) dirty.emplace_back(c);
+        }
+        rescan(dirty);
+
+        std::vector<std::tuple<Disk, double>> cell_max(cell_candidates.size(), std::make_tuple(Disk(), 0.0));
+        size_t workers = std::max<size_t>(std::min(resolve_thread_count(threads), cell_candidates.size()), 1);
+        std::vector<std::vector<double>> stats(workers);
+        parallel_for(cell_candidates.size(), workers, [&](size_t c, size_t worker) {
+            auto &cell = cell_candidates[c];
+            auto &cell_stats = stats[worker];
+            cell_stats.resize(cell.disks.size());
+            evaluate_batch(f, cell.red.data(), cell.blue.data(), cell.disks.size(), red_tot, blue_tot,
+                           cell_stats.data());
+            auto &[cur_max, max_stat] = cell_max[c];
+            for (size_t i = 0; i < cell.disks.size(); ++i) {
+                if (cell_stats[i] > max_stat) {
+                    cur_max = cell.disks[i];
+                    max_stat = cell_stats[i];
+                }
+            }
+        });
+        std::tie(max_disk, max_stat) = reduce_cell_maxima(cell_max);
+    }
+
+    /*
+     * Recomputes the stored candidates of the given net cells with the same restricted scans as max_disk_scale.
+     */
+    void DiskScanner::rescan(const std::vector<size_t> &dirty) {
+        if (dirty.empty()) {
+            return;
+        }
+        auto &cells = grid_net.cells();
+        size_t workers = std::min(resolve_thread_count(threads), dirty.size());
+        std::vector<std::vector<pt2_t>> net_chunks(workers);
+        std::vector<PointArray> red_chunks(workers), blue_chunks(workers);
+        std::vector<RestrictedScratch> scratches(workers);
+        std::vector<std::vector<DiskCandidate>> candidates(workers);
+
+        parallel_for(dirty.size(), workers, [&](size_t d, size_t worker) {
+            size_t c = dirty[d];
+            auto &net_chunk = net_chunks[worker];
+            auto &red_chunk = red_chunks[worker];
+            auto &blue_chunk = blue_chunks[worker];
+            auto &scratch = scratches[worker];
+            auto &cands = candidates[worker];
+            auto [i, j] = grid_net.get_cell(cells[c]);
+            gather_chunks(i, j, grid_net, grid_red, grid_blue, red, blue, net_chunk, red_chunk, blue_chunk);
+
+            cands.clear();
+            if (net_chunk.size() >= 3) {
+                auto range = grid_net(cells[c]);
+                for (auto pt1 = range.first; pt1 != range.second; ++pt1) {
+                    scratch.net.assign(pt1->second, net_chunk);
+                    scratch.red.assign(pt1->second, red_chunk);
+                    scratch.blue.assign(pt1->second, blue_chunk);
+                    for (auto &pt2: net_chunk) {
+                        if (pt1->second.approx_eq(pt2)) continue;
+
+                        size_t n = restricted_disk_weights(pt1->second, pt2, net_chunk, red_chunk, blue_chunk,
+                                                           min_res, 2 * min_res, scratch);
+                        for (size_t k = 0; k < n; ++k) {
+                            cands.push_back({scratch.red_weights[k], scratch.blue_weights[k], &pt1->second, &pt2,
+                                             &net_chunk[scratch.net_order[k].second]});
+                        }
+                    }
+                    // Drops repeated weight pairs before the candidate list gets large.
+                    if (cands.size() > (1u << 16)) {
+                        unique_candidates(cands);
+                    }
+                }
+                unique_candidates(cands);
+            }
+
+            auto &cell = cell_candidates[c];
+            cell.red.resize(cands.size());
+            cell.blue.resize(cands.size());
+            cell.disks.clear();
+            for (size_t k = 0; k < cands.size(); ++k) {
+                cell.red[k] = cands[k].red;
+                cell.blue[k] = cands[k].blue;
+                cell.disks.emplace_back(*cands[k].p1, *cands[k].p2, *cands[k].p3);
+            }
+        });
     }
 
 
@@ -517,7 +1142,8 @@ namespace pyscan {
             const lpoint_list_t &blue,
             bool compress,
             double min_res,
-            const discrepancy_func_t &f) {
+            const discrepancy_func_t &f,
+            size_t threads) {
 
 
         auto bb_op = bbox(point_net, red, blue);
@@ -529,92 +1155,66 @@ namespace pyscan {
         double red_tot = computeTotal(red);
         double blue_tot = computeTotal(blue);
         SparseGrid<lpt2_t> grid_net(bb, point_net, min_res);
-        auto grid_r = grid_net.get_grid_size();
         SparseGrid<lpt2_t> grid_red(bb, red, min_res), grid_blue(bb, blue, min_res);
-        Disk cur_max;
-        double max_stat = 0.0;
-        for (auto center_cell = grid_net.begin(); center_cell != grid_net.end();) {
-            std::vector<lpt2_t> net_chunk;
-            std::vector<lpt2_t> red_chunk;
-            std::vector<lpt2_t> blue_chunk;
-            net_chunk.clear();
-            red_chunk.clear();
-            blue_chunk.clear();
-            size_t i, j;
-            std::tie(i, j) = grid_net.get_cell(center_cell->second);
-            size_t start_k = i < 4 ? 0 : i - 4;
-            size_t start_l = j < 4 ? 0 : j - 4;
-            size_t end_k = i + 4 < grid_r ? i + 4 : grid_r;
-            size_t end_l = j + 4 < grid_r ? j + 4 : grid_r;
-            auto range = grid_net(i, j);
-
-            for (size_t k = start_k; k <= end_k; ++k) {
-                for (size_t l = start_l; l <= end_l; ++l) {
-                    auto net_range = grid_net(k, l);
-                    for (auto it = net_range.first; it != net_range.second; ++it) {
-                        net_chunk.emplace_back(it->second);
-                    }
 
-                    auto red_range = grid_red(k, l);
-                    for (auto it = red_range.first; it != red_range.second; ++it)
-                        red_chunk.emplace_back(it->second);
+        auto &cells = grid_net.cells();
+        std::vector<std::tuple<Disk, double>> cell_max(cells.size(), std::make_tuple(Disk(), 0.0));
+        size_t workers = std::min(resolve_thread_count(threads), cells.size());
+        std::vector<lpoint_list_t> net_chunks(workers), red_chunks(workers), blue_chunks(workers);
 
+        auto to_disk = [&](const halfspace3_t& h) {
+            double a = h[0], b = h[1], c = h[2], d = h[3];
+            return Disk(-a / (2 * c), -b / (2 * c), sqrt((a * a + b * b - 4 * c * d) / (4 * c * c)));
+        };
 
-                    auto blue_range = grid_blue(k, l);
-                    for (auto it = blue_range.first; it != blue_range.second; ++it)
-                        blue_chunk.emplace_back(it->second);
-                }
-            }
-
-            if (net_chunk.size() >= 3) {
+        filter_func3_t f_func = [&] (halfspace3_t const& proj_h) {
+            auto d = to_disk(proj_h);
+            double r = d.getRadius();
+            return min_res < r && r < 2 * min_res;
+        };
 
+        parallel_for(cells.size(), workers, [&](size_t c, size_t worker) {
+            auto &net_chunk = net_chunks[worker];
+            auto &red_chunk = red_chunks[worker];
+            auto &blue_chunk = blue_chunks[worker];
+            auto [i, j] = grid_net.get_cell(cells[c]);
+            gather_chunks(i, j, grid_net, grid_red, grid_blue, net_chunk, red_chunk, blue_chunk);
+            if (net_chunk.size() < 3) {
+                return;
+            }
 
-                for (auto pt1 = range.first; pt1 != range.second; ++pt1) {
-                    auto lifted_pt = lift_pt_alt(pt1->second);
-
-                    // Compute a new set of axis so that this point has the smallest x-axis.
-                    auto lift_project = [&] (lpt2_t const& pt) {
-                        //Project onto the new axis.
-                        auto lifted = lift_pt_alt(pt);
-                        return lifted;
-                    };
-
-                    lpoint3_list_t lifted_net(net_chunk.size());
-                    lpoint3_list_t lifted_red(red_chunk.size()), lifted_blue(blue_chunk.size());
-                    std::transform(net_chunk.begin(), net_chunk.end(), lifted_net.begin(), lift_project);
-                    std::transform(red_chunk.begin(), red_chunk.end(), lifted_red.begin(), lift_project);
-                    std::transform(blue_chunk.begin(), blue_chunk.end(), lifted_blue.begin(), lift_project);
-
-                    auto to_disk = [&](const halfspace3_t& h) {
-                        double a = h[0], b = h[1], c = h[2], d = h[3];
-                        return Disk(-a / (2 * c), -b / (2 * c), sqrt((a * a + b * b - 4 * c * d) / (4 * c * c)));
-                    };
-
-                    filter_func3_t f_func = [&] (halfspace3_t const& proj_h) {
-                        auto d = to_disk(proj_h);
-                        double r = d.getRadius();
-                        return min_res < r && r < 2 * min_res;
-                    };
-                    auto [proj_h, local_max_stat] = max_halfspace_restricted(lifted_pt, lifted_net,
-                            lifted_red, lifted_blue, compress, f_func, [&](double m, double b) {
-                        return f(m, red_tot, b, blue_tot);
-                    });
-                    //assert(util::aeq(evaluate_range(to_disk(proj_h), red_chunk, blue_chunk, f), local_max_stat));
-                    //assert(util::aeq(evaluate_range(to_disk(proj_h), red, blue, f), local_max_stat));
+            auto &[cur_max, max_stat] = cell_max[c];
+            auto range = grid_net(cells[c]);
+            for (auto pt1 = range.first; pt1 != range.second; ++pt1) {
+                auto lifted_pt = lift_pt_alt(pt1->second);
+
+                // Compute a new set of axis so that this point has the smallest x-axis.
+                auto lift_project = [&] (lpt2_t const& pt) {
+                    //Project onto the new axis.
+                    auto lifted = lift_pt_alt(pt);
+                    return lifted;
+                };
+
+                lpoint3_list_t lifted_net(net_chunk.size());
+                lpoint3_list_t lifted_red(red_chunk.size()), lifted_blue(blue_chunk.size());
+                std::transform(net_chunk.begin(), net_chunk.end(), lifted_net.begin(), lift_project);
+                std::transform(red_chunk.begin(), red_chunk.end(), lifted_red.begin(), lift_project);
+                std::transform(blue_chunk.begin(), blue_chunk.end(), lifted_blue.begin(), lift_project);
+
+                auto [proj_h, local_max_stat] = max_halfspace_restricted(lifted_pt, lifted_net,
+                        lifted_red, lifted_blue, compress, f_func, [&](double m, double b) {
+                    return f(m, red_tot, b, blue_tot);
+                });
+                //assert(util::aeq(evaluate_range(to_disk(proj_h), red_chunk, blue_chunk, f), local_max_stat));
+                //assert(util::aeq(evaluate_range(to_disk(proj_h), red, blue, f), local_max_stat));
 
-                    if (local_max_stat > max_stat) {
-                        cur_max = to_disk(proj_h);
-                        max_stat = local_max_stat;
-                    }
+                if (local_max_stat > max_stat) {
+                    cur_max = to_disk(proj_h);
+                    max_stat = local_max_stat;
                 }
             }
-
-            auto last = center_cell->first;
-            do {
-                ++center_cell;
-            } while (center_cell != grid_net.end() && center_cell->first == last);
-        }
-        return std::make_tuple(cur_max, max_stat);
+        });
+        return reduce_cell_maxima(cell_max);
     }
 
 
@@ -176,32 +176,43 @@ namespace pyscan {
 
 
 
-    double approximateHull(double eps,
-                           Vec2 const& cc, Vec2 const& cl,
-                           std::function<double(Vec2)> phi, //function to maximize
-                           std::function<Vec2(Vec2)> lineMaxExt) {
-
-
-        auto lineMaxF = [&] (Vec2 v1) {
-          auto pt = lineMaxExt(v1);
-          //std::cout << "line_max = " << pt << std::endl;
-          return pt; // projectToBoundary(pt, v1, alpha, rho);
-        };
+    namespace {
 
-        auto avg = [&] (Vec2 const& v1, Vec2 const& v2) {
+        /*
+         * The unit direction halfway between v1 and v2.
+         */
+        Vec2 avg(Vec2 const& v1, Vec2 const& v2) {
             Vec2 v_out = v1 + v2;
             Vec2 tmp;
             double norm = 1.0 / sqrt(v_out[0] * v_out[0] + v_out[1] * v_out[1]);
             tmp[0] = v_out[0] * norm;
             tmp[1] = v_out[1] * norm;
             return tmp;
-        };
+        }
 
+        /*
+         * A wedge of directions [d_cc, d_cl] of the hull refinement together with the extreme points p_cc and
+         * p_cl in those directions.
+         */
         struct Frame {
             Vec2 d_cc, d_cl, p_cc, p_cl;
             Frame(Vec2 const& di, Vec2 const& dj, Vec2 const& cc, Vec2 const& cl) :
                     d_cc(di), d_cl(dj), p_cc(cc), p_cl(cl) {}
         };
+    }
+
+    double approximateHull(double eps,
+                           Vec2 const& cc, Vec2 const& cl,
+                           std::function<double(Vec2)> phi, //function to maximize
+                           std::function<Vec2(Vec2)> lineMaxExt) {
+
+
+        auto lineMaxF = [&] (Vec2 v1) {
+          auto pt = lineMaxExt(v1);
+          //std::cout << "line_max = " << pt << std::endl;
+          return pt; // projectToBoundary(pt, v1, alpha, rho);
+        };
+
         double maxRValue = 0;
 
         std::deque<Frame> frameStack;
@@ -267,6 +278,50 @@ namespace pyscan {
                         approximateHull(eps, Vec2{-1, 0}, Vec2{0, 1}, phi, lineMaxF));
     }
 
+    double approximateHullBatch(double eps,
+                                std::function<double(Vec2)> phi, //function to maximize
+                                std::function<std::vector<Vec2>(std::vector<Vec2> const&)> lineMaxBatch) {
+
+        // Both halves of the circle of directions are refined together so they share one batch per level.
+        std::vector<Vec2> starts{Vec2{1, 0}, Vec2{0, -1}, Vec2{-1, 0}, Vec2{0, 1}};
+        auto start_pts = lineMaxBatch(starts);
+        std::vector<Frame> level;
+        level.emplace_back(starts[0], starts[1], start_pts[0], start_pts[1]);
+        level.emplace_back(starts[2], starts[3], start_pts[2], start_pts[3]);
+
+        double maxRValue = 0;
+        std::vector<Frame> refined;
+        std::vector<Vec2> m_vecs;
+        while (!level.empty()) {
+            // Every corner of the level is known before any triangle is tested, so the whole level prunes against
+            // the best of them.
+            for (auto const& lf : level) {
+                maxRValue = std::max({phi(lf.p_cc), phi(lf.p_cl), maxRValue});
+            }
+            refined.clear();
+            m_vecs.clear();
+            for (auto const& lf : level) {
+                double di = dot(lf.d_cc, lf.p_cc);
+                double dj = dot(lf.d_cl, lf.p_cl);
+                Vec2 p_ext;
+                if (lineIntersection(lf.d_cc, di, lf.d_cl, dj, p_ext) && phi(p_ext) - maxRValue > eps) {
+                    refined.push_back(lf);
+                    m_vecs.push_back(avg(lf.d_cc, lf.d_cl));
+                }
+            }
+            level.clear();
+            if (m_vecs.empty()) {
+                break;
+            }
+            auto line_maxes = lineMaxBatch(m_vecs);
+            for (size_t i = 0; i < refined.size(); i++) {
+                level.emplace_back(refined[i].d_cc, m_vecs[i], refined[i].p_cc, line_maxes[i]);
+                level.emplace_back(m_vecs[i], refined[i].d_cl, line_maxes[i], refined[i].p_cl);
+            }
+        }
+        return maxRValue;
+    }
+
     /*
      * Computes the height of a triangle that has corner points p1, p2, and pt where pt is the top corner.
      * p1, p2 -- corners of the base of the triangle
@@ -285,20 +340,6 @@ namespace pyscan {
                                    Vec2 const& cc, Vec2 const& cl,
                                    std::function<Vec2(Vec2)> lineMaxF) {
 
-            auto avg = [&] (Vec2 const& v1, Vec2 const& v2) {
-                Vec2 v_out = v1 + v2;
-                Vec2 tmp;
-                double norm = 1.0 / sqrt(v_out[0] * v_out[0] + v_out[1] * v_out[1]);
-                tmp[0] = v_out[0] * norm;
-                tmp[1] = v_out[1] * norm;
-                return tmp;
-            };
-
-            struct Frame {
-                Vec2 d_cc, d_cl, p_cc, p_cl;
-                Frame(Vec2 const& di, Vec2 const& dj, Vec2 const& cc, Vec2 const& cl) :
-                        d_cc(di), d_cl(dj), p_cc(cc), p_cl(cl) {}
-            };
             auto pcc = lineMaxF(cc), pcl = lineMaxF(cl);
             std::vector<Vec2> pts{ pcc, pcl };
             std::deque<Frame> frameStack;
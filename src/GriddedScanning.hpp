@@ -64,14 +64,14 @@ std::tuple<Region_t, double> gridding_scan(
     SparseGrid<Point_T> grid_red(bb, red, res), grid_blue(bb, blue, res);
 
 
-    for (auto center_cell = grid_net.begin(); center_cell != grid_net.end();) {
+    for (auto center_cell : grid_net.cells()) {
         std::vector<Net_T> net_chunk;
         std::vector<Point_T> red_chunk;
         std::vector<Point_T> blue_chunk;
         net_chunk.clear();
         red_chunk.clear();
         blue_chunk.clear();
-        auto[i, j] = grid_net.get_cell(center_cell->second);
+        auto[i, j] = grid_net.get_cell(center_cell);
         size_t start_k = i < boundary_width ? 0 : i - boundary_width;
         size_t start_l = j < boundary_width ? 0 : j - boundary_width;
         size_t end_k = i + boundary_width < grid_r ? i + boundary_width : grid_r;
@@ -101,11 +101,6 @@ std::tuple<Region_t, double> gridding_scan(
             curr_max = local_max_disk;
             max_stat = local_max_stat;
         }
-
-        auto last = center_cell->first;
-        do {
-            ++center_cell;
-        } while (center_cell != grid_net.end() && center_cell->first == last);
     }
 
     return std::make_tuple(curr_max, max_stat);
@@ -1,4 +1,5 @@
 #include <algorithm>
+#include <optional>
 #include <queue>
 #include <random>
 
@@ -7,6 +8,8 @@
 #include "Segment.hpp"
 #include "ConvexHull.hpp"
 #include "HalfSpaceScan.hpp"
+#include "Parallel.hpp"
+#include "Statistics.hpp"
 
 namespace pyscan{
 
@@ -60,18 +63,85 @@ namespace pyscan{
         return -a * inv_norm * orientation;
     }
 
-    std::tuple<halfspace2_t, double> max_halfplane_internal(
-            const point_list_t& point_net,
-            const wpoint_list_t& red,
-            const wpoint_list_t& blue,
-            const filter_func2_t& filter,
+    using pivot_max_t = std::optional<std::tuple<halfspace2_t, double>>;
+
+    /*
+     * Runs the sweep around every pivot of the net and combines the results. Each pivot is an independent task
+     * and later pivots have fewer planes to sweep, so the tasks are handed out dynamically. The per pivot maxima
+     * are reduced in pivot order with the same comparison as the sweep, so ties are broken exactly as in a
+     * single threaded scan.
+     */
+    template <typename Pivot_f>
+    inline static std::tuple<halfspace2_t, double> max_over_pivots(
+            size_t pivot_count,
+            double initial,
+            size_t threads,
+            Pivot_f pivot_max) {
+
+        std::vector<pivot_max_t> pivot_results(pivot_count);
+        parallel_for(pivot_count, threads, [&](size_t i, size_t) {
+            pivot_results[i] = pivot_max(i);
+        });
+
+        double max_discrepancy = initial;
+        halfspace2_t max_plane;
+        for (auto& result : pivot_results) {
+            if (result.has_value() && max_discrepancy <= std::get<1>(result.value())) {
+                std::tie(max_plane, max_discrepancy) = result.value();
+            }
+        }
+        return std::make_tuple(max_plane, max_discrepancy);
+    }
+
+    /*
+     * Evaluates the statistic on the weights of every halfplane through a pivot in one batch and returns the last
+     * halfplane attaining the maximum.
+     */
+    inline static std::tuple<halfspace2_t, double> max_sweep_halfplane(
+            const std::vector<halfspace2_t>& halfplanes,
+            const std::vector<double>& red_weights,
+            const std::vector<double>& blue_weights,
             const discrepancy_func2_t& f) {
 
+        std::vector<double> stats(halfplanes.size());
+        evaluate_batch(f, red_weights.data(), blue_weights.data(), halfplanes.size(), stats.data());
+
         double max_discrepancy = -std::numeric_limits<double>::infinity();
         halfspace2_t max_plane;
+        for (size_t j = 0; j < halfplanes.size(); ++j) {
+            if (max_discrepancy <= stats[j]) {
+                max_plane = halfplanes[j];
+                max_discrepancy = stats[j];
+            }
+        }
+        return std::make_tuple(max_plane, max_discrepancy);
+    }
+
+    inline static double point_weight(const wpoint_list_t& pts, size_t k) {
+        return pts[k].get_weight();
+    }
+
+    inline static double point_weight(const PointArray& pts, size_t k) {
+        return pts.w[k];
+    }
+
+    /*
+     * The weighted sweep shared by the point layouts. classify(pivot, l1, pts, inside, angle) records for every
+     * point of pts whether the first halfplane l1 contains it and the angle of the plane through the pivot and the
+     * point, in the same -h[0] form the halfplanes are sorted by (NaN when the point is the pivot).
+     */
+    template <typename Pts, typename Classify>
+    std::tuple<halfspace2_t, double> max_halfplane_sweep(
+            const point_list_t& point_net,
+            const Pts& red,
+            const Pts& blue,
+            const filter_func2_t& filter,
+            const discrepancy_func2_t& f,
+            size_t threads,
+            Classify classify) {
 
         assert(point_net.size() >= 2);
-        for (size_t i = 0; i < point_net.size() - 1; ++i) {
+        auto pivot_max = [&](size_t i) -> pivot_max_t {
             auto pivot = point_net[i];
 
             std::vector<halfspace2_t> halfplanes;
@@ -94,7 +164,7 @@ namespace pyscan{
             halfplanes.resize( std::distance(halfplanes.begin(), new_end));
 
             if (halfplanes.empty()) {
-                continue;
+                return {};
             }
 
             auto l1 = halfplanes[0];
@@ -105,23 +175,26 @@ namespace pyscan{
             for (auto& plane : halfplanes) {
                 angles.emplace_back(-plane[0]);
             }
-            auto calc_delta = [&](const wpoint_list_t& pts, std::vector<double>& deltas) {
+
+            std::vector<char> inside;
+            std::vector<double> angle;
+            auto calc_delta = [&](const Pts& pts, std::vector<double>& deltas) {
+                classify(pivot, l1, pts, inside, angle);
                 double res = 0.0;
-                for (auto const& pt : pts) {
-                    if (l1.contains(pt)) {
-                        res += pt.get_weight();
+                for (size_t k = 0; k < pts.size(); ++k) {
+                    double w = point_weight(pts, k);
+                    if (inside[k]) {
+                        res += w;
                     }
-
-                    halfspace2_t h_tmp(pivot, pt);
-                    if (!std::isnan(h_tmp[0])) {
-                        auto angle_it = std::lower_bound(angles.begin(), angles.end(), -h_tmp[0]);
+                    if (!std::isnan(angle[k])) {
+                        auto angle_it = std::lower_bound(angles.begin(), angles.end(), angle[k]);
                         //If the angle is begin or end then it is in the last wedge and we don't count it.
                         if (!(angle_it == angles.end() || angle_it == angles.begin())) {
                             auto ix = std::distance(angles.begin(), angle_it) - 1;
-                            if (l1.contains(pt)) {
-                                deltas[ix] -= pt.get_weight();
+                            if (inside[k]) {
+                                deltas[ix] -= w;
                             } else {
-                                deltas[ix] += pt.get_weight();
+                                deltas[ix] += w;
                             }
                         }
                     }
@@ -131,21 +204,71 @@ namespace pyscan{
 
             double red_curr = calc_delta(red, red_delta);
             double blue_curr = calc_delta(blue, blue_delta);
+            std::vector<double> red_weights(halfplanes.size()), blue_weights(halfplanes.size());
             for (size_t j = 0; true ;++j) {
-                double stat = f(red_curr, blue_curr);
-                if (max_discrepancy <= stat) {
-                    max_plane = halfplanes[j];
-                    max_discrepancy = stat;
-                }
+                red_weights[j] = red_curr;
+                blue_weights[j] = blue_curr;
                 if (j == halfplanes.size() - 1) {
                     break;
                 }
                 red_curr += red_delta[j];
                 blue_curr += blue_delta[j];
             }
-        }
+            return max_sweep_halfplane(halfplanes, red_weights, blue_weights, f);
+        };
 
-        return std::make_tuple(max_plane, max_discrepancy);
+        return max_over_pivots(point_net.size() - 1, -std::numeric_limits<double>::infinity(), threads, pivot_max);
+    }
+
+    std::tuple<halfspace2_t, double> max_halfplane_internal(
+            const point_list_t& point_net,
+            const wpoint_list_t& red,
+            const wpoint_list_t& blue,
+            const filter_func2_t& filter,
+            const discrepancy_func2_t& f,
+            size_t threads = 1) {
+        return max_halfplane_sweep(point_net, red, blue, filter, f, threads,
+                [](const pt2_t& pivot, const halfspace2_t& l1, const wpoint_list_t& pts,
+                   std::vector<char>& inside, std::vector<double>& angle) {
+            inside.resize(pts.size());
+            angle.resize(pts.size());
+            for (size_t k = 0; k < pts.size(); ++k) {
+                inside[k] = l1.contains(pts[k]);
+                angle[k] = -halfspace2_t(pivot, pts[k])[0];
+            }
+        });
+    }
+
+    /*
+     * The weighted sweep for points stored in a PointArray. The containment test against the first plane and the
+     * angle of the plane through the pivot and each point are plain arithmetic over the coordinate arrays, so they
+     * are computed in one pass before the points are bucketed into the wedges.
+     */
+    std::tuple<halfspace2_t, double> max_halfplane_internal(
+            const point_list_t& point_net,
+            const PointArray& red,
+            const PointArray& blue,
+            const filter_func2_t& filter,
+            const discrepancy_func2_t& f,
+            size_t threads = 1) {
+        return max_halfplane_sweep(point_net, red, blue, filter, f, threads,
+                [](const pt2_t& pivot, const halfspace2_t& l1, const PointArray& pts,
+                   std::vector<char>& inside, std::vector<double>& angle) {
+            double px = pivot[0], py = pivot[1], ph = pivot[2];
+            double l1x = l1[0], l1y = l1[1], l1h = l1[2];
+            size_t n = pts.size();
+            const double *xs = pts.x.data(), *ys = pts.y.data();
+            inside.resize(n);
+            angle.resize(n);
+            for (size_t k = 0; k < n; ++k) {
+                // l1.contains(pt) and -halfspace2_t(pivot, pt)[0] for pt = (x, y, 1).
+                inside[k] = util::alte(0.0, l1x * xs[k] + l1y * ys[k] + l1h);
+                double a = py - ys[k] * ph;
+                double b = -(px - xs[k] * ph);
+                double inv_norm = 1 / sqrt(a * a + b * b);
+                angle[k] = std::copysign(1.0, b * inv_norm) * (a * inv_norm);
+            }
+        });
     }
 
 
@@ -199,15 +322,13 @@ namespace pyscan{
             const lpoint_list_t& red,
             const lpoint_list_t& blue,
             const filter_func2_t& filter,
-            const discrepancy_func2_t& f) {
-
-        double max_discrepancy = 0.0;
-        halfspace2_t max_plane;
+            const discrepancy_func2_t& f,
+            size_t threads = 1) {
 
         if (point_net.size() < 2) {
-            return {max_plane, max_discrepancy};
+            return {halfspace2_t(), 0.0};
         }
-        for (size_t i = 0; i < point_net.size() - 1; ++i) {
+        auto pivot_max = [&](size_t i) -> pivot_max_t {
             auto pivot = point_net[i];
 
             std::vector<halfspace2_t> halfplanes;
@@ -229,7 +350,7 @@ namespace pyscan{
             halfplanes.resize( std::distance(halfplanes.begin(), new_end));
 
             if (halfplanes.empty()) {
-                continue;
+                return {};
             }
 
             auto& l1 = halfplanes[0];
@@ -282,8 +403,10 @@ namespace pyscan{
             label_set_t blue_set;
             double red_curr = calc_delta(red, red_deltaR, red_deltaA, red_set);
             double blue_curr = calc_delta(blue, blue_deltaR, blue_deltaA, blue_set);
+            std::vector<double> red_weights(halfplanes.size()), blue_weights(halfplanes.size());
             for (size_t j = 0; true ;++j) {
-                double new_stat = f(red_curr, blue_curr);
+                red_weights[j] = red_curr;
+                blue_weights[j] = blue_curr;
 //                if (!util::aeq(range_weight(halfplanes[j], red), red_curr)) {
 //                    std::cout << halfplanes[j].str() << std::endl;
 //                    std::cout << range_weight(halfplanes[j], red) << " " <<   red_curr << std::endl;
@@ -303,20 +426,16 @@ namespace pyscan{
 //                    assert(util::aeq(range_weight(halfplanes[j], blue), blue_curr));
 //                }
 
-
-                if (max_discrepancy <= new_stat) {
-                    max_plane = halfplanes[j];
-                    max_discrepancy = new_stat;
-                }
                 if (j == halfplanes.size() - 1) {
                     break;
                 }
                 red_curr += update_weight(red_set, red_deltaA[j], red_deltaR[j]);
                 blue_curr += update_weight(blue_set, blue_deltaA[j], blue_deltaR[j]);
             }
-        }
+            return max_sweep_halfplane(halfplanes, red_weights, blue_weights, f);
+        };
 
-        return std::make_tuple(max_plane, max_discrepancy);
+        return max_over_pivots(point_net.size() - 1, 0.0, threads, pivot_max);
     }
 
 
@@ -324,13 +443,24 @@ namespace pyscan{
             const point_list_t& point_net,
             const wpoint_list_t& red,
             const wpoint_list_t& blue,
-            const discrepancy_func_t& f) {
+            const discrepancy_func_t& f,
+            size_t threads) {
+        return max_halfplane(point_net, PointArray(red), PointArray(blue), f, threads);
+    }
+
+    std::tuple<halfspace2_t, double> max_halfplane(
+            const point_list_t& point_net,
+            const PointArray& red,
+            const PointArray& blue,
+            const discrepancy_func_t& f,
+            size_t threads) {
         double m_Total = computeTotal(red);
         double b_Total = computeTotal(blue);
 
         return max_halfplane_internal(point_net, red, blue,
                                       [](halfspace2_t const& h) { (void)h; return true;},
-                                      [&](double m, double b) { return f(m, m_Total, b, b_Total);}
+                                      BoundStatistic(f, m_Total, b_Total),
+                                      threads
         );
     }
 
@@ -338,13 +468,15 @@ namespace pyscan{
             const point_list_t& point_net,
             const lpoint_list_t& red,
             const lpoint_list_t& blue,
-            const discrepancy_func_t& f) {
+            const discrepancy_func_t& f,
+            size_t threads) {
         double m_Total = computeTotal(red);
         double b_Total = computeTotal(blue);
 
         return max_halfplane_internal(point_net, red, blue,
                                       [](halfspace2_t const& h) { (void)h; return true;},
-                                      [&](double m, double b) { return f(m, m_Total, b, b_Total);}
+                                      BoundStatistic(f, m_Total, b_Total),
+                                      threads
         );
     }
 
@@ -354,18 +486,17 @@ namespace pyscan{
             const point3_list_t& point_net,
             const std::vector<P<3>>& red,
             const std::vector<P<3>>& blue,
-            const discrepancy_func_t& f) {
+            const discrepancy_func_t& f,
+            size_t threads) {
 
         double m_Total = computeTotal(red);
         double b_Total = computeTotal(blue);
 
-        HalfSpace<3> max_halfspace;
-        double max_discrepancy = 0.0;
-
         if (point_net.size() < 3) {
-            return {max_halfspace, 0.0};
+            return {HalfSpace<3>(), 0.0};
         }
-        for (size_t i = 0; i < point_net.size() - 2; ++i) {
+        std::vector<std::tuple<HalfSpace<3>, double>> pivot_results(point_net.size() - 2);
+        parallel_for(point_net.size() - 2, threads, [&](size_t i, size_t) {
             auto pivot = point_net[i];
             auto drop = [&pivot](const pt3_t& pt) {
                 return drop_point(pivot, pt);
@@ -383,16 +514,21 @@ namespace pyscan{
             //std::cout << blue[0] << drop_blue[0] << std::endl;
             auto [h, max_h] = max_halfplane_internal(drop_net, drop_red, drop_blue,
                                                      [](halfspace2_t const& h) { (void)h; return true;},
-                                                     [&](double m, double b) { return f(m, m_Total, b, b_Total);}
+                                                     BoundStatistic(f, m_Total, b_Total)
             );
 
             //assert(util::aeq(evaluate_range(h, drop_red, drop_blue, f), max_h));
+            pivot_results[i] = std::make_tuple(HalfSpace<3>(lift_half_space(h, pivot)), max_h);
+        });
+
+        HalfSpace<3> max_halfspace;
+        double max_discrepancy = 0.0;
+        for (auto& [h, max_h] : pivot_results) {
             if (max_h >= max_discrepancy) {
                 max_discrepancy = max_h;
-                max_halfspace = HalfSpace<3>(lift_half_space(h, pivot));
+                max_halfspace = h;
                 //assert(util::aeq(evaluate_range(max_halfspace, red, blue, f), max_h));
             }
-
         }
         return std::make_tuple(halfspace3_t(max_halfspace), max_discrepancy);
     }
@@ -402,16 +538,18 @@ namespace pyscan{
             const point3_list_t& point_net,
             const lpoint3_list_t& red,
             const lpoint3_list_t& blue,
-            const discrepancy_func_t& f) {
-        return max_halfspace_internal(point_net, red, blue, f);
+            const discrepancy_func_t& f,
+            size_t threads) {
+        return max_halfspace_internal(point_net, red, blue, f, threads);
     }
 
     std::tuple<halfspace3_t, double> max_halfspace(
             const point3_list_t& point_net,
             const wpoint3_list_t& red,
             const wpoint3_list_t& blue,
-            const discrepancy_func_t& f) {
-        return max_halfspace_internal(point_net, red, blue, f);
+            const discrepancy_func_t& f,
+            size_t threads) {
+        return max_halfspace_internal(point_net, red, blue, f, threads);
     }
 
 
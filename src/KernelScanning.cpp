@@ -10,10 +10,14 @@
 #include <tuple>
 #include <functional>
 #include <memory>
-#include <gsl/gsl_multimin.h>
+#include <iterator>
+#include <algorithm>
+#include <cassert>
+#include <limits>
 
 #include "Sampling.hpp"
 #include "KernelScanning.hpp"
+#include "PointArray.hpp"
 #include "Gridding.hpp"
 #include "Utilities.hpp"
 
@@ -34,118 +38,72 @@ namespace pyscan {
 //
 
 
-    double
-    unwrap_f(const gsl_vector *v, void *params)
-    {
-        auto fp = static_cast<Bernoulli_Disk*>(params);
-
-        double p = gsl_vector_get(v, 0);
-        double q = gsl_vector_get(v, 1);
-        return -fp->alternative_hyp(p, q);
-    }
-
-    /* The gradient of f, df = (df/dx, df/dy). */
-    void
-    unwrap_df (const gsl_vector *v, void *params,
-           gsl_vector *df)
-    {
-        auto fp = static_cast<Bernoulli_Disk*>(params);
-
-        double p = gsl_vector_get(v, 0);
-        double q = gsl_vector_get(v, 1);
-
-        auto [dfp, dfq] = fp->diff(p, q);
-        gsl_vector_set(df, 0, -dfp);
-        gsl_vector_set(df, 1, -dfq);
-    }
-
-    /* Compute both f and df together. */
-    void
-    unwrap_fdf (const gsl_vector *x, void *params,
-            double *f, gsl_vector *df)
-    {
-        *f = unwrap_f(x, params);
-        unwrap_df(x, params, df);
-    }
-
+    /*
+     * Projected Newton's method on the concave likelihood. Each step solves H s = -g with a small ridge on the
+     * diagonal, for the case where no point has kernel weight and p is unconstrained, and then halves the step
+     * until the point clipped to the box increases the likelihood enough. Nothing is allocated, and from a nearby
+     * start it usually stops within a few iterations.
+     */
     std::tuple<double, double, double> find_pq_poi(
             double p_init,
             double q_init,
             const Bernoulli_Disk& disc_f) {
-        size_t iter = 0;
-        int status = GSL_CONTINUE;
-
-        const gsl_multimin_fdfminimizer_type *T;
-        gsl_multimin_fdfminimizer *s;
-
-        gsl_vector *x;
-        gsl_multimin_function_fdf my_func;
-
-        my_func.n = 2;
-        my_func.f = unwrap_f;
-        my_func.df = unwrap_df;
-        my_func.fdf = unwrap_fdf;
-        my_func.params = (void*)&disc_f;
-
-        /*Initialize the vector x to be p_init and q_init*/
-        x = gsl_vector_alloc (2);
-        gsl_vector_set (x, 0, p_init);
-        gsl_vector_set (x, 1, q_init);
-
-        T = gsl_multimin_fdfminimizer_conjugate_fr;
-        s = gsl_multimin_fdfminimizer_alloc (T, 2);
-
-        /*
-         * The initial step-size is chosen as 0.01, and the line minimization parameter is set at 0.0001.
-         */
-        gsl_multimin_fdfminimizer_set (s, &my_func, x, 0.01, 1e-4);
-
-        double p_o = p_init, q_o = q_init;
-        do
-        {
-            iter++;
-
-            status = gsl_multimin_fdfminimizer_iterate (s);
-
-            if (status)
+        const double lower = 1e-4, upper = 1 - 1e-4;
+        auto clip = [&](double v) {
+            return std::min(std::max(v, lower), upper);
+        };
+        if (std::isnan(p_init) || std::isnan(q_init)) {
+            p_init = .6;
+            q_init = .5;
+        }
+        double p = clip(p_init), q = clip(q_init);
+        auto d = disc_f.value_diff_hessian(p, q);
+        for (size_t iter = 0; iter < 100; iter++) {
+            //A coordinate pushing against a side of the box it is already on cannot move.
+            double gp = d.dp, gq = d.dq;
+            if ((p <= lower && gp < 0) || (p >= upper && gp > 0)) gp = 0;
+            if ((q <= lower && gq < 0) || (q >= upper && gq > 0)) gq = 0;
+            if (std::sqrt(gp * gp + gq * gq) < 1e-4) {
                 break;
-            /*
-             * The program terminates when the norm of the gradient has been reduced below 0.001.
-             */
-            double p = gsl_vector_get(s->x, 0);
-            double q = gsl_vector_get(s->x, 1);
-            bool trig = true;
-            if (p <= 0) {
-                p = 1e-4;
-            } else if (p > 1) {
-                p = 1 - 1e-4;
-            } else if (q <= 0) {
-                q = 1e-4;
-            } else if (q >= 1) {
-                q = 1 - 1e-4;
-            } else if (std::isnan(q) || std::isnan(p)) {
-                //restart at the last location.
-                p = p_o;
-                q = q_o;
-            } else {
-                trig = false;
             }
 
-            if (trig) {
-                gsl_vector_set (x, 0, p);
-                gsl_vector_set (x, 1, q);
-                gsl_multimin_fdfminimizer_set (s, &my_func, x, 0.01, 1e-4);
+            double a = -d.dpp, b = -d.dpq, c = -d.dqq;
+            double ridge = 1e-10 * (a + c) + 1e-12;
+            a += ridge;
+            c += ridge;
+            double det = a * c - b * b;
+            double sp, sq;
+            if (det > 0) {
+                sp = (c * d.dp - b * d.dq) / det;
+                sq = (a * d.dq - b * d.dp) / det;
             } else {
-                status = gsl_multimin_test_gradient(s->gradient, 1e-4);
+                sp = d.dp / a;
+                sq = d.dq / c;
+            }
+
+            double t = 1.0;
+            double np = p, nq = q;
+            bool moved = false;
+            while (t > 1e-12) {
+                np = clip(p + t * sp);
+                nq = clip(q + t * sq);
+                double gain = d.dp * (np - p) + d.dq * (nq - q);
+                if (np == p && nq == q) {
+                    break;
+                }
+                if (disc_f.alternative_hyp(np, nq) >= d.value + 1e-4 * gain) {
+                    moved = true;
+                    break;
+                }
+                t /= 2;
             }
-            p_o = p;
-            q_o = q;
-        } while (status == GSL_CONTINUE && iter < 100);
-
-        double p = gsl_vector_get(s->x, 0);
-        double q = gsl_vector_get(s->x, 1);
-        gsl_multimin_fdfminimizer_free (s);
-        gsl_vector_free (x);
+            if (!moved) {
+                break;
+            }
+            p = np;
+            q = nq;
+            d = disc_f.value_diff_hessian(p, q);
+        }
         double f_val = disc_f.lrt(p, q);
         //If this region does not have a higher than normal measured than baseline points
         return std::make_tuple(p, q, f_val);
@@ -183,10 +141,18 @@ namespace pyscan {
         return find_pq_poi(.6, .5, disc);
     }
 
+    /*
+     * The Gaussian kernel. The grid scans evaluate it from squared distances with from_squared, which skips the
+     * square root and the division.
+     */
     struct Kernel {
         double operator()(double dist, double bandwidth) {
             return exp(-dist * dist / (bandwidth * bandwidth));
         }
+
+        static double from_squared(double dist2, double inv_h2) {
+            return exp(-dist2 * inv_h2);
+        }
     };
 
 
@@ -211,26 +177,30 @@ namespace pyscan {
             b_weights.emplace_back(p.get_weight());
         }
         disc.set_weights(m_weights, b_weights);
-        std::vector<double> m_radii(measured.size(), 0.0);
-        std::vector<double> b_radii(baseline.size(), 0.0);
+        PointArray m_arr(measured);
+        PointArray b_arr(baseline);
 
         double p_init = .6;
         double q_init = .5;
 
+        //The kernel values are written straight into disc, so this only holds for the Gaussian Kernel.
+        assert(disc.kernel.target<Kernel>() != nullptr);
+        double inv_h2 = 1 / (disc.bandwidth * disc.bandwidth);
+        auto kernel_values = [inv_h2](PointArray const& pts, double x, double y, std::vector<double>& fr) {
+            for (size_t i = 0; i < pts.size(); i++) {
+                double dx = pts.x[i] - x;
+                double dy = pts.y[i] - y;
+                fr[i] = Kernel::from_squared(dx * dx + dy * dy, inv_h2);
+            }
+        };
+
         auto [mnx, mny, mxx, mxy] = full_bb;
         for (double x = mnx; x < mxx; ) {
             for (double y = mny; y < mxy; ) {
 
-                pt2_t center(x, y, 1.0);
                 Disk disk(x, y, disk_r);
-                for (size_t i = 0; i < measured.size(); i++) {
-                    m_radii[i] = center.dist(measured[i]);
-                }
-                for (size_t i = 0; i < baseline.size(); i++) {
-                    b_radii[i] = center.dist(baseline[i]);
-                }
-
-                disc.set_radii(m_radii, b_radii);
+                kernel_values(m_arr, x, y, disc.m_fr);
+                kernel_values(b_arr, x, y, disc.b_fr);
 
                 auto[p, q, fval] = find_pq_poi(p_init, q_init, disc);
 
@@ -276,6 +246,168 @@ namespace pyscan {
         return max_kernel_slow_internal(measured, baseline, grid_res, disk_r, disc, edited_bb);
     }
 
+    /*
+     * The points of one set bucketed into square cells of side cell, stored cell by cell, so the points within
+     * cell of any location are in the 3 x 3 block of cells around it. The number of cells along a side is capped and
+     * the cells grow instead when cell is tiny compared to the extent of the points.
+     */
+    class CellIndex {
+    public:
+        CellIndex(const PointArray& pts, double cell) {
+            if (pts.size() == 0) {
+                return;
+            }
+            lx = *std::min_element(pts.x.begin(), pts.x.end());
+            ly = *std::min_element(pts.y.begin(), pts.y.end());
+            double ux = *std::max_element(pts.x.begin(), pts.x.end());
+            double uy = *std::max_element(pts.y.begin(), pts.y.end());
+            side = std::max({cell, (ux - lx) / MAX_CELLS, (uy - ly) / MAX_CELLS, std::numeric_limits<double>::min()});
+            nx = static_cast<size_t>((ux - lx) / side) + 1;
+            ny = static_cast<size_t>((uy - ly) / side) + 1;
+
+            std::vector<size_t> cell_of(pts.size());
+            offsets.assign(nx * ny + 1, 0);
+            for (size_t i = 0; i < pts.size(); i++) {
+                cell_of[i] = std::min(column(pts.x[i]), nx - 1) * ny + std::min(row(pts.y[i]), ny - 1);
+                offsets[cell_of[i] + 1]++;
+            }
+            for (size_t c = 0; c < nx * ny; c++) {
+                offsets[c + 1] += offsets[c];
+            }
+            x.resize(pts.size());
+            y.resize(pts.size());
+            w.resize(pts.size());
+            std::vector<size_t> next(offsets.begin(), offsets.end() - 1);
+            for (size_t i = 0; i < pts.size(); i++) {
+                size_t j = next[cell_of[i]]++;
+                x[j] = pts.x[i];
+                y[j] = pts.y[i];
+                w[j] = pts.w[i];
+            }
+        }
+
+        //Calls f(squared distance, weight) for every point within r of (cx, cy).
+        template <typename F>
+        void near(double cx, double cy, double r, F&& f) const {
+            if (nx == 0) {
+                return;
+            }
+            double r2 = r * r;
+            size_t c_lo = column(cx - r), c_hi = std::min(column(cx + r), nx - 1);
+            size_t r_lo = row(cy - r), r_hi = std::min(row(cy + r), ny - 1);
+            if (r_lo > r_hi) {
+                return;
+            }
+            for (size_t c = c_lo; c <= c_hi; c++) {
+                for (size_t j = offsets[c * ny + r_lo]; j < offsets[c * ny + r_hi + 1]; j++) {
+                    double dx = x[j] - cx;
+                    double dy = y[j] - cy;
+                    double d2 = dx * dx + dy * dy;
+                    if (d2 <= r2) {
+                        f(d2, w[j]);
+                    }
+                }
+            }
+        }
+
+    private:
+        static constexpr double MAX_CELLS = 2048;
+
+        //The cell coordinates, clamped below at 0. Callers clamp above.
+        size_t column(double v) const {
+            return v <= lx ? 0 : static_cast<size_t>(std::min((v - lx) / side, 2 * MAX_CELLS));
+        }
+
+        size_t row(double v) const {
+            return v <= ly ? 0 : static_cast<size_t>(std::min((v - ly) / side, 2 * MAX_CELLS));
+        }
+
+        double lx = 0, ly = 0, side = 1;
+        size_t nx = 0, ny = 0;
+        //The points of cell (c, r) are [offsets[c * ny + r], offsets[c * ny + r + 1]).
+        std::vector<size_t> offsets;
+        std::vector<double> x;
+        std::vector<double> y;
+        std::vector<double> w;
+    };
+
+    std::tuple<Disk, double, double> max_kernel_truncated(
+            const wpoint_list_t &measured,
+            const wpoint_list_t &baseline,
+            double grid_res,
+            double disk_r,
+            double bandwidth,
+            double cutoff) {
+        double red_tot = computeTotal(measured);
+        double blue_tot = computeTotal(baseline);
+        Kernel kern;
+        Bernoulli_Disk disc(red_tot, blue_tot, bandwidth, kern);
+        Disk curr_max;
+        double max_stat = 0.0;
+
+        auto bb_op = bbox(measured, baseline);
+        if (!bb_op.has_value()) {
+            return std::make_tuple(curr_max, max_stat, 0.0);
+        }
+        PointArray m_arr(measured);
+        PointArray b_arr(baseline);
+        CellIndex m_index(m_arr, cutoff);
+        CellIndex b_index(b_arr, cutoff);
+
+        double inv_h2 = 1 / (bandwidth * bandwidth);
+        double p_init = .6;
+        double q_init = .5;
+        double max_p = p_init, max_q = q_init;
+
+        auto [mnx, mny, mxx, mxy] = bb_op.value();
+        for (double x = mnx - disk_r; x < mxx + disk_r; ) {
+            for (double y = mny - disk_r; y < mxy + disk_r; ) {
+                disc.clear_points();
+                m_index.near(x, y, cutoff, [&](double d2, double w) {
+                    disc.add_measured(w, Kernel::from_squared(d2, inv_h2));
+                });
+                b_index.near(x, y, cutoff, [&](double d2, double w) {
+                    disc.add_baseline(w, Kernel::from_squared(d2, inv_h2));
+                });
+
+                auto[p, q, fval] = find_pq_poi(p_init, q_init, disc);
+                if (std::isnan(p) || std::isnan(q) || p <= 0 || q <= 0 || p >= 1 || q >= 1) {
+                    p_init = .6;
+                    q_init = .5;
+                } else {
+                    p_init = p;
+                    q_init = q;
+                }
+                if (max_stat < fval) {
+                    max_stat = fval;
+                    curr_max = Disk(x, y, disk_r);
+                    max_p = p;
+                    max_q = q;
+                }
+                y = y + grid_res;
+            }
+            x = x + grid_res;
+        }
+
+        if (max_stat <= 0) {
+            return std::make_tuple(curr_max, max_stat, 0.0);
+        }
+        //The statistic of the best center again with every point given its exact kernel value.
+        auto origin = curr_max.getOrigin();
+        auto exact_values = [&](PointArray const& pts, void (Bernoulli_Disk::*add)(double, double)) {
+            for (size_t i = 0; i < pts.size(); i++) {
+                double dx = pts.x[i] - origin(0);
+                double dy = pts.y[i] - origin(1);
+                (disc.*add)(pts.w[i], Kernel::from_squared(dx * dx + dy * dy, inv_h2));
+            }
+        };
+        disc.clear_points();
+        exact_values(m_arr, &Bernoulli_Disk::add_measured);
+        exact_values(b_arr, &Bernoulli_Disk::add_baseline);
+        double error = std::abs(disc.lrt(max_p, max_q) - max_stat);
+        return std::make_tuple(curr_max, max_stat, error);
+    }
+
 
     template<bool enable_prune, bool adaptive_grid>
     std::tuple<Disk, double> max_kernel_internal(
@@ -302,25 +434,19 @@ namespace pyscan {
 
         for (size_t x_off = 0; x_off < 3; x_off++) {
             for (size_t y_off = 0; y_off < 3; y_off++) {
+                //Subtracting the offset keeps the lower corner at or below the smallest coordinate. Adding
+                //x_off * radius_size first can round past it and drop the boundary points from the grids.
                 auto bb = std::make_tuple(
-                        std::get<0>(full_bb) + x_off * radius_size - 2 * radius_size,
-                        std::get<1>(full_bb) + y_off * radius_size - 2 * radius_size,
+                        std::get<0>(full_bb) - (2.0 - x_off) * radius_size,
+                        std::get<1>(full_bb) - (2.0 - y_off) * radius_size,
                         std::get<2>(full_bb) + x_off * radius_size,
                         std::get<3>(full_bb) + y_off * radius_size);
                 //Define a coarse grid.
                 SparseGrid<wpt2_t> grid_red(bb, measured, radius_size * 3), grid_blue(bb, baseline, radius_size * 3);
                 std::vector<uint64_t> keys;
-                {
-                    for (auto b = grid_red.begin(); b != grid_red.end(); b++) {
-                        keys.emplace_back(b->first);
-                    }
-                    for (auto b = grid_blue.begin(); b != grid_blue.end(); b++) {
-                        keys.emplace_back(b->first);
-                    }
-                    std::sort(keys.begin(), keys.end());
-                    auto nend = std::unique(keys.begin(), keys.end());
-                    keys.erase(nend, keys.end());
-                }
+                std::set_union(grid_red.cells().begin(), grid_red.cells().end(),
+                               grid_blue.cells().begin(), grid_blue.cells().end(),
+                               std::back_inserter(keys));
 
                 //Consider cells with points in them, so they must have $\eps n$ values
                 for (auto k : keys) {
@@ -453,25 +579,18 @@ namespace pyscan {
         point_list_t centers;
         for (size_t x_off = 0; x_off < 3; x_off++) {
             for (size_t y_off = 0; y_off < 3; y_off++) {
+                //The offset is subtracted for the same reason as in max_kernel_internal.
                 auto bb = std::make_tuple(
-                        std::get<0>(full_bb) + x_off * radius_size - 2 * radius_size,
-                        std::get<1>(full_bb) + y_off * radius_size - 2 * radius_size,
+                        std::get<0>(full_bb) - (2.0 - x_off) * radius_size,
+                        std::get<1>(full_bb) - (2.0 - y_off) * radius_size,
                         std::get<2>(full_bb) + x_off * radius_size,
                         std::get<3>(full_bb) + y_off * radius_size);
                 //Define a coarse grid.
                 SparseGrid<wpt2_t> grid_red(bb, measured, radius_size * 3), grid_blue(bb, baseline, radius_size * 3);
                 std::vector<uint64_t> keys;
-                {
-                    for (auto b = grid_red.begin(); b != grid_red.end(); b++) {
-                        keys.emplace_back(b->first);
-                    }
-                    for (auto b = grid_blue.begin(); b != grid_blue.end(); b++) {
-                        keys.emplace_back(b->first);
-                    }
-                    std::sort(keys.begin(), keys.end());
-                    auto nend = std::unique(keys.begin(), keys.end());
-                    keys.erase(nend, keys.end());
-                }
+                std::set_union(grid_red.cells().begin(), grid_red.cells().end(),
+                               grid_blue.cells().begin(), grid_blue.cells().end(),
+                               std::back_inserter(keys));
 
                 //Consider cells with points in them, so they must have $\eps n$ values
                 for (auto k : keys) {
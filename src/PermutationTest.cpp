@@ -0,0 +1,195 @@
+#include <numeric>
+#include <random>
+
+#include "DiskScan.hpp"
+#include "HalfSpaceScan.hpp"
+#include "KernelScanning.hpp"
+#include "Parallel.hpp"
+#include "PermutationTest.hpp"
+#include "PointArray.hpp"
+#include "RectangleScan.hpp"
+
+namespace pyscan {
+
+    inline static size_t permutation_workers(size_t threads, size_t replicates) {
+        return std::max<size_t>(std::min(resolve_thread_count(threads), replicates), 1);
+    }
+
+    /*
+     * Runs the replicates of a permutation test. scan(order, worker) returns the maximum statistic when the points
+     * order[0, red_count) of the pool are red and the rest are blue. Every worker owns an index buffer that is
+     * reset and then partially shuffled in place for each replicate.
+     */
+    template <typename Scan>
+    static permutation_result_t permutation_test_internal(
+            size_t red_count,
+            size_t total,
+            const Scan &scan,
+            size_t replicates,
+            uint64_t seed,
+            size_t threads) {
+
+        std::vector<size_t> identity(total);
+        std::iota(identity.begin(), identity.end(), 0);
+        double observed = scan(identity, 0);
+
+        size_t workers = permutation_workers(threads, replicates);
+        std::vector<std::vector<size_t>> orders(workers);
+        std::vector<double> null_dist(replicates, 0.0);
+        parallel_for(replicates, workers, [&](size_t rep, size_t worker) {
+            auto &order = orders[worker];
+            order = identity;
+            std::seed_seq seq{static_cast<uint32_t>(seed), static_cast<uint32_t>(seed >> 32),
+                              static_cast<uint32_t>(rep), static_cast<uint32_t>(static_cast<uint64_t>(rep) >> 32)};
+            std::mt19937_64 gen(seq);
+            // Only the first red_count positions of a Fisher-Yates shuffle decide the labels.
+            for (size_t i = 0; i < red_count && i + 1 < total; ++i) {
+                std::uniform_int_distribution<size_t> dist(i, total - 1);
+                std::swap(order[i], order[dist(gen)]);
+            }
+            null_dist[rep] = scan(order, worker);
+        });
+
+        size_t at_least = 0;
+        for (double v : null_dist) {
+            if (v >= observed) at_least++;
+        }
+        std::sort(null_dist.begin(), null_dist.end());
+        double p_value = (1.0 + at_least) / (replicates + 1.0);
+        return std::make_tuple(observed, null_dist, p_value);
+    }
+
+    /*
+     * Splits the pool into per worker red and blue PointArrays according to the shuffled order.
+     */
+    class PoolSplitter {
+    public:
+        PoolSplitter(const wpoint_list_t &red, const wpoint_list_t &blue, size_t workers) :
+                pool(red), red_count(red.size()), red_parts(workers), blue_parts(workers) {
+            pool.reserve(red.size() + blue.size());
+            for (auto &pt : blue) {
+                pool.push_back(pt(0), pt(1), pt.get_weight());
+            }
+        }
+
+        size_t size() const {
+            return pool.size();
+        }
+
+        std::tuple<const PointArray &, const PointArray &> split(const std::vector<size_t> &order, size_t worker) {
+            auto &red_part = red_parts[worker];
+            auto &blue_part = blue_parts[worker];
+            red_part.clear();
+            blue_part.clear();
+            for (size_t i = 0; i < order.size(); ++i) {
+                if (i < red_count) {
+                    red_part.push_back(pool, order[i]);
+                } else {
+                    blue_part.push_back(pool, order[i]);
+                }
+            }
+            return std::tie(red_part, blue_part);
+        }
+
+    private:
+        PointArray pool;
+        size_t red_count;
+        std::vector<PointArray> red_parts;
+        std::vector<PointArray> blue_parts;
+    };
+
+    permutation_result_t permutation_test_rectangle(
+            const wpoint_list_t &red,
+            const wpoint_list_t &blue,
+            double eps,
+            double a,
+            double b,
+            size_t replicates,
+            uint64_t seed,
+            size_t threads) {
+
+        assert(!red.empty() && !blue.empty());
+        // The ranks only depend on the coordinates, so all of the points are ranked once as one set.
+        wpoint_list_t pool(red);
+        pool.insert(pool.end(), blue.begin(), blue.end());
+        auto ranked = std::get<0>(to_epoints(pool, wpoint_list_t()));
+
+        size_t workers = permutation_workers(threads, replicates);
+        std::vector<epoint_list_t> red_parts(workers), blue_parts(workers);
+        auto scan = [&](const std::vector<size_t> &order, size_t worker) {
+            auto &red_part = red_parts[worker];
+            auto &blue_part = blue_parts[worker];
+            red_part.clear();
+            blue_part.clear();
+            for (size_t i = 0; i < order.size(); ++i) {
+                (i < red.size() ? red_part : blue_part).emplace_back(ranked[order[i]]);
+            }
+            return std::get<1>(max_erectangle(red_part, blue_part, eps, a, b));
+        };
+        return permutation_test_internal(red.size(), pool.size(), scan, replicates, seed, workers);
+    }
+
+    permutation_result_t permutation_test_disk(
+            const point_list_t &point_net,
+            const wpoint_list_t &red,
+            const wpoint_list_t &blue,
+            double min_res,
+            const discrepancy_func_t &f,
+            size_t replicates,
+            uint64_t seed,
+            size_t threads) {
+
+        size_t workers = permutation_workers(threads, replicates);
+        PoolSplitter splitter(red, blue, workers);
+        auto scan = [&](const std::vector<size_t> &order, size_t worker) {
+            auto [red_part, blue_part] = splitter.split(order, worker);
+            return std::get<1>(max_disk_scale(point_net, red_part, blue_part, min_res, f, 1));
+        };
+        return permutation_test_internal(red.size(), splitter.size(), scan, replicates, seed, workers);
+    }
+
+    permutation_result_t permutation_test_halfplane(
+            const point_list_t &point_net,
+            const wpoint_list_t &red,
+            const wpoint_list_t &blue,
+            const discrepancy_func_t &f,
+            size_t replicates,
+            uint64_t seed,
+            size_t threads) {
+
+        size_t workers = permutation_workers(threads, replicates);
+        PoolSplitter splitter(red, blue, workers);
+        auto scan = [&](const std::vector<size_t> &order, size_t worker) {
+            auto [red_part, blue_part] = splitter.split(order, worker);
+            return std::get<1>(max_halfplane(point_net, red_part, blue_part, f, 1));
+        };
+        return permutation_test_internal(red.size(), splitter.size(), scan, replicates, seed, workers);
+    }
+
+    permutation_result_t permutation_test_kernel(
+            const wpoint_list_t &red,
+            const wpoint_list_t &blue,
+            double grid_res,
+            double radius_size,
+            double bandwidth,
+            size_t replicates,
+            uint64_t seed,
+            size_t threads) {
+
+        size_t workers = permutation_workers(threads, replicates);
+        wpoint_list_t pool(red);
+        pool.insert(pool.end(), blue.begin(), blue.end());
+        std::vector<wpoint_list_t> red_parts(workers), blue_parts(workers);
+        auto scan = [&](const std::vector<size_t> &order, size_t worker) {
+            auto &red_part = red_parts[worker];
+            auto &blue_part = blue_parts[worker];
+            red_part.clear();
+            blue_part.clear();
+            for (size_t i = 0; i < order.size(); ++i) {
+                (i < red.size() ? red_part : blue_part).emplace_back(pool[order[i]]);
+            }
+            return std::get<1>(max_kernel(red_part, blue_part, grid_res, radius_size, bandwidth));
+        };
+        return permutation_test_internal(red.size(), pool.size(), scan, replicates, seed, workers);
+    }
+}
@@ -0,0 +1,196 @@
+#include <numeric>
+
+#include "Range.hpp"
+#include "RangeIndex.hpp"
+
+namespace pyscan {
+
+    RangeIndex::RangeIndex(std::vector<Box> const &boxes, std::vector<double> const &weights) :
+        boxes(boxes), weights(weights), order(boxes.size()) {
+        std::iota(order.begin(), order.end(), 0);
+        if (!order.empty()) {
+            nodes.reserve(2 * (order.size() / LEAF_SIZE + 1));
+            build(0, order.size());
+        }
+    }
+
+    size_t RangeIndex::build(size_t first, size_t last) {
+        size_t ix = nodes.size();
+        nodes.emplace_back();
+        Box box = boxes[order[first]];
+        double weight = 0;
+        for (size_t i = first; i < last; i++) {
+            auto const &b = boxes[order[i]];
+            box.lx = std::min(box.lx, b.lx);
+            box.ly = std::min(box.ly, b.ly);
+            box.ux = std::max(box.ux, b.ux);
+            box.uy = std::max(box.uy, b.uy);
+            weight += weights[order[i]];
+        }
+        size_t left = 0, right = 0;
+        //The depth is bounded by log2(n / LEAF_SIZE) + 1 since every split is at the median.
+        if (last - first > LEAF_SIZE) {
+            bool split_x = box.ux - box.lx >= box.uy - box.ly;
+            auto center = [&](size_t item) {
+                auto const &b = boxes[item];
+                return split_x ? b.lx + b.ux : b.ly + b.uy;
+            };
+            size_t mid = first + (last - first) / 2;
+            std::nth_element(order.begin() + first, order.begin() + mid, order.begin() + last,
+                    [&](size_t i, size_t j) { return center(i) < center(j); });
+            left = build(first, mid);
+            right = build(mid, last);
+        }
+        nodes[ix] = Node{box, weight, first, last, left, right};
+        return ix;
+    }
+
+    template <typename Pts>
+    static RangeIndex point_index_internal(const Pts &pts) {
+        std::vector<Box> boxes;
+        std::vector<double> weights;
+        boxes.reserve(pts.size());
+        weights.reserve(pts.size());
+        for (auto &pt : pts) {
+            boxes.push_back(Box{pt(0), pt(1), pt(0), pt(1)});
+            weights.push_back(pt.get_weight());
+        }
+        return RangeIndex(boxes, weights);
+    }
+
+    RangeIndex point_index(const wpoint_list_t &pts) {
+        return point_index_internal(pts);
+    }
+
+    RangeIndex point_index(const lpoint_list_t &pts) {
+        return point_index_internal(pts);
+    }
+
+    RangeIndex trajectory_index(const trajectory_set_t &trajs, std::vector<size_t> &items) {
+        std::vector<Box> boxes;
+        std::vector<double> weights;
+        items.clear();
+        for (size_t i = 0; i < trajs.size(); i++) {
+            auto const &traj = trajs[i];
+            if (traj.empty()) {
+                continue;
+            }
+            Box box{traj[0](0), traj[0](1), traj[0](0), traj[0](1)};
+            for (auto &pt : traj) {
+                box.lx = std::min(box.lx, pt(0));
+                box.ly = std::min(box.ly, pt(1));
+                box.ux = std::max(box.ux, pt(0));
+                box.uy = std::max(box.uy, pt(1));
+            }
+            boxes.push_back(box);
+            weights.push_back(traj.get_weight());
+            items.push_back(i);
+        }
+        return RangeIndex(boxes, weights);
+    }
+
+    static wpoint_list_t to_weighted(const point_list_t &pts) {
+        wpoint_list_t wpts;
+        wpts.reserve(pts.size());
+        for (auto &pt : pts) {
+            wpts.emplace_back(1.0, pt(0), pt(1), 1.0);
+        }
+        return wpts;
+    }
+
+    static std::vector<size_t> identity(size_t n) {
+        std::vector<size_t> items(n);
+        std::iota(items.begin(), items.end(), 0);
+        return items;
+    }
+
+    SpatialIndex::SpatialIndex(const wpoint_list_t &pts) :
+        points(pts), items(identity(pts.size())), index(point_index(pts)),
+        item_count(pts.size()), total_weight(computeTotal(pts)) {}
+
+    SpatialIndex::SpatialIndex(const point_list_t &pts) : SpatialIndex(to_weighted(pts)) {}
+
+    SpatialIndex::SpatialIndex(const trajectory_set_t &trajs) :
+        trajectories(trajs), index(trajectory_index(trajs, items)),
+        item_count(trajs.size()), total_weight(computeTotal(trajs)) {}
+
+    template <typename R>
+    bool SpatialIndex::accepts(const R &range, size_t item) const {
+        if (trajectories.empty()) {
+            return range.contains(points[item]);
+        } else {
+            return range.intersects_trajectory(trajectories[items[item]]);
+        }
+    }
+
+    template <typename R>
+    double SpatialIndex::weight_internal(const R &range) const {
+        double w = 0;
+        index.query(range,
+                [&](size_t item) { return accepts(range, item); },
+                [&](RangeIndex::Node const &node) { w += node.weight; },
+                [&](size_t item) { w += index.weight(item); });
+        return w;
+    }
+
+    template <typename R>
+    size_t SpatialIndex::count_internal(const R &range) const {
+        size_t c = 0;
+        index.query(range,
+                [&](size_t item) { return accepts(range, item); },
+                [&](RangeIndex::Node const &node) { c += node.last - node.first; },
+                [&](size_t) { c++; });
+        return c;
+    }
+
+    template <typename R>
+    std::vector<size_t> SpatialIndex::inside_internal(const R &range) const {
+        std::vector<size_t> found;
+        index.query(range,
+                [&](size_t item) { return accepts(range, item); },
+                [&](RangeIndex::Node const &node) {
+                    for (size_t i = node.first; i < node.last; i++) {
+                        found.push_back(items[index.item(i)]);
+                    }
+                },
+                [&](size_t item) { found.push_back(items[item]); });
+        std::sort(found.begin(), found.end());
+        return found;
+    }
+
+    double SpatialIndex::weight(const Disk &range) const {
+        return weight_internal(range);
+    }
+
+    double SpatialIndex::weight(const Rectangle &range) const {
+        return weight_internal(range);
+    }
+
+    double SpatialIndex::weight(const halfspace2_t &range) const {
+        return weight_internal(range);
+    }
+
+    size_t SpatialIndex::count(const Disk &range) const {
+        return count_internal(range);
+    }
+
+    size_t SpatialIndex::count(const Rectangle &range) const {
+        return count_internal(range);
+    }
+
+    size_t SpatialIndex::count(const halfspace2_t &range) const {
+        return count_internal(range);
+    }
+
+    std::vector<size_t> SpatialIndex::inside(const Disk &range) const {
+        return inside_internal(range);
+    }
+
+    std::vector<size_t> SpatialIndex::inside(const Rectangle &range) const {
+        return inside_internal(range);
+    }
+
+    std::vector<size_t> SpatialIndex::inside(const halfspace2_t &range) const {
+        return inside_internal(range);
+    }
+}
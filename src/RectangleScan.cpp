@@ -4,6 +4,8 @@
 #include <functional>
 #include <tuple>
 #include <unordered_set>
+#include <unordered_map>
+#include <numeric>
 //#include <zlib.h>
 #include <memory>
 
@@ -11,6 +13,8 @@
 #include "Range.hpp"
 #include "RectangleScan.hpp"
 #include "FunctionApprox.hpp"
+#include "Parallel.hpp"
+#include "Simd.hpp"
 
 namespace pyscan {
 
@@ -238,46 +242,150 @@ namespace pyscan {
     }
 
     /*
-     * Simple 1/eps^4 algorithm described in the paper that just computes every subgrid.
-     * This will work on a nonlinear function.
+     * The subgrid scan sweeps SUBGRID_LANES columns k at a time. At step d lane t adds column k + t + d to its
+     * running sum, so every lane sums its columns in the same order as a column by column sweep and produces the
+     * same values, while each step is a contiguous vector load. A block keeps its sums and statistic values for
+     * all of its steps, which is 3 * SUBGRID_LANES * r doubles and stays in L2 for the grid sizes we scan.
+     *
+     * The scan still evaluates the statistic once for each of the r^4 / 4 subgrids. For the built in statistics
+     * the divisions in that evaluation dominate the cost, so blocking the sums further does not make it faster.
      */
-    Subgrid max_subgrid(Grid const &grid, const discrepancy_func_t &func) {
-        std::vector<double> red_count(grid.size(), 0);
-        std::vector<double> blue_count(grid.size(), 0);
-
+#if defined(PYSCAN_SIMD)
+    constexpr size_t SUBGRID_LANES = Simd::width;
+#else
+    constexpr size_t SUBGRID_LANES = 8;
+#endif
+
+    struct SubgridScratch {
+        std::vector<double> red_count;
+        std::vector<double> blue_count;
+        std::vector<double> red_sums;
+        std::vector<double> blue_sums;
+        std::vector<double> values;
+    };
 
+    /*
+     * Scans every subgrid whose lowest row is i and leaves the first maximum in row, column order in max.
+     */
+    template <typename Stat>
+    static void max_subgrid_band(Grid const &grid, size_t i, const Stat &func, SubgridScratch &scratch,
+            Subgrid &max) {
+        size_t r = grid.size();
         auto t_red = static_cast<double>(grid.totalRedWeight());
         auto t_blue = static_cast<double>(grid.totalBlueWeight());
 
-        Subgrid max = Subgrid(-1, -1, -1, -1, -std::numeric_limits<double>::infinity());
-        for (size_t i = 0; i < grid.size() - 1; i++) {
-            red_count.assign(grid.size(), 0);
-            blue_count.assign(grid.size(), 0);
-            for (size_t j = i; j < grid.size(); j++) {
+        // The padding lets the lanes of the last block read past the final column.
+        scratch.red_count.assign(r + SUBGRID_LANES, 0);
+        scratch.blue_count.assign(r + SUBGRID_LANES, 0);
+        scratch.red_sums.resize(r * SUBGRID_LANES);
+        scratch.blue_sums.resize(r * SUBGRID_LANES);
+        scratch.values.resize(r * SUBGRID_LANES);
+        double* red_sums = scratch.red_sums.data();
+        double* blue_sums = scratch.blue_sums.data();
+        double* values = scratch.values.data();
+
+        for (size_t j = i; j < r; j++) {
+            for (size_t k = 0; k < r; k++) {
+                scratch.blue_count[k] += grid.blueCount(j, k);
+                scratch.red_count[k] += grid.redCount(j, k);
+            }
 
-                for (size_t k = 0; k < grid.size(); k++) {
-                    blue_count[k] += grid.blueCount(j, k);
-                    red_count[k] += grid.redCount(j, k);
+            for (size_t k0 = 0; k0 < r; k0 += SUBGRID_LANES) {
+                const double* red_col = scratch.red_count.data() + k0;
+                const double* blue_col = scratch.blue_count.data() + k0;
+                size_t steps = r - k0;
+#if defined(PYSCAN_SIMD)
+                auto red_acc = Simd::set1(0.0);
+                auto blue_acc = Simd::set1(0.0);
+                for (size_t d = 0; d < steps; d++) {
+                    red_acc = Simd::add(red_acc, Simd::load(red_col + d));
+                    blue_acc = Simd::add(blue_acc, Simd::load(blue_col + d));
+                    Simd::store(red_sums + d * SUBGRID_LANES, red_acc);
+                    Simd::store(blue_sums + d * SUBGRID_LANES, blue_acc);
+                }
+#else
+                double red_acc[SUBGRID_LANES] = {};
+                double blue_acc[SUBGRID_LANES] = {};
+                for (size_t d = 0; d < steps; d++) {
+                    for (size_t t = 0; t < SUBGRID_LANES; t++) {
+                        red_acc[t] += red_col[d + t];
+                        blue_acc[t] += blue_col[d + t];
+                        red_sums[d * SUBGRID_LANES + t] = red_acc[t];
+                        blue_sums[d * SUBGRID_LANES + t] = blue_acc[t];
+                    }
+                }
+#endif
+                evaluate_batch(func, red_sums, blue_sums, steps * SUBGRID_LANES, t_red, t_blue, values);
+                // Lane t has run past the last column once d + t >= steps.
+                for (size_t d = steps > SUBGRID_LANES ? steps - SUBGRID_LANES : 0; d < steps; d++) {
+                    for (size_t t = steps - d; t < SUBGRID_LANES; t++) {
+                        values[d * SUBGRID_LANES + t] = -std::numeric_limits<double>::infinity();
+                    }
                 }
 
-                for (size_t k = 0; k < grid.size(); k++) {
-                    double red_l_count = 0;
-                    double blue_l_count = 0;
-                    for (size_t l = k; l < grid.size(); l++) {
-                        red_l_count += red_count[l];
-                        blue_l_count += blue_count[l];
-                        double maxf = func(red_l_count,  t_red, blue_l_count, t_blue);
+                // Most blocks hold nothing above the current maximum, so they are ruled out before the ordered scan.
+#if defined(PYSCAN_SIMD)
+                auto curr = Simd::set1(max.fValue());
+                auto above = Simd::m_none();
+                for (size_t d = 0; d < steps; d++) {
+                    above = Simd::m_or(above, Simd::gt(Simd::load(values + d * SUBGRID_LANES), curr));
+                }
+                if (Simd::bits(above) == 0) {
+                    continue;
+                }
+#else
+                bool above = false;
+                for (size_t n = 0; n < steps * SUBGRID_LANES; n++) {
+                    above |= values[n] > max.fValue();
+                }
+                if (!above) {
+                    continue;
+                }
+#endif
+                for (size_t t = 0; t < SUBGRID_LANES && t < steps; t++) {
+                    for (size_t d = 0; d + t < steps; d++) {
+                        double maxf = values[d * SUBGRID_LANES + t];
                         if (maxf > max.fValue()) {
-                            max = Subgrid(l, j, k, i, maxf);
+                            max = Subgrid(k0 + t + d, j, k0 + t, i, maxf);
                         }
                     }
-
                 }
             }
         }
+    }
+
+    /*
+     * Simple 1/eps^4 algorithm described in the paper that just computes every subgrid.
+     * This will work on a nonlinear function.
+     */
+    template <typename Stat>
+    static Subgrid max_subgrid_internal(Grid const &grid, const Stat &func, size_t threads) {
+        Subgrid max = Subgrid(-1, -1, -1, -1, -std::numeric_limits<double>::infinity());
+        if (grid.size() < 2) {
+            return max;
+        }
+        // Every lowest row is an independent band. Reducing the band maxima in row order keeps the first maximum.
+        size_t bands = grid.size() - 1;
+        size_t workers = std::min(resolve_thread_count(threads), bands);
+        std::vector<SubgridScratch> scratches(workers);
+        std::vector<Subgrid> band_max(bands, max);
+        parallel_for(bands, workers, [&](size_t i, size_t worker) {
+            max_subgrid_band(grid, i, func, scratches[worker], band_max[i]);
+        });
+        for (auto const& sg : band_max) {
+            if (sg.fValue() > max.fValue()) {
+                max = sg;
+            }
+        }
         return max;
     }
 
+    Subgrid max_subgrid(Grid const &grid, const discrepancy_func_t &func, size_t threads) {
+        return dispatch_statistic(func, [&](auto const& stat) {
+            return max_subgrid_internal(grid, stat, threads);
+        });
+    }
+
 
     Subgrid max_subgrid_linear(Grid const &grid, double a, double b) {
         std::vector<double> weight(grid.size(), 0);
@@ -309,26 +417,85 @@ namespace pyscan {
         return max;
     }
 
-    Subgrid max_subgrid_convex(Grid const &grid, double eps, discrepancy_func_t const &f) {
+    std::vector<Subgrid> max_subgrid_linear(Grid const &grid, std::vector<std::tuple<double, double>> const& coeffs) {
+        /*
+         * Runs max_subgrid_linear for every (a, b) pair in one pass over the grid. The weights of a row are read
+         * once and folded into one weight vector per pair, which is updated in the same order as the single pair
+         * scan so each pair gets exactly the subgrid max_subgrid_linear(grid, a, b) returns.
+         */
+        size_t r = grid.size();
+        std::vector<Subgrid> maxes(coeffs.size(), Subgrid(0, 0, 0, 0, -std::numeric_limits<double>::infinity()));
+        std::vector<double> red_row(r, 0);
+        std::vector<double> blue_row(r, 0);
+        std::vector<double> weights(coeffs.size() * r, 0);
+        for (size_t i = 0; i < r; i++) {
+            weights.assign(coeffs.size() * r, 0);
+            for (size_t j = i; j < r; j++) {
+                for (size_t k = 0; k < r; k++) {
+                    red_row[k] = grid.redWeight(j, k);
+                    blue_row[k] = grid.blueWeight(j, k);
+                }
+                for (size_t c = 0; c < coeffs.size(); c++) {
+                    auto [a, b] = coeffs[c];
+                    double* weight = weights.data() + c * r;
+                    for (size_t k = 0; k < r; k++) {
+                        weight[k] += b * blue_row[k];
+                        weight[k] += a * red_row[k];
+                    }
+                    double curr_W = 0;
+                    size_t start_ix = 0;
+                    for (size_t l = 0; l < r; l++) {
+                        curr_W += weight[l];
+                        if (curr_W <= 0) {
+                            curr_W = 0;
+                            start_ix = l + 1;
+                        }
+                        if (curr_W > maxes[c].fValue()) {
+                            maxes[c] = Subgrid(l, j, start_ix, i, curr_W);
+                        }
+                    }
+                }
+            }
+        }
+        return maxes;
+    }
+
+    Subgrid max_subgrid_convex(Grid const &grid, double eps, discrepancy_func_t const &f, size_t threads) {
         /*
-         * This uses the
+         * This uses the approximate hull of the (red, blue) weights of the subgrids. Each level of the hull hands
+         * over all of its directions at once and they are split into one multi direction linear scan per thread.
          */
         auto phi = [&] (Vec2 const& v) {return f(v[0], 1.0,  v[1], 1.0); };
-        Subgrid curr_subgrid(0, 0, 0, 0, -std::numeric_limits<double>::infinity());
         Subgrid max_subgrid(0, 0, 0, 0, -std::numeric_limits<double>::infinity());
         double maxV = 0;
-        auto linemaxF = [&] (Vec2 const& dir) {
-            curr_subgrid = max_subgrid_linear(grid, dir[0], dir[1]);
-            Vec2 curr_mb{grid.redSubWeight(curr_subgrid), grid.blueSubWeight(curr_subgrid)};
-
-            double curr_val = phi(curr_mb);
-            if (curr_val > maxV) {
-                max_subgrid = curr_subgrid;
-                maxV = curr_val;
+        auto linemaxBatch = [&] (std::vector<Vec2> const& dirs) {
+            std::vector<Subgrid> subgrids(dirs.size(), max_subgrid);
+            size_t workers = std::min(resolve_thread_count(threads), dirs.size());
+            parallel_for(workers, workers, [&](size_t w, size_t) {
+                size_t begin = dirs.size() * w / workers;
+                size_t end = dirs.size() * (w + 1) / workers;
+                std::vector<std::tuple<double, double>> coeffs;
+                for (size_t d = begin; d < end; d++) {
+                    coeffs.emplace_back(dirs[d][0], dirs[d][1]);
+                }
+                auto part = max_subgrid_linear(grid, coeffs);
+                std::copy(part.begin(), part.end(), subgrids.begin() + begin);
+            });
+
+            // The best subgrid is picked in direction order so the result does not depend on the threads.
+            std::vector<Vec2> line_maxes;
+            for (auto const& curr_subgrid : subgrids) {
+                Vec2 curr_mb{grid.redSubWeight(curr_subgrid), grid.blueSubWeight(curr_subgrid)};
+                double curr_val = phi(curr_mb);
+                if (curr_val > maxV) {
+                    max_subgrid = curr_subgrid;
+                    maxV = curr_val;
+                }
+                line_maxes.push_back(curr_mb);
             }
-            return curr_mb;
+            return line_maxes;
         };
-        approximateHull(eps, phi, linemaxF);
+        approximateHullBatch(eps, phi, linemaxBatch);
         return max_subgrid;
     }
 
@@ -355,35 +522,114 @@ namespace pyscan {
 
 
 
-    class LabeledGrid {
+    /*
+     * A set of labels in 0..label_count - 1 stored as one stamp per label. A label is in the set exactly when its
+     * stamp equals the current generation, so clearing the set is a counter increment.
+     */
+    class LabelSet {
+    public:
+        void resize(size_t label_count) {
+            if (stamps.size() < label_count) {
+                stamps.resize(label_count, 0);
+            }
+        }
+
+        void clear() {
+            ++generation;
+        }
+
+        //Returns true if the label was not in the set yet.
+        bool insert(size_t label) {
+            if (stamps[label] == generation) {
+                return false;
+            }
+            stamps[label] = generation;
+            return true;
+        }
+
+    private:
+        std::vector<size_t> stamps;
+        size_t generation = 1;
+    };
 
-        struct LabelW {
-            size_t label;
-            double weight;
+    struct LabelW {
+        size_t label;
+        double weight;
 
-            LabelW(size_t l, double w) : label(l), weight(w) {}
-            LabelW(): label(0), weight(0) {}
+        LabelW(size_t l, double w) : label(l), weight(w) {}
+        LabelW(): label(0), weight(0) {}
 
 
-            friend std::ostream& operator<<(std::ostream& os, const LabelW& el) {
-                os << "(" << el.label << ", " << el.weight << ")";
-                return os;
+        friend std::ostream& operator<<(std::ostream& os, const LabelW& el) {
+            os << "(" << el.label << ", " << el.weight << ")";
+            return os;
+        }
+    };
+
+    /*
+     * Buffers reused by every call of max_rect_labeled_internal, so the scan itself does not allocate once they
+     * have grown to size.
+     */
+    struct LabeledScratch {
+        LabelSet m_seen;
+        LabelSet b_seen;
+        LabelSet column_labels;
+        std::vector<size_t> column_pos;
+
+        //One run per column, long enough for every point in the column.
+        std::vector<size_t> column_offsets;
+        std::vector<size_t> m_column_size;
+        std::vector<size_t> b_column_size;
+        std::vector<LabelW> m_columns;
+        std::vector<LabelW> b_columns;
+
+        explicit LabeledScratch(size_t label_count) : column_pos(label_count, 0) {
+            m_seen.resize(label_count);
+            b_seen.resize(label_count);
+            column_labels.resize(label_count);
+        }
+    };
+
+    /*
+     * Renames the labels of both sets to 0..L-1, in order of first appearance, and returns L.
+     */
+    static size_t compact_labels(lpoint_list_t& m_points, lpoint_list_t& b_points) {
+        std::unordered_map<size_t, size_t> ids;
+        for (auto* pts : {&m_points, &b_points}) {
+            for (auto& pt : *pts) {
+                auto it = ids.emplace(pt.get_label(), ids.size()).first;
+                pt.set_label(it->second);
             }
-        };
+        }
+        return ids.size();
+    }
 
+    class LabeledGrid {
 
         using part_list_t = std::vector<double>;
-        using grid_cell_t = std::vector<LabelW>;
-        using grid_t = std::vector<grid_cell_t>;
 
         part_list_t x_values;
         part_list_t y_values;
-        grid_t m_labels;
-        grid_t b_labels;
+
+        //The cells are stored row by row as runs of one flat buffer.
+        std::vector<size_t> m_offsets;
+        std::vector<size_t> b_offsets;
+        std::vector<LabelW> m_labels;
+        std::vector<LabelW> b_labels;
 
     public:
 
-        LabeledGrid(size_t r, lpoint_list_t m_points, lpoint_list_t b_points) {
+        struct cell_t {
+            const LabelW* first;
+            const LabelW* last;
+
+            const LabelW* begin() const { return first; }
+            const LabelW* end() const { return last; }
+            bool empty() const { return first == last; }
+        };
+
+        //The labels have to be compacted to 0..L-1 and seen has to be sized for them. The points are sorted in place.
+        LabeledGrid(size_t r, lpoint_list_t& m_points, lpoint_list_t& b_points, LabelSet& seen) {
             double m_total = computeTotal(m_points);
             double b_total = computeTotal(b_points);
 
@@ -399,16 +645,15 @@ namespace pyscan {
 
                 double curr_weight = 0;
                 part_list_t partitions;
-                std::unordered_set<size_t> active_label_set;
+                seen.clear();
                 for (auto& p : labeled_points) {
-                    if (active_label_set.find(p.get_label()) == active_label_set.end()) {
+                    if (seen.insert(p.get_label())) {
                         curr_weight += p.get_weight();
-                        active_label_set.emplace(p.get_label());
                     }
                     if (curr_weight > max_weight) {
                         partitions.emplace_back(p(dim));
                         curr_weight = 0;
-                        active_label_set.clear();
+                        seen.clear();
                     }
                 }
                 return partitions;
@@ -426,10 +671,10 @@ namespace pyscan {
             update_parts(x_values, 0);
             update_parts(y_values, 1);
 
-            m_labels.resize((x_values.size() - 1) * (y_values.size() - 1));
-            b_labels.resize((x_values.size() - 1) * (y_values.size() - 1));
-
-            auto grid_insert = [&] (grid_t &cells, lpoint_list_t const& lbl_pts) {
+            auto grid_insert = [&] (std::vector<size_t>& offsets, std::vector<LabelW>& cells, lpoint_list_t const& lbl_pts) {
+                std::vector<size_t> cell_ix;
+                cell_ix.reserve(lbl_pts.size());
+                offsets.assign(x_size() * y_size() + 1, 0);
                 for (auto &pt : lbl_pts) {
                     long ix = std::upper_bound(x_values.begin(), x_values.end(), pt(0)) - x_values.begin() - 1;
                     long iy = std::upper_bound(y_values.begin(), y_values.end(), pt(1)) - y_values.begin() - 1;
@@ -438,20 +683,40 @@ namespace pyscan {
                         ix = ix - 1;
                         iy = iy - 1;
                     }
-                    cells[iy * (x_values.size() - 1) + ix].emplace_back(pt.get_label(), pt.get_weight());
+                    cell_ix.emplace_back(iy * x_size() + ix);
+                    offsets[cell_ix.back() + 1]++;
                 }
+                std::partial_sum(offsets.begin(), offsets.end(), offsets.begin());
 
+                //Points keep their order within a cell.
+                std::vector<size_t> cursor(offsets.begin(), offsets.end() - 1);
+                cells.resize(lbl_pts.size());
+                for (size_t i = 0; i < lbl_pts.size(); i++) {
+                    cells[cursor[cell_ix[i]]++] = LabelW(lbl_pts[i].get_label(), lbl_pts[i].get_weight());
+                }
             };
-            grid_insert(m_labels, m_points);
-            grid_insert(b_labels, b_points);
+            grid_insert(m_offsets, m_labels, m_points);
+            grid_insert(b_offsets, b_labels, b_points);
         }
 
-        grid_cell_t const& get_m(size_t ix, size_t iy) const {
-            return m_labels[iy * (x_values.size() - 1) + ix];
+        cell_t get_m(size_t ix, size_t iy) const {
+            size_t cell = iy * x_size() + ix;
+            return {m_labels.data() + m_offsets[cell], m_labels.data() + m_offsets[cell + 1]};
         }
 
-        grid_cell_t const& get_b(size_t ix, size_t iy) const {
-            return b_labels[iy * (x_values.size() - 1) + ix];
+        cell_t get_b(size_t ix, size_t iy) const {
+            size_t cell = iy * x_size() + ix;
+            return {b_labels.data() + b_offsets[cell], b_labels.data() + b_offsets[cell + 1]};
+        }
+
+        //Number of red and blue points in column ix.
+        size_t column_count(size_t ix) const {
+            size_t count = 0;
+            for (size_t iy = 0; iy < y_size(); iy++) {
+                size_t cell = iy * x_size() + ix;
+                count += m_offsets[cell + 1] - m_offsets[cell] + b_offsets[cell + 1] - b_offsets[cell];
+            }
+            return count;
         }
 
         double x_val(size_t ix) const {
@@ -471,56 +736,94 @@ namespace pyscan {
         }
     };
 
-    std::tuple<Rectangle, double> max_rect_labeled(size_t r, double max_w,
-                                                   lpoint_list_t const& m_points,
-                                                   lpoint_list_t const& b_points,
+    /*
+     * Adds the points of one cell to a column. A column keeps each label once, in order of first appearance, with
+     * the weight of the last point that carried it.
+     */
+    static void add_to_column(LabelW* column, size_t& size, LabeledGrid::cell_t const& cell, LabeledScratch& scratch) {
+        if (cell.empty()) {
+            return;
+        }
+        scratch.column_labels.clear();
+        for (size_t k = 0; k < size; k++) {
+            scratch.column_labels.insert(column[k].label);
+            scratch.column_pos[column[k].label] = k;
+        }
+        for (auto& lw : cell) {
+            if (scratch.column_labels.insert(lw.label)) {
+                scratch.column_pos[lw.label] = size;
+                column[size++] = lw;
+            } else {
+                column[scratch.column_pos[lw.label]].weight = lw.weight;
+            }
+        }
+    }
+
+    /*
+     * The labels of m_points and b_points have to be compacted to 0..L-1, and scratch has to be built for L labels.
+     * Both point sets are reordered.
+     */
+    template <typename Stat>
+    static std::tuple<Rectangle, double> max_rect_labeled_internal(size_t r, double max_w,
+                                                   lpoint_list_t& m_points,
+                                                   lpoint_list_t& b_points,
                                                    double m_Total,
                                                    double b_Total,
-                                                   const discrepancy_func_t& func) {
+                                                   const Stat& func,
+                                                   LabeledScratch& scratch) {
 
-        LabeledGrid grid(r, m_points, b_points);
+        LabeledGrid grid(r, m_points, b_points, scratch.m_seen);
 
         Rectangle maxRect(0.0, 0.0, 0.0, 0.0);
         double max_stat = 0;
 
+        auto& offsets = scratch.column_offsets;
+        offsets.resize(grid.x_size() + 1);
+        offsets[0] = 0;
+        for (size_t i = 0; i < grid.x_size(); i++) {
+            offsets[i + 1] = offsets[i] + grid.column_count(i);
+        }
+        scratch.m_columns.resize(offsets.back());
+        scratch.b_columns.resize(offsets.back());
+        scratch.m_column_size.resize(grid.x_size());
+        scratch.b_column_size.resize(grid.x_size());
+
         for (size_t lower_j = 0; lower_j < grid.y_size(); lower_j++) {
-            std::vector<std::unordered_map<size_t, double>> m_columns(grid.x_size(), std::unordered_map<size_t, double>());
-            std::vector<std::unordered_map<size_t, double>> b_columns(grid.x_size(), std::unordered_map<size_t, double>());
+            std::fill(scratch.m_column_size.begin(), scratch.m_column_size.end(), 0);
+            std::fill(scratch.b_column_size.begin(), scratch.b_column_size.end(), 0);
             for (size_t upper_j = lower_j; upper_j < grid.y_size() &&
                                            std::abs(grid.y_val(upper_j + 1) - grid.y_val(lower_j)) < max_w; upper_j++) {
                 for (size_t left_i = 0; left_i < grid.x_size(); left_i++) {
-
-                    for (auto& lw : grid.get_m(left_i, upper_j)) {
-                        m_columns[left_i][lw.label] = lw.weight;
-                    }
-                    for (auto& lw : grid.get_b(left_i, upper_j)) {
-                        b_columns[left_i][lw.label] = lw.weight;
-                    }
+                    add_to_column(scratch.m_columns.data() + offsets[left_i], scratch.m_column_size[left_i],
+                                  grid.get_m(left_i, upper_j), scratch);
+                    add_to_column(scratch.b_columns.data() + offsets[left_i], scratch.b_column_size[left_i],
+                                  grid.get_b(left_i, upper_j), scratch);
                 }
 
                 for (size_t left_i = 0; left_i < grid.x_size(); left_i++) {
                     //make sweep
-                    std::unordered_set<size_t> curr_m_labels;
-                    std::unordered_set<size_t> curr_b_labels;
+                    scratch.m_seen.clear();
+                    scratch.b_seen.clear();
                     double m_weight = 0;
                     double b_weight = 0;
                     for (size_t right_i = left_i; right_i < grid.x_size() &&
                                                   std::abs(grid.x_val(right_i + 1) - grid.x_val(left_i)) < max_w; right_i++) {
-                        for (auto& label : m_columns[right_i]) {
-                            if (curr_m_labels.find(label.first) == curr_m_labels.end()) {
-                                m_weight += label.second;
-                                curr_m_labels.emplace(label.first);
+                        const LabelW* m_column = scratch.m_columns.data() + offsets[right_i];
+                        for (size_t k = 0; k < scratch.m_column_size[right_i]; k++) {
+                            if (scratch.m_seen.insert(m_column[k].label)) {
+                                m_weight += m_column[k].weight;
                             }
                         }
-                        for (auto& label : b_columns[right_i]) {
-                            if (curr_b_labels.find(label.first) == curr_b_labels.end()) {
-                                b_weight += label.second;
-                                curr_b_labels.emplace(label.first);
+                        const LabelW* b_column = scratch.b_columns.data() + offsets[right_i];
+                        for (size_t k = 0; k < scratch.b_column_size[right_i]; k++) {
+                            if (scratch.b_seen.insert(b_column[k].label)) {
+                                b_weight += b_column[k].weight;
                             }
                         }
 
-                        if (func(m_weight, m_Total, b_weight, b_Total) > max_stat) {
-                            max_stat = func(m_weight, m_Total, b_weight, b_Total);
+                        double new_stat = func(m_weight, m_Total, b_weight, b_Total);
+                        if (new_stat > max_stat) {
+                            max_stat = new_stat;
                             maxRect = Rectangle(grid.x_val(right_i + 1), grid.y_val(upper_j + 1), grid.x_val(left_i), grid.y_val(lower_j));
                         }
                     }
@@ -538,18 +841,25 @@ namespace pyscan {
 
         double m_Total = computeTotal(m_points);
         double b_Total = computeTotal(b_points);
-        return max_rect_labeled(r, max_w, m_points, b_points, m_Total, b_Total, func);
+        lpoint_list_t m_compact(m_points);
+        lpoint_list_t b_compact(b_points);
+        LabeledScratch scratch(compact_labels(m_compact, b_compact));
+        return dispatch_statistic(func, [&](auto const& stat) {
+            return max_rect_labeled_internal(r, max_w, m_compact, b_compact, m_Total, b_Total, stat, scratch);
+        });
     }
 
 
-    std::tuple<Rectangle, double> max_rect_labeled_scale(
+    template <typename Stat>
+    static std::tuple<Rectangle, double> max_rect_labeled_scale_internal(
             size_t r,
             double max_r,
             double alpha,
             const point_list_t &net,
             const lpoint_list_t &red,
             const lpoint_list_t &blue,
-            const discrepancy_func_t &f) {
+            const Stat &f,
+            size_t threads) {
 
         Rectangle max_rect;
         double max_stat = 0.0;
@@ -561,20 +871,32 @@ namespace pyscan {
 
         double red_tot = computeTotal(red);
         double blue_tot = computeTotal(blue);
+        //The labels are compacted once and every worker reuses its chunk buffers and scratch space across cells.
+        lpoint_list_t red_compact(red);
+        lpoint_list_t blue_compact(blue);
+        size_t label_count = compact_labels(red_compact, blue_compact);
         SparseGrid<pt2_t> grid_net(bb, net, alpha);
-        SparseGrid<lpt2_t> grid_red(bb, red, alpha), grid_blue(bb, blue, alpha);
+        SparseGrid<lpt2_t> grid_red(bb, red_compact, alpha), grid_blue(bb, blue_compact, alpha);
         auto grid_r = grid_net.get_grid_size();
         size_t sub_grid_size = lround(ceil(alpha / max_r));
 
-        for (auto center_cell = grid_net.begin(); center_cell != grid_net.end();) {
-            std::vector<lpt2_t> net_chunk;
-            std::vector<lpt2_t> red_chunk;
-            std::vector<lpt2_t> blue_chunk;
-            net_chunk.clear();
+        auto &cells = grid_net.cells();
+        std::vector<std::tuple<Rectangle, double>> cell_max(cells.size(), std::make_tuple(Rectangle(), 0.0));
+        size_t workers = std::max<size_t>(std::min(resolve_thread_count(threads), cells.size()), 1);
+        std::vector<lpoint_list_t> red_chunks(workers), blue_chunks(workers);
+        std::vector<LabeledScratch> scratches;
+        scratches.reserve(workers);
+        for (size_t w = 0; w < workers; w++) {
+            scratches.emplace_back(label_count);
+        }
+
+        parallel_for(cells.size(), workers, [&](size_t c, size_t worker) {
+            auto &red_chunk = red_chunks[worker];
+            auto &blue_chunk = blue_chunks[worker];
             red_chunk.clear();
             blue_chunk.clear();
             size_t i, j;
-            std::tie(i, j) = grid_net.get_cell(center_cell->second);
+            std::tie(i, j) = grid_net.get_cell(cells[c]);
 
             size_t end_k = i + sub_grid_size < grid_r ? i + sub_grid_size : grid_r;
             size_t end_l = j + sub_grid_size < grid_r ? j + sub_grid_size : grid_r;
@@ -591,20 +913,34 @@ namespace pyscan {
                         blue_chunk.emplace_back(it->second);
                 }
             }
-            auto [new_rect, local_max_stat] = max_rect_labeled(r, max_r, red_chunk, blue_chunk, red_tot, blue_tot, f);
+            cell_max[c] = max_rect_labeled_internal(r, max_r, red_chunk, blue_chunk, red_tot, blue_tot, f,
+                                                    scratches[worker]);
+        });
+
+        //Reducing in cell order keeps the first maximal cell, whatever the thread count.
+        for (auto &[new_rect, local_max_stat] : cell_max) {
             if (local_max_stat > max_stat) {
                 max_rect = new_rect;
                 max_stat = local_max_stat;
             }
-
-            auto last = center_cell->first;
-            do {
-                ++center_cell;
-            } while (center_cell != grid_net.end() && center_cell->first == last);
         }
         return std::make_tuple(max_rect, max_stat);
     }
 
+    std::tuple<Rectangle, double> max_rect_labeled_scale(
+            size_t r,
+            double max_r,
+            double alpha,
+            const point_list_t &net,
+            const lpoint_list_t &red,
+            const lpoint_list_t &blue,
+            const discrepancy_func_t &f,
+            size_t threads) {
+        return dispatch_statistic(f, [&](auto const& stat) {
+            return max_rect_labeled_scale_internal(r, max_r, alpha, net, red, blue, stat, threads);
+        });
+    }
+
 
     //////////////////////////////////////////////////////////////////////////////////
     //Max Rectangle Code//////////////////////////////////////////////////
@@ -660,13 +996,12 @@ namespace pyscan {
 
 
 
-     epoint_list_t even_compress_internal(epoint_it_t b, epoint_it_t e, double m_w) {
+    void even_compress_internal(epoint_list_t::const_iterator b, epoint_list_t::const_iterator e, double m_w, epoint_list_t& break_pts) {
         /*
          * Takes a vector of weighted points and constructed a smaller set of weighted points equally spaced with
-         * the a different set of weights.
+         * the a different set of weights. The points are appended to break_pts.
          */
         double curr_w = 0;
-        std::vector<ept_t> break_pts;
         for (; b != e; ++b) {
             if ((curr_w + b->get_weight()) > m_w) {
                 break_pts.emplace_back(b->get_x(), b->get_y(), curr_w + b->get_weight());
@@ -675,18 +1010,16 @@ namespace pyscan {
                 curr_w += b->get_weight();
             }
         }
-        return break_pts;
     }
 
 
     template <typename UURG>
-    epoint_list_t block_compress_internal(epoint_it_t b, epoint_it_t e, double m_w, UURG&& gen) {
+    void block_compress_internal(epoint_list_t::const_iterator b, epoint_list_t::const_iterator e, double m_w, UURG&& gen, epoint_list_t& break_pts) {
         /*
          * Takes a vector of weighted points and constructed a smaller set of weighted points equally spaced with
-         * the a different set of weights.
+         * the a different set of weights. The points are appended to break_pts.
          */
         double curr_w = 0;
-        std::vector<ept_t> break_pts;
         auto last_b = b;
         for (; b != e; ++b) {
             if ((curr_w + b->get_weight()) > m_w) {
@@ -698,7 +1031,6 @@ namespace pyscan {
                 curr_w += b->get_weight();
             }
         }
-        return break_pts;
     }
 
 //    epoint_list_t cascade_compress_internal(
@@ -733,18 +1065,6 @@ namespace pyscan {
     };
 
 
-    Slab::Slab(std::weak_ptr<Slab> p,
-            epoint_list_t m_m,
-            epoint_list_t b_m,
-            size_t ty,
-            size_t by) :
-                m_merges(std::move(m_m)),
-                b_merges(std::move(b_m)),
-                top_y(ty),
-                bottom_y(by),
-                parent(std::move(p)) {}
-
-
     double Slab::measure_interval(size_t mxx, size_t mnx, double a, double b) const {
         /*
          * Measures the interval [mnx, mxx) associated with a single slab.
@@ -762,7 +1082,10 @@ namespace pyscan {
     }
 
     SlabTree::SlabTree(epoint_list_t mpts, epoint_list_t bpts, double max_w) :
-        total_m(computeTotal(mpts)), total_b(computeTotal(bpts)) {
+        SlabTree(std::move(mpts), std::move(bpts), max_w, 0) {}
+
+    SlabTree::SlabTree(epoint_list_t mpts, epoint_list_t bpts, double max_w, double even_w) :
+        root(nullptr), total_m(computeTotal(mpts)), total_b(computeTotal(bpts)) {
         /*
          * Create a vertical decomposition of the point set so that we can split the points into a sequence of horizontal
          * strips where each contains at most max_w.
@@ -772,15 +1095,15 @@ namespace pyscan {
         };
         std::sort(mpts.begin(), mpts.end(), y_order);
         std::sort(bpts.begin(), bpts.end(), y_order);
-        std::vector<ept_t> merge_buffer;
-        merge_buffer.reserve(mpts.size() + bpts.size());
-        std::merge(mpts.begin(), mpts.end(), bpts.begin(), bpts.end(), std::back_inserter(merge_buffer), y_order);
 
         std::vector<size_t> vert_decomp;
         vert_decomp.reserve((size_t) (1 / max_w));
         vert_decomp.emplace_back(0);
         double curr_weight = 0;
-        for (auto &p : merge_buffer) {
+        //Walks both lists in merged y order without materializing the merge.
+        auto m_it = mpts.begin(), b_it = bpts.begin();
+        while (m_it != mpts.end() || b_it != bpts.end()) {
+            auto& p = (b_it == bpts.end() || (m_it != mpts.end() && !y_order(*b_it, *m_it))) ? *m_it++ : *b_it++;
             curr_weight += p.get_weight();
             if (curr_weight >= max_w * (total_m + total_b)) {
                 curr_weight = 0;
@@ -795,11 +1118,11 @@ namespace pyscan {
             vert_decomp.emplace_back(mmx_it->get_y() + 1);
         }
 
-        SlabTree::init(mpts, bpts, vert_decomp);
+        SlabTree::init(std::move(mpts), std::move(bpts), vert_decomp, even_w);
     }
 
     SlabTree::SlabTree(std::vector<size_t> vert_decomp, epoint_list_t mpts, epoint_list_t bpts) :
-        total_m(computeTotal(mpts)), total_b(computeTotal(bpts)) {
+        root(nullptr), total_m(computeTotal(mpts)), total_b(computeTotal(bpts)) {
         /*
          * Create a vertical decomposition of the point set so that we can split the points into a sequence of horizontal
          * strips where each contains at most max_w.
@@ -819,7 +1142,7 @@ namespace pyscan {
         SlabTree::init(std::move(mpts), std::move(bpts), vert_decomp);
     }
 
-    void SlabTree::init(epoint_list_t mpts, epoint_list_t bpts, std::vector<size_t> const& vert_decomp) {
+    void SlabTree::init(epoint_list_t mpts, epoint_list_t bpts, std::vector<size_t> const& vert_decomp, double even_w) {
 
         //std::sort(vert_decomp.begin(), vert_decomp.end());
 
@@ -836,13 +1159,38 @@ namespace pyscan {
         std::sort(mpts.begin(), mpts.end());
         std::sort(bpts.begin(), bpts.end());
 
+        arena = std::make_shared<SlabArena>();
+        // A tree over k strips has 2k - 1 slabs. Reserving them up front keeps the pointers between slabs valid.
+        arena->slabs.reserve(2 * vert_decomp.size());
+        // A point is stored once in every slab on the path from the root to the leaf strip holding it, so the
+        // merge buffers are reserved at exactly that size.
+        auto path_length = [&vert_decomp](ept_t const& pt) {
+            size_t first = 0, last = vert_decomp.size(), length = 1;
+            while (last - first > 2) {
+                size_t mid = first + (last - first) / 2;
+                if (pt(1) < vert_decomp[mid]) {
+                    last = mid + 1;
+                } else {
+                    first = mid;
+                }
+                length++;
+            }
+            return length;
+        };
+        if (even_w <= 0) {
+            size_t m_size = 0, b_size = 0;
+            for (auto const& pt : mpts) m_size += path_length(pt);
+            for (auto const& pt : bpts) b_size += path_length(pt);
+            arena->m_points.reserve(m_size);
+            arena->b_points.reserve(b_size);
+        }
+
         cell_list_t active;
         active.emplace_back(nullptr, &root,
                             std::make_tuple(vert_decomp.cbegin(), vert_decomp.cend()),
                             std::make_tuple(mpts.begin(), mpts.end()),
                             std::make_tuple(bpts.begin(), bpts.end()));
 
-        std::queue<slab_ptr> roots;
         while (!active.empty()) {
             auto[parent, el_ptr, vrng, mrng, brng] = active.back();
 
@@ -852,14 +1200,22 @@ namespace pyscan {
             auto[m_b, m_e] = mrng;
             auto[b_b, b_e] = brng;
 
-
-            //Compress the current m_pts and b_pts and compute the weights.
-            //Need the
-            auto m_merges = epoint_list_t(m_b, m_e);
-            auto b_merges = epoint_list_t(b_b, b_e);
-
             //Compute the slab now.
-            *el_ptr = std::shared_ptr<Slab>(new Slab(parent, m_merges, b_merges, *(v_e - 1), *v_b));
+            arena->slabs.emplace_back(parent, *(v_e - 1), *v_b);
+            slab_ptr slab = &arena->slabs.back();
+            *el_ptr = slab;
+
+            size_t m_first = arena->m_points.size();
+            size_t b_first = arena->b_points.size();
+            if (even_w > 0) {
+                even_compress_internal(m_b, m_e, even_w * total_m, arena->m_points);
+                even_compress_internal(b_b, b_e, even_w * total_b, arena->b_points);
+            } else {
+                arena->m_points.insert(arena->m_points.end(), m_b, m_e);
+                arena->b_points.insert(arena->b_points.end(), b_b, b_e);
+            }
+            slab->m_merges = SlabRun<ept_t>(&arena->m_points, m_first, arena->m_points.size());
+            slab->b_merges = SlabRun<ept_t>(&arena->b_points, b_first, arena->b_points.size());
 
             //Now emplace back to the active
             if ((v_e - v_b) > 2) {
@@ -873,13 +1229,13 @@ namespace pyscan {
                 };
                 auto m_iter_splt = std::stable_partition(m_b, m_e, part_f);
                 auto b_iter_splt = std::stable_partition(b_b, b_e, part_f);
-                active.emplace_back(*el_ptr,
-                                    &((*el_ptr)->down),
+                active.emplace_back(slab,
+                                    &(slab->down),
                                     std::make_tuple(v_b, v_mid + 1),
                                     std::make_tuple(m_b, m_iter_splt),
                                     std::make_tuple(b_b, b_iter_splt));
-                active.emplace_back(*el_ptr,
-                                    &((*el_ptr)->up),
+                active.emplace_back(slab,
+                                    &(slab->up),
                                     std::make_tuple(v_mid, v_e),
                                     std::make_tuple(m_iter_splt, m_e),
                                     std::make_tuple(b_iter_splt, b_e));
@@ -908,103 +1264,202 @@ namespace pyscan {
         return leaves;
     }
 
-    void SlabTree::reset_splits() {
-        std::vector<decltype(root)> curr_stack;
-        curr_stack.push_back(root);
-        while (!curr_stack.empty()) {
-            auto el = curr_stack.back();
-            curr_stack.pop_back();
-            if (el != nullptr) {
-                el->global_split_offset = std::vector<size_t>();
-                curr_stack.push_back(el->down);
-                curr_stack.push_back(el->up);
+    std::vector<slab_ptr> SlabTree::get_slabs() const {
+        /*
+         * Every slab of this tree in breadth first order, so each slab comes before its children.
+         */
+        std::vector<slab_ptr> slabs;
+        if (root == nullptr) {
+            return slabs;
+        }
+        slabs.push_back(root);
+        for (size_t i = 0; i < slabs.size(); i++) {
+            if (slabs[i]->up != nullptr) {
+                slabs.push_back(slabs[i]->up);
+            }
+            if (slabs[i]->down != nullptr) {
+                slabs.push_back(slabs[i]->down);
             }
         }
+        return slabs;
+    }
+
+    void SlabTree::reset_splits() {
+        for (auto slab : get_slabs()) {
+            slab->global_split_offset = SlabRun<size_t>();
+        }
+    }
+
+    /*
+     * Scratch buffers for compute_splits. pass is a stack holding the pass set of every slab whose parent has not
+     * been finished yet.
+     */
+    struct SplitScratch {
+        std::vector<size_t> pass;
+        std::vector<size_t> xs;
+        std::vector<size_t> acc;
+        std::vector<size_t> tmp;
+        std::vector<size_t> out;
+        std::vector<std::tuple<slab_ptr, size_t, size_t>> runs;
+    };
+
+    //acc becomes the union of acc and the sorted, duplicate free range [first, last).
+    inline static void union_into(std::vector<size_t>& acc, std::vector<size_t>& tmp,
+                                  std::vector<size_t>::const_iterator first, std::vector<size_t>::const_iterator last) {
+        tmp.clear();
+        std::set_union(acc.begin(), acc.end(), first, last, std::back_inserter(tmp));
+        acc.swap(tmp);
+    }
+
+    //The sorted, duplicate free x coordinates of the merges of slab.
+    inline static void merge_coordinates(Slab const& slab, std::vector<size_t>& xs) {
+        xs.clear();
+        for (auto& pt : slab.m_merges) { xs.emplace_back(pt.get_x()); }
+        for (auto& pt : slab.b_merges) { xs.emplace_back(pt.get_x()); }
+        std::inplace_merge(xs.begin(), xs.begin() + slab.m_merges.size(), xs.end());
+        xs.erase(std::unique(xs.begin(), xs.end()), xs.end());
+    }
+
+    /*
+     * Appends the splits of slab and of every slab below it to scratch.out, recording their runs, and pushes the
+     * pass set of slab on scratch.pass.
+     */
+    static void accumulate_splits(slab_ptr slab, SplitScratch& scratch) {
+        auto& pass = scratch.pass;
+        size_t first = pass.size();
+        if (slab->up == nullptr || slab->down == nullptr) {
+            //Slabs have either two children or none, and a leaf keeps the splits it had.
+            size_t out_first = scratch.out.size();
+            scratch.out.insert(scratch.out.end(), slab->global_split_offset.begin(), slab->global_split_offset.end());
+            scratch.runs.emplace_back(slab, out_first, scratch.out.size());
+            pass.insert(pass.end(), slab->global_split_offset.begin(), slab->global_split_offset.end());
+            return;
+        }
+        accumulate_splits(slab->up, scratch);
+        size_t mid = pass.size();
+        accumulate_splits(slab->down, scratch);
+
+        auto& acc = scratch.acc;
+        acc.assign(slab->global_split_offset.begin(), slab->global_split_offset.end());
+        merge_coordinates(*slab->up, scratch.xs);
+        union_into(acc, scratch.tmp, scratch.xs.cbegin(), scratch.xs.cend());
+        union_into(acc, scratch.tmp, pass.cbegin() + first, pass.cbegin() + mid);
+        //acc is now the pass set of slab, and the down child only adds to the splits of slab itself.
+        size_t out_first = scratch.out.size();
+        merge_coordinates(*slab->down, scratch.xs);
+        scratch.tmp.clear();
+        std::set_union(acc.begin(), acc.end(), scratch.xs.begin(), scratch.xs.end(), std::back_inserter(scratch.tmp));
+        std::set_union(scratch.tmp.begin(), scratch.tmp.end(), pass.begin() + mid, pass.end(),
+                       std::back_inserter(scratch.out));
+        scratch.runs.emplace_back(slab, out_first, scratch.out.size());
+
+        pass.resize(first);
+        pass.insert(pass.end(), acc.begin(), acc.end());
     }
 
     void SlabTree::compute_splits() {
+        /*
+         * Every slab gets the union of the x coordinates of the merges below it. This reproduces the order of the
+         * old leaf up propagation, where a slab was passed on to its parent as soon as its up child had been merged
+         * into it and before its down child was. So what a slab passes on is
+         *     pass(slab) = own(slab) + x(up) + pass(up)
+         * and its splits are pass(slab) + x(down) + pass(down). A post order walk writes the splits of every slab
+         * once, straight into one flat buffer.
+         */
+        if (root == nullptr) {
+            return;
+        }
+        SplitScratch scratch;
+        accumulate_splits(root, scratch);
+        //The root of a subtree view passes on to its ancestors the same way, for as long as it is an up child.
+        for (slab_ptr child = root, p = root->parent; p != nullptr; child = p, p = p->parent) {
+            auto& acc = scratch.acc;
+            acc.assign(p->global_split_offset.begin(), p->global_split_offset.end());
+            merge_coordinates(*child, scratch.xs);
+            union_into(acc, scratch.tmp, scratch.xs.cbegin(), scratch.xs.cend());
+            union_into(acc, scratch.tmp, scratch.pass.cbegin(), scratch.pass.cend());
+            size_t out_first = scratch.out.size();
+            scratch.out.insert(scratch.out.end(), acc.begin(), acc.end());
+            scratch.runs.emplace_back(p, out_first, scratch.out.size());
+            if (child != p->up) {
+                break;
+            }
+            scratch.pass.swap(acc);
+        }
 
-        auto roots = get_leaves();
+        size_t base = 0;
+        if (root == arena->slabs.data()) {
+            // The whole tree is being recomputed, so none of the old runs are needed any more.
+            arena->splits.swap(scratch.out);
+        } else {
+            base = arena->splits.size();
+            arena->splits.insert(arena->splits.end(), scratch.out.begin(), scratch.out.end());
+        }
+        for (auto& [slab, first, last] : scratch.runs) {
+            slab->global_split_offset = SlabRun<size_t>(&arena->splits, base + first, base + last);
+        }
+    }
 
-        using s_it = std::vector<size_t>::iterator;
-        auto inplace_set_union = [](std::vector<size_t>& memory, s_it b, s_it mid, s_it e) {
-            // Now merge into the already existing split offsets.
-            std::inplace_merge(b, mid, e);
-            auto end_it = std::unique(b, e);
-            memory.erase(end_it, e);
-        };
-        //Now go back through and create a list of all the lower splits.
-        while (!roots.empty()) {
-            auto child = roots.back();
-            roots.pop_back();
-            //Now merge into the parent.
-            auto p = child->parent.lock();
-            if (p != nullptr) {
-                //First merge the m_merges and b_merges into the end of the existing global_split_offset
-                std::vector<size_t> curr_splits;
-                curr_splits.reserve(child->m_merges.size() + child->b_merges.size());
-                for (auto& pt : child->m_merges) { curr_splits.emplace_back(pt.get_x()); }
-                for (auto& pt : child->b_merges) { curr_splits.emplace_back(pt.get_x()); }
-
-                inplace_set_union(curr_splits, curr_splits.begin(),
-                                  curr_splits.begin() + child->m_merges.size(),
-                                  curr_splits.end());
-
-                size_t offset = curr_splits.size();
-                curr_splits.reserve(curr_splits.size() + child->global_split_offset.size());
-                std::copy(child->global_split_offset.begin(), child->global_split_offset.end(),
-                          std::back_inserter(curr_splits));
-                inplace_set_union(curr_splits, curr_splits.begin(), curr_splits.begin() + offset, curr_splits.end());
-
-                size_t offset2 = p->global_split_offset.size();
-                std::copy(curr_splits.begin(), curr_splits.end(), std::back_inserter(p->global_split_offset));
-
-                inplace_set_union(p->global_split_offset, p->global_split_offset.begin(),
-                                  p->global_split_offset.begin() + offset2, p->global_split_offset.end());
-                if (p->up == nullptr || child == p->up) {
-                    roots.emplace_back(p);
-                }
+    template <typename Compress>
+    void SlabTree::compress_merges(Compress compress) {
+        /*
+         * Rebuilds both merge buffers of the arena. compress(slab, m_out, b_out) appends the new merges of each slab
+         * in this tree and the slabs of the arena outside of it are copied as they are. Swapping in the new buffers
+         * releases the memory of the uncompressed lists.
+         */
+        std::vector<bool> in_tree(arena->slabs.size(), false);
+        for (auto slab : get_slabs()) {
+            in_tree[slab - arena->slabs.data()] = true;
+        }
+        epoint_list_t m_points;
+        epoint_list_t b_points;
+        std::vector<std::array<size_t, 4>> runs(arena->slabs.size());
+        for (size_t i = 0; i < arena->slabs.size(); i++) {
+            auto& slab = arena->slabs[i];
+            runs[i][0] = m_points.size();
+            runs[i][2] = b_points.size();
+            if (in_tree[i]) {
+                compress(slab, m_points, b_points);
+            } else {
+                m_points.insert(m_points.end(), slab.m_merges.begin(), slab.m_merges.end());
+                b_points.insert(b_points.end(), slab.b_merges.begin(), slab.b_merges.end());
             }
+            runs[i][1] = m_points.size();
+            runs[i][3] = b_points.size();
+        }
+        arena->m_points.swap(m_points);
+        arena->b_points.swap(b_points);
+        for (size_t i = 0; i < arena->slabs.size(); i++) {
+            arena->slabs[i].m_merges = SlabRun<ept_t>(&arena->m_points, runs[i][0], runs[i][1]);
+            arena->slabs[i].b_merges = SlabRun<ept_t>(&arena->b_points, runs[i][2], runs[i][3]);
         }
     }
 
     void SlabTree::block_compress(double max_w) {
 
-        std::vector<slab_ptr> curr_slabs;
         if (root == nullptr) {
             return;
         }
         std::random_device rd;
         std::minstd_rand gen(rd());
 
-        curr_slabs.emplace_back(root->up);
-        curr_slabs.emplace_back(root->down);
-        while (!curr_slabs.empty()) {
-            auto curr_root = curr_slabs.back();
-            curr_slabs.pop_back();
-            if (curr_root != nullptr) {
-                curr_root->m_merges = block_compress_internal(curr_root->m_merges.begin(), curr_root->m_merges.end(), max_w * total_m, gen);
-                curr_root->b_merges = block_compress_internal(curr_root->b_merges.begin(), curr_root->b_merges.end(), max_w * total_b, gen);
-                curr_slabs.emplace_back(curr_root->up);
-                curr_slabs.emplace_back(curr_root->down);
+        compress_merges([&](Slab const& slab, epoint_list_t& m_out, epoint_list_t& b_out) {
+            // The root keeps all of its points.
+            if (&slab == root) {
+                m_out.insert(m_out.end(), slab.m_merges.begin(), slab.m_merges.end());
+                b_out.insert(b_out.end(), slab.b_merges.begin(), slab.b_merges.end());
+            } else {
+                block_compress_internal(slab.m_merges.begin(), slab.m_merges.end(), max_w * total_m, gen, m_out);
+                block_compress_internal(slab.b_merges.begin(), slab.b_merges.end(), max_w * total_b, gen, b_out);
             }
-        }
+        });
     }
 
     void SlabTree::even_compress(double max_w) {
-        std::vector<slab_ptr> curr_slabs;
-        curr_slabs.emplace_back(root);
-        while (!curr_slabs.empty()) {
-            auto curr_root = curr_slabs.back();
-            curr_slabs.pop_back();
-            if (curr_root != nullptr) {
-                curr_root->m_merges = even_compress_internal(curr_root->m_merges.begin(), curr_root->m_merges.end(),
-                                               max_w * total_m);
-                curr_root->b_merges = even_compress_internal(curr_root->b_merges.begin(), curr_root->b_merges.end(), max_w * total_b);
-                curr_slabs.emplace_back(curr_root->up);
-                curr_slabs.emplace_back(curr_root->down);
-            }
-        }
+        compress_merges([&](Slab const& slab, epoint_list_t& m_out, epoint_list_t& b_out) {
+            even_compress_internal(slab.m_merges.begin(), slab.m_merges.end(), max_w * total_m, m_out);
+            even_compress_internal(slab.b_merges.begin(), slab.b_merges.end(), max_w * total_b, b_out);
+        });
     }
 
 //    void SlabTree::cascade_compress(double eps){
@@ -1208,7 +1663,7 @@ namespace pyscan {
     }
 
     std::vector<MaxIntervalAlt> insert_updates(std::vector<MaxIntervalAlt> const& max_intervals,
-                                              epoint_list_t const& updates, double scale) {
+                                              SlabRun<ept_t> const& updates, double scale) {
         std::vector<MaxIntervalAlt> new_set;
         for (auto& p : updates) {
             new_set.emplace_back(p.get_x(), p.get_weight() * scale);
@@ -1232,7 +1687,7 @@ namespace pyscan {
     }
 
     std::vector<MaxIntervalAlt> reduce_merges(std::vector<MaxIntervalAlt> const& max_intervals,
-                                        std::vector<size_t> const& curr_splits) {
+                                        SlabRun<size_t> const& curr_splits) {
 
         if (max_intervals.empty()) {
             return {};
@@ -1293,19 +1748,72 @@ namespace pyscan {
             std::set_union(top->global_split_offset.begin(), top->global_split_offset.end(),
                        bottom->global_split_offset.begin(), bottom->global_split_offset.end(),
                        std::back_inserter(splits));
-            auto tmp_merges = reduce_merges(max_intervals, splits);
+            auto tmp_merges = reduce_merges(max_intervals, SlabRun<size_t>(&splits, 0, splits.size()));
             return tmp_merges;
         } else if (top != nullptr) {
             return reduce_merges(max_intervals, top->global_split_offset);
         } else if (bottom != nullptr) {
             return reduce_merges(max_intervals, bottom->global_split_offset);
         } else {
-            std::vector<size_t> splits;
-            return reduce_merges(max_intervals, splits);
+            return reduce_merges(max_intervals, SlabRun<size_t>());
         }
     }
 
 
+    /*
+     * Handles the frame on top of the stack. A frame with no remaining slabs describes a single vertical interval
+     * and is scored against the current maximum, any other frame is replaced by its four children.
+     */
+    void midpoint_step(std::vector<slab_frame>& slab_stack, double m_a, double b_b,
+            ERectangle& max_rect, double& max_v) {
+        auto [top_top, top_bottom, bottom_top, bottom_bottom, p_up, p_low, m4] = slab_stack.back();
+        slab_stack.pop_back();
+        if (!(top_top == nullptr &&
+              top_bottom == nullptr &&
+              bottom_top == nullptr &&
+              bottom_bottom == nullptr)) {
+            // 4 doesn't have any merges
+            // 3 is top_bottom merged.
+            // 2 is bottom_top merged.
+            // 1 is top_bottom and bottom_top merged.
+            //Pretty sure this works.
+            auto m3 = update_mx_intervals(m4, top_bottom, m_a, b_b);
+            auto m1 = update_mx_intervals(m3, bottom_top, m_a, b_b);
+            auto m2 = update_mx_intervals(m4, bottom_top, m_a, b_b);
+
+            //Pretty sure this works.
+            m1 = reduce_merges_helper(m1, top_top, bottom_bottom);
+            m2 = reduce_merges_helper(m2, top_bottom, bottom_bottom);
+            m3 = reduce_merges_helper(m3, top_top, bottom_top);
+            m4 = reduce_merges_helper(m4, top_bottom, bottom_top);
+
+            emplace_helper(slab_stack, top_top, bottom_bottom, p_up, p_low, m1);
+            emplace_helper(slab_stack, top_bottom, bottom_bottom, p_up, p_low, m2);
+            emplace_helper(slab_stack, top_top, bottom_top, p_up, p_low, m3);
+            emplace_helper(slab_stack, top_bottom, bottom_top, p_up, p_low, m4);
+
+        } else {
+            if (!m4.empty() && max_v < m4[0].get_max().get_v()) {
+                size_t lx = m4[0].get_max().get_l();
+                size_t rx = m4[0].get_max().get_r();
+
+                max_rect = ERectangle(rx + 1, p_up, lx, p_low);
+                max_v = m4[0].get_max().get_v();
+            }
+        }
+    }
+
+    bool is_leaf_frame(slab_frame const& frame) {
+        return std::get<0>(frame) == nullptr && std::get<1>(frame) == nullptr &&
+               std::get<2>(frame) == nullptr && std::get<3>(frame) == nullptr;
+    }
+
+    slab_frame root_frame(slab_ptr root) {
+        return slab_frame(get_top(root->up), get_bottom(root->up),
+                get_top(root->down), get_bottom(root->down),
+                root->get_mid(), root->get_mid(), std::vector<MaxIntervalAlt>());
+    }
+
     std::tuple<ERectangle, double> SlabTree::max_rectangle_midpoint(double m_a, double b_b) {
         //Initialize with list of maximum intervals.
         ERectangle max_rect;
@@ -1313,82 +1821,125 @@ namespace pyscan {
         b_b = b_b / total_b;
 
         std::vector<slab_frame> slab_stack;
-        slab_stack.emplace_back(get_top(root->up), get_bottom(root->up),
-                get_top(root->down), get_bottom(root->down),
-                root->get_mid(), root->get_mid(), std::vector<MaxIntervalAlt>());
+        slab_stack.emplace_back(root_frame(root));
 
         double max_v = 0;
         while (!slab_stack.empty()) {
-            auto [top_top, top_bottom, bottom_top, bottom_bottom, p_up, p_low, m4] = slab_stack.back();
-            slab_stack.pop_back();
-            if (!(top_top == nullptr &&
-                  top_bottom == nullptr &&
-                  bottom_top == nullptr &&
-                  bottom_bottom == nullptr)) {
-                // 4 doesn't have any merges
-                // 3 is top_bottom merged.
-                // 2 is bottom_top merged.
-                // 1 is top_bottom and bottom_top merged.
-                //Pretty sure this works.
-                auto m3 = update_mx_intervals(m4, top_bottom, m_a, b_b);
-                auto m1 = update_mx_intervals(m3, bottom_top, m_a, b_b);
-                auto m2 = update_mx_intervals(m4, bottom_top, m_a, b_b);
-
-                //Pretty sure this works.
-                m1 = reduce_merges_helper(m1, top_top, bottom_bottom);
-                m2 = reduce_merges_helper(m2, top_bottom, bottom_bottom);
-                m3 = reduce_merges_helper(m3, top_top, bottom_top);
-                m4 = reduce_merges_helper(m4, top_bottom, bottom_top);
-
-                emplace_helper(slab_stack, top_top, bottom_bottom, p_up, p_low, m1);
-                emplace_helper(slab_stack, top_bottom, bottom_bottom, p_up, p_low, m2);
-                emplace_helper(slab_stack, top_top, bottom_top, p_up, p_low, m3);
-                emplace_helper(slab_stack, top_bottom, bottom_top, p_up, p_low, m4);
+            midpoint_step(slab_stack, m_a, b_b, max_rect, max_v);
+        }
+        return std::make_tuple(max_rect, max_v);
 
-            } else {
-                if (!m4.empty() && max_v < m4[0].get_max().get_v()) {
-                    size_t lx = m4[0].get_max().get_l();
-                    size_t rx = m4[0].get_max().get_r();
+    }
 
-                    max_rect = ERectangle(rx + 1, p_up, lx, p_low);
-                    max_v = m4[0].get_max().get_v();
+    std::tuple<ERectangle, double> SlabTree::max_rectangle(double m_a, double b_b, size_t threads) {
+        size_t workers = resolve_thread_count(threads);
+        if (workers <= 1) {
+            std::vector<SlabTree> child_instances;
+            child_instances.emplace_back(*this);
+            ERectangle max_rect;
+            double max_v = 0;
+            while (!child_instances.empty()) {
+                auto curr_tree = child_instances.back();
+                child_instances.pop_back();
+                auto [erect, eval] = curr_tree.max_rectangle_midpoint(m_a, b_b);
+                if (eval > max_v) {
+                    max_rect = erect;
+                    max_v = eval;
+                }
+                if (curr_tree.get_root()->up != nullptr) {
+                    child_instances.emplace_back(curr_tree.get_upper_tree());
+                }
+                if (curr_tree.get_root()->down != nullptr) {
+                    child_instances.emplace_back(curr_tree.get_lower_tree());
                 }
             }
+            return std::make_tuple(max_rect, max_v);
         }
-        return std::make_tuple(max_rect, max_v);
 
-    }
+        /*
+         * Every subtree runs its own midpoint recursion and those recursions only meet in the final maximum. The
+         * frames are laid out in the order the serial scan would visit them, one root frame per subtree, and the
+         * frames are split into their children level by level until there is enough work to go around (the depth
+         * cutoff). Each frame is then scanned to completion as a task of the work stealing parallel_for and the
+         * task maxima are reduced in frame order, so ties resolve exactly as they do in the serial scan.
+         */
+        double scaled_a = m_a / total_m;
+        double scaled_b = b_b / total_b;
+
+        std::vector<slab_frame> frames;
+        std::vector<slab_ptr> roots{root};
+        while (!roots.empty()) {
+            auto curr = roots.back();
+            roots.pop_back();
+            frames.emplace_back(root_frame(curr));
+            if (curr->up != nullptr) {
+                roots.emplace_back(curr->up);
+            }
+            if (curr->down != nullptr) {
+                roots.emplace_back(curr->down);
+            }
+        }
+
+        size_t target = workers * 16;
+        std::vector<slab_frame> next_frames;
+        std::vector<slab_frame> children;
+        while (frames.size() < target) {
+            bool split = false;
+            next_frames.clear();
+            for (auto& frame : frames) {
+                if (is_leaf_frame(frame)) {
+                    next_frames.emplace_back(std::move(frame));
+                    continue;
+                }
+                // A split frame only pushes its children, so nothing can be scored here.
+                ERectangle unused_rect;
+                double unused_v = 0;
+                children.clear();
+                children.emplace_back(std::move(frame));
+                midpoint_step(children, scaled_a, scaled_b, unused_rect, unused_v);
+                // The serial scan pops the children from the back of its stack.
+                std::move(children.rbegin(), children.rend(), std::back_inserter(next_frames));
+                split = true;
+            }
+            std::swap(frames, next_frames);
+            if (!split) {
+                break;
+            }
+        }
+
+        std::vector<std::tuple<ERectangle, double>> results(frames.size(), std::make_tuple(ERectangle(), 0.0));
+        parallel_for(frames.size(), workers, [&](size_t i, size_t) {
+            std::vector<slab_frame> slab_stack;
+            slab_stack.emplace_back(std::move(frames[i]));
+            auto& [max_rect, max_v] = results[i];
+            while (!slab_stack.empty()) {
+                midpoint_step(slab_stack, scaled_a, scaled_b, max_rect, max_v);
+            }
+        });
 
-    std::tuple<ERectangle, double> SlabTree::max_rectangle(double m_a, double b_b) {
-        std::vector<SlabTree> child_instances;
-        child_instances.emplace_back(*this);
         ERectangle max_rect;
         double max_v = 0;
-        while (!child_instances.empty()) {
-            auto curr_tree = child_instances.back();
-            child_instances.pop_back();
-            auto [erect, eval] = curr_tree.max_rectangle_midpoint(m_a, b_b);
+        for (auto& [erect, eval] : results) {
             if (eval > max_v) {
                 max_rect = erect;
                 max_v = eval;
             }
-            if (curr_tree.get_root()->up != nullptr) {
-                child_instances.emplace_back(curr_tree.get_upper_tree());
-            }
-            if (curr_tree.get_root()->down != nullptr) {
-                child_instances.emplace_back(curr_tree.get_lower_tree());
-            }
         }
         return std::make_tuple(max_rect, max_v);
     }
 
 
-    std::tuple<Rectangle, double> max_rectangle(const wpoint_list_t& mpts, const wpoint_list_t& bpts, double eps, double a, double b) {
-        auto [m_pts, b_pts, xmap, ymap] = pyscan::to_epoints(mpts, bpts);
-        SlabTree tree(m_pts, b_pts, eps);
-        tree.even_compress(eps / log(1 / eps));
+    std::tuple<ERectangle, double> max_erectangle(const epoint_list_t& m_pts, const epoint_list_t& b_pts, double eps, double a, double b,
+            size_t threads) {
+        SlabTree tree(m_pts, b_pts, eps, eps / log(1 / eps));
         tree.compute_splits();
-        auto [max_rect, max_v] = tree.max_rectangle(a, b);
+        return tree.max_rectangle(a, b, threads);
+    }
+
+    std::tuple<Rectangle, double> max_rectangle(const wpoint_list_t& mpts, const wpoint_list_t& bpts, double eps, double a, double b,
+            size_t threads) {
+        auto [m_pts, b_pts, xmap, ymap] = pyscan::to_epoints(mpts, bpts);
+        auto [max_rect, max_v] = max_erectangle(m_pts, b_pts, eps, a, b, threads);
         return std::make_tuple(Rectangle(xmap[max_rect.upX()], ymap[max_rect.upY()], xmap[max_rect.lowX()], ymap[max_rect.lowY()]), max_v);
     }
 
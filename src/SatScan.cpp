@@ -4,142 +4,257 @@
  * email: michaelmathen@gmail.com
  * website: https://mmath.dev/
  */
+#include <numeric>
+#include <unordered_map>
+
 #include "Point.hpp"
 #include "Disk.hpp"
 #include "Gridding.hpp"
+#include "Parallel.hpp"
+#include "PointArray.hpp"
 #include "SatScan.hpp"
+#include "Statistics.hpp"
 
 namespace pyscan {
 
+    /*
+     * The points of one set sorted by x, so the points of a vertical strip are a contiguous run. Labels are renamed
+     * to 0..L-1 so the label set of a disk can be a flat array.
+     */
+    struct StripIndex {
+        std::vector<double> x;
+        std::vector<double> y;
+        std::vector<double> w;
+        std::vector<size_t> label;
+        size_t label_count = 0;
+        double total;
+
+        explicit StripIndex(const PointArray& pts) : total(computeTotal(pts)) {
+            std::vector<size_t> order(pts.size());
+            std::iota(order.begin(), order.end(), 0);
+            std::sort(order.begin(), order.end(), [&](size_t i, size_t j) { return pts.x[i] < pts.x[j]; });
+            x.reserve(pts.size());
+            y.reserve(pts.size());
+            w.reserve(pts.size());
+            std::unordered_map<size_t, size_t> ids;
+            for (size_t i : order) {
+                x.push_back(pts.x[i]);
+                y.push_back(pts.y[i]);
+                w.push_back(pts.w[i]);
+                if (pts.has_labels()) {
+                    label.push_back(ids.emplace(pts.label[i], ids.size()).first->second);
+                }
+            }
+            label_count = ids.size();
+        }
+
+        //The points with cx - r <= x <= cx + r in order of increasing y.
+        void strip(double cx, double r, std::vector<size_t>& out) const {
+            auto lo = std::lower_bound(x.begin(), x.end(), cx - r);
+            auto hi = std::upper_bound(lo, x.end(), cx + r);
+            out.resize(hi - lo);
+            std::iota(out.begin(), out.end(), static_cast<size_t>(lo - x.begin()));
+            std::sort(out.begin(), out.end(), [&](size_t i, size_t j) { return y[i] < y[j]; });
+        }
+    };
+
+    using dist_index_t = std::vector<std::pair<double, size_t>>;
+
+    /*
+     * Buffers reused by every center that one worker scans.
+     */
+    struct SequenceScratch {
+        std::vector<size_t> m_strip;
+        std::vector<size_t> b_strip;
+        dist_index_t m_order;
+        dist_index_t b_order;
+        std::vector<double> m_sums;
+        std::vector<double> b_sums;
+        std::vector<double> dists;
+        std::vector<double> stats;
+        std::vector<size_t> m_stamp;
+        std::vector<size_t> b_stamp;
+        size_t generation = 0;
+    };
+
+    /*
+     * Sweeps the disks centered at (cx, cy) with radius at most disk_r in order of increasing radius. Only the
+     * points of the y window [lo, hi) of each strip are candidates, and only their (squared distance, index) pairs
+     * are sorted. A labeled point only adds its weight the first time its label enters the disk. The running
+     * weights of every disk are recorded first and the statistic is evaluated on all of them in one batch.
+     */
     static std::tuple<Disk, double> max_disk_sequence(
-            const pt2_t& center,
-            lpoint_list_t &measured,
-            lpoint_list_t &baseline,
+            double cx, double cy, double disk_r,
+            const StripIndex& measured,
+            const StripIndex& baseline,
+            size_t m_lo, size_t m_hi,
+            size_t b_lo, size_t b_hi,
+            SequenceScratch& scratch,
             discrepancy_func_t const& disc) {
 
-        auto order_f = [&center] (const pt2_t& p1, const pt2_t& p2) {
-            return center.dist(p1) < center.dist(p2);
+        double r2 = disk_r * disk_r;
+        auto fill_order = [cx, cy, r2] (const StripIndex& pts, const std::vector<size_t>& strip, size_t lo, size_t hi,
+                dist_index_t& order) {
+            order.clear();
+            for (size_t k = lo; k < hi; ++k) {
+                size_t i = strip[k];
+                double dx = pts.x[i] - cx;
+                double dy = pts.y[i] - cy;
+                double d2 = dx * dx + dy * dy;
+                if (d2 <= r2) {
+                    order.emplace_back(d2, i);
+                }
+            }
+            std::sort(order.begin(), order.end());
         };
-        std::sort(measured.begin(), measured.end(), order_f);
-        std::sort(baseline.begin(), baseline.end(), order_f);
-        double m_tot = computeTotal(measured);
-        double b_tot = computeTotal(baseline);
+        auto& m_order = scratch.m_order;
+        auto& b_order = scratch.b_order;
+        fill_order(measured, scratch.m_strip, m_lo, m_hi, m_order);
+        fill_order(baseline, scratch.b_strip, b_lo, b_hi, b_order);
 
-        double max_disc = -std::numeric_limits<double>::infinity();
-        Disk max_disk(center(0), center(1), 0.0);
-        double m_curr_sum = 0;
-        double b_curr_sum = 0;
-        auto curr_m = measured.begin();
-        auto curr_b = baseline.begin();
-        double curr_dist = 0;
-        using label_set = std::unordered_set<decltype(measured.front().get_label())>;
-        label_set measured_label_set;
-        label_set baseline_label_set;
-        auto increment = [&] (const lpt2_t& pt, label_set& labels) {
-            auto it = labels.find(pt.get_label());
-            if (it == labels.end()) {
-                labels.insert(pt.get_label());
-                return pt.get_weight();
+        scratch.generation++;
+        auto weight = [&] (const StripIndex& pts, size_t i, std::vector<size_t>& stamp) {
+            if (pts.label.empty()) {
+                return pts.w[i];
+            } else if (stamp[pts.label[i]] != scratch.generation) {
+                stamp[pts.label[i]] = scratch.generation;
+                return pts.w[i];
             } else {
                 return 0.0;
             }
         };
-        while (curr_m != measured.end() || curr_b != baseline.end()) {
-            if (curr_b == baseline.end()) {
-                m_curr_sum += increment(*curr_m, measured_label_set);
-                curr_dist = center.dist(*curr_m);
-                curr_m++;
-            } else if (curr_m == measured.end()) {
-                b_curr_sum += increment(*curr_b, baseline_label_set);
-                curr_dist = center.dist(*curr_b);
-                curr_b++;
-            } else if (center.dist(*curr_m) < center.dist(*curr_b)) {
-                m_curr_sum += increment(*curr_m, measured_label_set);
-                curr_dist = center.dist(*curr_m);
-                curr_m++;
-            } else {
-                b_curr_sum += increment(*curr_b, baseline_label_set);
-                curr_dist = center.dist(*curr_b);
-                curr_b++;
-            }
-            double curr_disc = disc(m_curr_sum, m_tot, b_curr_sum, b_tot);
-            if (curr_disc > max_disc) {
-                max_disc = curr_disc;
-                max_disk = Disk(center(0), center(1), curr_dist);
-            }
-        }
-        return std::make_tuple(max_disk, max_disc);
-    }
 
-    static std::tuple<Disk, double> max_disk_sequence(
-            const pt2_t& center,
-            wpoint_list_t &measured,
-            wpoint_list_t &baseline,
-            discrepancy_func_t const& disc) {
-
-        auto order_f = [&center] (const pt2_t& p1, const pt2_t& p2) {
-            return center.dist(p1) < center.dist(p2);
-        };
-        std::sort(measured.begin(), measured.end(), order_f);
-        std::sort(baseline.begin(), baseline.end(), order_f);
-        double m_tot = computeTotal(measured);
-        double b_tot = computeTotal(baseline);
-
-        double max_disc = -std::numeric_limits<double>::infinity();
-        Disk max_disk(center(0), center(1), 0.0);
+        size_t n = m_order.size() + b_order.size();
+        scratch.m_sums.resize(n);
+        scratch.b_sums.resize(n);
+        scratch.dists.resize(n);
+        scratch.stats.resize(n);
         double m_curr_sum = 0;
         double b_curr_sum = 0;
-        auto curr_m = measured.begin();
-        auto curr_b = baseline.begin();
-        double curr_dist = 0;
-        while (curr_m != measured.end() || curr_b != baseline.end()) {
-            if (curr_b == baseline.end()) {
-                m_curr_sum += curr_m->get_weight();
-                curr_dist = center.dist(*curr_m);
-                curr_m++;
-            } else if (curr_m == measured.end()) {
-                b_curr_sum += curr_b->get_weight();
-                curr_dist = center.dist(*curr_b);
-                curr_b++;
-            } else if (center.dist(*curr_m) < center.dist(*curr_b)) {
-                m_curr_sum += curr_m->get_weight();
-                curr_dist = center.dist(*curr_m);
+        auto curr_m = m_order.begin();
+        auto curr_b = b_order.begin();
+        for (size_t i = 0; i < n; ++i) {
+            if (curr_b == b_order.end() || (curr_m != m_order.end() && curr_m->first < curr_b->first)) {
+                m_curr_sum += weight(measured, curr_m->second, scratch.m_stamp);
+                scratch.dists[i] = curr_m->first;
                 curr_m++;
             } else {
-                b_curr_sum += curr_b->get_weight();
-                curr_dist = center.dist(*curr_b);
+                b_curr_sum += weight(baseline, curr_b->second, scratch.b_stamp);
+                scratch.dists[i] = curr_b->first;
                 curr_b++;
             }
-            double curr_disc = disc(m_curr_sum, m_tot, b_curr_sum, b_tot);
-            if (curr_disc > max_disc) {
-                max_disc = curr_disc;
-                max_disk = Disk(center(0), center(1), curr_dist);
+            scratch.m_sums[i] = m_curr_sum;
+            scratch.b_sums[i] = b_curr_sum;
+        }
+        evaluate_batch(disc, scratch.m_sums.data(), scratch.b_sums.data(), n, measured.total, baseline.total,
+                scratch.stats.data());
+
+        double max_disc = -std::numeric_limits<double>::infinity();
+        Disk max_disk(cx, cy, 0.0);
+        for (size_t i = 0; i < n; ++i) {
+            if (scratch.stats[i] > max_disc) {
+                max_disc = scratch.stats[i];
+                max_disk = Disk(cx, cy, sqrt(scratch.dists[i]));
             }
         }
-       return std::make_tuple(max_disk, max_disc);
+        return std::make_tuple(max_disk, max_disc);
     }
 
-    template <typename Pt>
-    std::tuple<Disk, double> max_grid_disk_internal(
-            std::vector<Pt> measured,
-            std::vector<Pt> baseline,
+    /*
+     * The grid centers grid_scan visits over the bounding box of both sets grown by disk_r, as the x coordinates
+     * of the columns and the y coordinates shared by every column. Returns false when both sets are empty.
+     */
+    static bool center_grid(
+            const PointArray& measured,
+            const PointArray& baseline,
             double grid_res,
+            double disk_r,
+            std::vector<double>& xs,
+            std::vector<double>& ys) {
+        xs.clear();
+        ys.clear();
+        auto bb_op = bbox(measured, baseline);
+        if (!bb_op.has_value()) {
+            return false;
+        }
+        auto [mnx, mny, mxx, mxy] = bb_op.value();
+        for (double x = mnx - disk_r; x < mxx + disk_r; x = x + grid_res) {
+            xs.push_back(x);
+        }
+        for (double y = mny - disk_r; y < mxy + disk_r; y = y + grid_res) {
+            ys.push_back(y);
+        }
+        return true;
+    }
+
+    /*
+     * Every column of grid centers shares one strip of candidate points per set, sorted by y, and moving up the
+     * column only slides a y window over it. The columns are scanned on threads workers and the best disk of each
+     * is kept, so the maximum is reduced in the same order grid_scan visits the centers.
+     *
+     * When profile is not null the best disk of every center is also written there, center (c, r) at
+     * profile[4 * (c * ys.size() + r)] as its x, y, radius and statistic.
+     */
+    static std::tuple<Disk, double> max_grid_disk_internal(
+            const PointArray& measured,
+            const PointArray& baseline,
+            double disk_r,
             discrepancy_func_t const& disc,
-            bbox_t const& full_bb) {
-        Disk curr_max;
-        double max_stat = -std::numeric_limits<float>::infinity();
+            std::vector<double> const& xs,
+            std::vector<double> const& ys,
+            size_t threads,
+            double* profile) {
+        StripIndex m_index(measured);
+        StripIndex b_index(baseline);
 
+        size_t workers = std::max<size_t>(std::min(resolve_thread_count(threads), xs.size()), 1);
+        SequenceScratch proto;
+        proto.m_stamp.resize(m_index.label_count, 0);
+        proto.b_stamp.resize(b_index.label_count, 0);
+        std::vector<SequenceScratch> scratches(workers, proto);
+        std::vector<Disk> column_max(xs.size());
+        std::vector<double> column_stat(xs.size(), -std::numeric_limits<double>::infinity());
 
-        auto scanning = [&] (double x, double y){
-            pt2_t center(x, y, 1.0);
-            auto [d, mx_d] = max_disk_sequence(center, measured, baseline, disc);
-            if (max_stat < mx_d) {
-                curr_max = d;
-                max_stat = mx_d;
+        parallel_for(xs.size(), workers, [&](size_t c, size_t worker) {
+            auto& scratch = scratches[worker];
+            double cx = xs[c];
+            m_index.strip(cx, disk_r, scratch.m_strip);
+            b_index.strip(cx, disk_r, scratch.b_strip);
+            size_t m_lo = 0, m_hi = 0, b_lo = 0, b_hi = 0;
+            auto slide = [disk_r](const StripIndex& pts, const std::vector<size_t>& strip, double cy,
+                    size_t& lo, size_t& hi) {
+                while (lo < strip.size() && pts.y[strip[lo]] < cy - disk_r) lo++;
+                hi = std::max(hi, lo);
+                while (hi < strip.size() && pts.y[strip[hi]] <= cy + disk_r) hi++;
+            };
+            for (size_t r = 0; r < ys.size(); r++) {
+                double cy = ys[r];
+                slide(m_index, scratch.m_strip, cy, m_lo, m_hi);
+                slide(b_index, scratch.b_strip, cy, b_lo, b_hi);
+                auto [d, mx_d] = max_disk_sequence(cx, cy, disk_r, m_index, b_index, m_lo, m_hi, b_lo, b_hi,
+                        scratch, disc);
+                if (profile != nullptr) {
+                    double* row = profile + 4 * (c * ys.size() + r);
+                    row[0] = cx;
+                    row[1] = cy;
+                    row[2] = d.getRadius();
+                    row[3] = mx_d;
+                }
+                if (column_stat[c] < mx_d) {
+                    column_max[c] = d;
+                    column_stat[c] = mx_d;
+                }
             }
+        });
 
-        };
-        grid_scan(full_bb, grid_res, scanning);
+        Disk curr_max;
+        double max_stat = -std::numeric_limits<float>::infinity();
+        for (size_t c = 0; c < xs.size(); c++) {
+            if (max_stat < column_stat[c]) {
+                curr_max = column_max[c];
+                max_stat = column_stat[c];
+            }
+        }
         return std::make_tuple(curr_max, max_stat);
     }
 
@@ -148,17 +263,25 @@ namespace pyscan {
             const wpoint_list_t &baseline,
             double grid_res,
             double disk_r,
-            discrepancy_func_t const& func) {
-        auto bb_op = bbox(measured, baseline);
-        if (!bb_op.has_value()) {
+            discrepancy_func_t const& func,
+            size_t threads) {
+        return satscan_grid(PointArray(measured), PointArray(baseline), grid_res, disk_r, func, threads);
+    }
+
+    std::tuple<Disk, double> satscan_grid(
+            const PointArray &measured,
+            const PointArray &baseline,
+            double grid_res,
+            double disk_r,
+            discrepancy_func_t const& func,
+            size_t threads) {
+        std::vector<double> xs, ys;
+        if (!center_grid(measured, baseline, grid_res, disk_r, xs, ys)) {
             Disk curr_max;
             double max_stat = 0.0;
             return std::make_tuple(curr_max, max_stat);
         }
-        auto full_bb = bb_op.value();
-        auto [mnx, mny, mxx, mxy] = full_bb;
-        auto edited_bb = std::make_tuple(mnx - disk_r, mny - disk_r, mxx + disk_r, mxy + disk_r);
-        return max_grid_disk_internal(measured, baseline, grid_res, func, edited_bb);
+        return max_grid_disk_internal(measured, baseline, disk_r, func, xs, ys, threads, nullptr);
     }
 
     std::tuple<Disk, double> satscan_grid_labeled(
@@ -166,18 +289,35 @@ namespace pyscan {
             const lpoint_list_t &baseline,
             double grid_res,
             double disk_r,
-            discrepancy_func_t const& func) {
-        auto bb_op = bbox(measured, baseline);
-        if (!bb_op.has_value()) {
+            discrepancy_func_t const& func,
+            size_t threads) {
+        return satscan_grid(PointArray(measured), PointArray(baseline), grid_res, disk_r, func, threads);
+    }
+
+    std::tuple<size_t, size_t> satscan_grid_shape(
+            const PointArray &measured,
+            const PointArray &baseline,
+            double grid_res,
+            double disk_r) {
+        std::vector<double> xs, ys;
+        center_grid(measured, baseline, grid_res, disk_r, xs, ys);
+        return std::make_tuple(xs.size(), ys.size());
+    }
+
+    std::tuple<Disk, double> satscan_grid_profile(
+            const PointArray &measured,
+            const PointArray &baseline,
+            double grid_res,
+            double disk_r,
+            discrepancy_func_t const& func,
+            double* out,
+            size_t threads) {
+        std::vector<double> xs, ys;
+        if (!center_grid(measured, baseline, grid_res, disk_r, xs, ys)) {
             Disk curr_max;
             double max_stat = 0.0;
             return std::make_tuple(curr_max, max_stat);
         }
-        auto full_bb = bb_op.value();
-        auto [mnx, mny, mxx, mxy] = full_bb;
-        auto edited_bb = std::make_tuple(mnx - disk_r, mny - disk_r, mxx + disk_r, mxy + disk_r);
-        return max_grid_disk_internal(measured, baseline, grid_res, func, edited_bb);
+        return max_grid_disk_internal(measured, baseline, disk_r, func, xs, ys, threads, out);
     }
-
-
-}
\ No newline at end of file
+}
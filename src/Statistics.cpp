@@ -0,0 +1,280 @@
+#include <cfloat>
+#include <cstdint>
+
+#include "Simd.hpp"
+#include "Statistics.hpp"
+
+namespace pyscan {
+
+    namespace {
+
+        template <typename Stat>
+        void evaluate_scalar(const Stat& stat,
+                const double* m_sub, const double* b_sub, size_t n,
+                double m_total, double b_total,
+                double* out) {
+            for (size_t i = 0; i < n; ++i) {
+                out[i] = stat(m_sub[i], m_total, b_sub[i], b_total);
+            }
+        }
+
+#if defined(PYSCAN_SIMD)
+        using vec = Simd::vec;
+        using mask = Simd::mask;
+
+        /*
+         * Natural log for positive normal finite lanes. This is the reduction and polynomial of the fdlibm log,
+         * which is accurate to within an ulp. Other inputs give garbage, so callers route those lanes to the scalar
+         * statistic with in_log_domain.
+         */
+        inline vec simd_log(vec x) {
+            const vec ln2_hi = Simd::set1(6.93147180369123816490e-01);
+            const vec ln2_lo = Simd::set1(1.90821492927058770002e-10);
+            const vec Lg1 = Simd::set1(6.666666666666735130e-01);
+            const vec Lg2 = Simd::set1(3.999999999940941908e-01);
+            const vec Lg3 = Simd::set1(2.857142874366239149e-01);
+            const vec Lg4 = Simd::set1(2.222219843214978396e-01);
+            const vec Lg5 = Simd::set1(1.818357216161805012e-01);
+            const vec Lg6 = Simd::set1(1.531383769920937332e-01);
+            const vec Lg7 = Simd::set1(1.479819860511658591e-01);
+            const vec one = Simd::set1(1.0);
+            const vec half = Simd::set1(0.5);
+
+            // x = 2^k * m with m in [1, 2). The biased exponent is turned into a double by planting it in the
+            // mantissa of 2^52.
+            auto xi = Simd::as_int(x);
+            auto m = Simd::as_double(Simd::ior(Simd::iand(xi, Simd::iset1(0x000fffffffffffffLL)),
+                                               Simd::iset1(0x3ff0000000000000LL)));
+            auto k = Simd::sub(Simd::as_double(Simd::ior(Simd::srl52(xi), Simd::iset1(0x4330000000000000LL))),
+                               Simd::set1(4503599627370496.0 + 1023.0));
+
+            // Move m into [sqrt(2)/2, sqrt(2)).
+            auto big = Simd::gt(m, Simd::set1(1.41421356237309504880));
+            m = Simd::select(big, Simd::mul(m, half), m);
+            k = Simd::select(big, Simd::add(k, one), k);
+
+            auto f = Simd::sub(m, one);
+            auto s = Simd::div(f, Simd::add(Simd::set1(2.0), f));
+            auto z = Simd::mul(s, s);
+            auto w = Simd::mul(z, z);
+            auto t1 = Simd::mul(w, Simd::add(Lg2, Simd::mul(w, Simd::add(Lg4, Simd::mul(w, Lg6)))));
+            auto t2 = Simd::mul(z, Simd::add(Lg1, Simd::mul(w, Simd::add(Lg3, Simd::mul(w,
+                                Simd::add(Lg5, Simd::mul(w, Lg7)))))));
+            auto R = Simd::add(t2, t1);
+            auto hfsq = Simd::mul(half, Simd::mul(f, f));
+            auto inner = Simd::add(Simd::mul(s, Simd::add(hfsq, R)), Simd::mul(k, ln2_lo));
+            return Simd::sub(Simd::mul(k, ln2_hi), Simd::sub(Simd::sub(hfsq, inner), f));
+        }
+
+        inline mask in_log_domain(vec x) {
+            return Simd::m_and(Simd::ge(x, Simd::set1(DBL_MIN)), Simd::le(x, Simd::set1(DBL_MAX)));
+        }
+
+        /*
+         * Runs kernel over full vectors of the input. The kernel returns its values and a mask of lanes it could
+         * not handle (edge cases of the statistic), which are recomputed with the scalar statistic. The tail that
+         * does not fill a vector is also scalar.
+         */
+        template <typename Stat, typename Kernel>
+        void evaluate_simd(const Stat& stat, Kernel kernel,
+                const double* m_sub, const double* b_sub, size_t n,
+                double m_total, double b_total,
+                double* out) {
+            size_t i = 0;
+            for (; i + Simd::width <= n; i += Simd::width) {
+                mask scalar_lanes;
+                Simd::store(out + i, kernel(Simd::load(m_sub + i), Simd::load(b_sub + i), scalar_lanes));
+                for (unsigned lanes = Simd::bits(scalar_lanes); lanes != 0; lanes &= lanes - 1) {
+                    size_t j = i + __builtin_ctz(lanes);
+                    out[j] = stat(m_sub[j], m_total, b_sub[j], b_total);
+                }
+            }
+            evaluate_scalar(stat, m_sub + i, b_sub + i, n - i, m_total, b_total, out + i);
+        }
+
+        void evaluate_kernel(const KulldorffStat& stat,
+                const double* m_sub, const double* b_sub, size_t n,
+                double m_total, double b_total,
+                double* out) {
+            const vec m_tot = Simd::set1(m_total), b_tot = Simd::set1(b_total);
+            const vec rho = Simd::set1(stat.rho), one_rho = Simd::set1(1 - stat.rho);
+            const vec zero = Simd::set1(0.0), one = Simd::set1(1.0);
+            const vec eps = Simd::set1(std::numeric_limits<double>::epsilon());
+            evaluate_simd(stat, [&](vec m, vec b, mask& scalar_lanes) {
+                auto mr = Simd::div(m, m_tot);
+                auto br = Simd::div(b, b_tot);
+                auto bounded = Simd::m_or(Simd::m_or(Simd::lt(mr, rho), Simd::lt(br, rho)),
+                                          Simd::m_or(Simd::gt(br, one_rho), Simd::gt(mr, one_rho)));
+                auto r1 = Simd::div(mr, br);
+                auto r2 = Simd::div(Simd::sub(one, mr), Simd::sub(one, br));
+                auto generic = Simd::m_and(Simd::m_and(Simd::gt(mr, zero), Simd::lt(mr, one)),
+                                           Simd::m_and(Simd::gt(br, zero), Simd::lt(br, one)));
+                generic = Simd::m_and(generic, Simd::gt(Simd::abs(Simd::sub(one, Simd::abs(r1))), eps));
+                generic = Simd::m_and(generic, Simd::m_and(in_log_domain(r1), in_log_domain(r2)));
+                scalar_lanes = Simd::m_not(Simd::m_or(bounded, generic));
+                auto val = Simd::add(Simd::mul(mr, simd_log(r1)), Simd::mul(Simd::sub(one, mr), simd_log(r2)));
+                return Simd::select(bounded, zero, val);
+            }, m_sub, b_sub, n, m_total, b_total, out);
+        }
+
+        void evaluate_kernel(const RegularizedKulldorffStat& stat,
+                const double* m_sub, const double* b_sub, size_t n,
+                double m_total, double b_total,
+                double* out) {
+            const vec m_tot = Simd::set1(m_total), b_tot = Simd::set1(b_total);
+            const vec rho = Simd::set1(stat.rho);
+            const vec zero = Simd::set1(0.0), one = Simd::set1(1.0);
+            evaluate_simd(stat, [&](vec m, vec b, mask& scalar_lanes) {
+                auto mr = Simd::div(m, m_tot);
+                auto br = Simd::div(b, b_tot);
+                auto r1 = Simd::div(mr, Simd::add(br, rho));
+                auto r2 = Simd::div(Simd::sub(one, mr), Simd::add(Simd::sub(one, br), rho));
+                // mr == 0 and mr == 1 are separate cases of the statistic.
+                auto generic = Simd::m_and(Simd::gt(mr, zero), Simd::lt(mr, one));
+                generic = Simd::m_and(generic, Simd::m_and(in_log_domain(r1), in_log_domain(r2)));
+                scalar_lanes = Simd::m_not(generic);
+                return Simd::add(Simd::mul(mr, simd_log(r1)), Simd::mul(Simd::sub(one, mr), simd_log(r2)));
+            }, m_sub, b_sub, n, m_total, b_total, out);
+        }
+
+        void evaluate_kernel(const GammaStat& stat,
+                const double* m_sub, const double* b_sub, size_t n,
+                double m_total, double b_total,
+                double* out) {
+            const vec m_tot = Simd::set1(m_total), b_tot = Simd::set1(b_total);
+            const vec rho = Simd::set1(stat.rho), one_rho = Simd::set1(1 - stat.rho);
+            const vec zero = Simd::set1(0.0), one = Simd::set1(1.0);
+            evaluate_simd(stat, [&](vec m, vec b, mask& scalar_lanes) {
+                auto mr = Simd::div(m, m_tot);
+                auto br = Simd::div(b, b_tot);
+                auto bounded = Simd::m_or(Simd::lt(br, rho), Simd::gt(br, one_rho));
+                auto generic = Simd::m_and(Simd::gt(br, zero), Simd::lt(br, one));
+                scalar_lanes = Simd::m_not(Simd::m_or(bounded, generic));
+                auto diff = Simd::sub(mr, br);
+                auto val = Simd::div(Simd::mul(diff, diff), Simd::mul(br, Simd::sub(one, br)));
+                return Simd::select(bounded, zero, val);
+            }, m_sub, b_sub, n, m_total, b_total, out);
+        }
+
+        void evaluate_kernel(const DiscStat& stat,
+                const double* m_sub, const double* b_sub, size_t n,
+                double m_total, double b_total,
+                double* out) {
+            const vec m_tot = Simd::set1(m_total), b_tot = Simd::set1(b_total);
+            evaluate_simd(stat, [&](vec m, vec b, mask& scalar_lanes) {
+                scalar_lanes = Simd::m_none();
+                return Simd::abs(Simd::sub(Simd::div(m, m_tot), Simd::div(b, b_tot)));
+            }, m_sub, b_sub, n, m_total, b_total, out);
+        }
+
+        void evaluate_kernel(const LinearStat& stat,
+                const double* m_sub, const double* b_sub, size_t n,
+                double m_total, double b_total,
+                double* out) {
+            const vec m_tot = Simd::set1(m_total), b_tot = Simd::set1(b_total);
+            const vec a = Simd::set1(stat.a), b_coef = Simd::set1(stat.b);
+            evaluate_simd(stat, [&](vec m, vec b, mask& scalar_lanes) {
+                scalar_lanes = Simd::m_none();
+                return Simd::add(Simd::div(Simd::mul(a, m), m_tot), Simd::div(Simd::mul(b_coef, b), b_tot));
+            }, m_sub, b_sub, n, m_total, b_total, out);
+        }
+
+        void evaluate_kernel(const BernoulliStat& stat,
+                const double* m_sub, const double* b_sub, size_t n,
+                double m_total, double b_total,
+                double* out) {
+            const vec m_tot = Simd::set1(m_total), b_tot = Simd::set1(b_total);
+            const vec one = Simd::set1(1.0);
+            // The terms that only depend on the totals.
+            const vec c1 = Simd::set1(m_total * log(m_total / (b_total + m_total)));
+            const vec c2 = Simd::set1(b_total * log(1 - m_total/ (m_total + b_total)));
+            evaluate_simd(stat, [&](vec m, vec b, mask& scalar_lanes) {
+                auto m_out = Simd::sub(m_tot, m);
+                auto b_out = Simd::sub(b_tot, b);
+                auto p = Simd::div(m, Simd::add(b, m));
+                auto q = Simd::div(m_out, Simd::sub(Simd::add(b_out, m_tot), m));
+                auto p1 = Simd::sub(one, p);
+                auto q1 = Simd::sub(one, q);
+                scalar_lanes = Simd::m_not(Simd::m_and(Simd::m_and(in_log_domain(p), in_log_domain(p1)),
+                                                       Simd::m_and(in_log_domain(q), in_log_domain(q1))));
+                auto val = Simd::add(Simd::mul(m, simd_log(p)), Simd::mul(b, simd_log(p1)));
+                val = Simd::add(val, Simd::mul(m_out, simd_log(q)));
+                val = Simd::add(val, Simd::mul(b_out, simd_log(q1)));
+                return Simd::sub(Simd::sub(val, c1), c2);
+            }, m_sub, b_sub, n, m_total, b_total, out);
+        }
+
+        void evaluate_kernel(const BernoulliSingleSampleStat& stat,
+                const double* m_sub, const double* b_sub, size_t n,
+                double m_total, double b_total,
+                double* out) {
+            const vec m_tot = Simd::set1(m_total), b_tot = Simd::set1(b_total);
+            const vec one = Simd::set1(1.0);
+            const vec b_m_tot = Simd::set1(b_total - m_total);
+            // The terms that only depend on the totals.
+            const vec c1 = Simd::set1(m_total * log(m_total / b_total));
+            const vec c2 = Simd::set1((b_total - m_total) * log(1 - m_total / b_total));
+            evaluate_simd(stat, [&](vec m, vec b, mask& scalar_lanes) {
+                auto m_out = Simd::sub(m_tot, m);
+                auto b_m = Simd::sub(b, m);
+                auto p = Simd::div(m, b);
+                auto q = Simd::div(m_out, Simd::sub(b_tot, b));
+                auto p1 = Simd::sub(one, p);
+                auto q1 = Simd::sub(one, q);
+                scalar_lanes = Simd::m_not(Simd::m_and(Simd::m_and(in_log_domain(p), in_log_domain(p1)),
+                                                       Simd::m_and(in_log_domain(q), in_log_domain(q1))));
+                auto val = Simd::add(Simd::mul(m, simd_log(p)), Simd::mul(b_m, simd_log(p1)));
+                val = Simd::add(val, Simd::mul(m_out, simd_log(q)));
+                val = Simd::add(val, Simd::mul(Simd::sub(b_m_tot, b_m), simd_log(q1)));
+                return Simd::sub(Simd::sub(val, c1), c2);
+            }, m_sub, b_sub, n, m_total, b_total, out);
+        }
+#endif
+
+        //Statistics without a vector kernel (or builds without a vector unit) get a loop with the statistic inlined.
+        template <typename Stat>
+        void evaluate_kernel(const Stat& stat,
+                const double* m_sub, const double* b_sub, size_t n,
+                double m_total, double b_total,
+                double* out) {
+            evaluate_scalar(stat, m_sub, b_sub, n, m_total, b_total, out);
+        }
+    }
+
+    void evaluate_batch(const discrepancy_func_t& f,
+            const double* m_sub, const double* b_sub, size_t n,
+            double m_total, double b_total,
+            double* out) {
+        dispatch_statistic(f, [&](auto const& stat) {
+            evaluate_kernel(stat, m_sub, b_sub, n, m_total, b_total, out);
+        });
+    }
+
+    template <typename Stat>
+    void evaluate_batch(const Stat& stat,
+            const double* m_sub, const double* b_sub, size_t n,
+            double m_total, double b_total,
+            double* out) {
+        evaluate_kernel(stat, m_sub, b_sub, n, m_total, b_total, out);
+    }
+
+    template void evaluate_batch(const KulldorffStat&, const double*, const double*, size_t, double, double, double*);
+    template void evaluate_batch(const RegularizedKulldorffStat&, const double*, const double*, size_t, double, double, double*);
+    template void evaluate_batch(const GammaStat&, const double*, const double*, size_t, double, double, double*);
+    template void evaluate_batch(const DiscStat&, const double*, const double*, size_t, double, double, double*);
+    template void evaluate_batch(const LinearStat&, const double*, const double*, size_t, double, double, double*);
+    template void evaluate_batch(const BernoulliStat&, const double*, const double*, size_t, double, double, double*);
+    template void evaluate_batch(const BernoulliSingleSampleStat&, const double*, const double*, size_t, double, double, double*);
+
+    void evaluate_batch(const std::function<double(double, double)>& f,
+            const double* m_sub, const double* b_sub, size_t n,
+            double* out) {
+        if (auto bound = f.target<BoundStatistic>()) {
+            bound->evaluate(m_sub, b_sub, n, out);
+        } else {
+            for (size_t i = 0; i < n; ++i) {
+                out[i] = f(m_sub[i], b_sub[i]);
+            }
+        }
+    }
+}
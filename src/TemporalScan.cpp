@@ -0,0 +1,140 @@
+#include <numeric>
+
+#include "DiskScan.hpp"
+#include "PointArray.hpp"
+#include "TemporalScan.hpp"
+
+namespace pyscan {
+
+    /*
+     * The indices of the points in increasing time order. Every window is a contiguous range of this order and both
+     * ends of the range only move forward as the window slides.
+     */
+    static std::vector<size_t> time_order(const tpoint_list_t &pts) {
+        std::vector<size_t> order(pts.size());
+        std::iota(order.begin(), order.end(), 0);
+        std::stable_sort(order.begin(), order.end(), [&](size_t i, size_t j) {
+            return pts[i].get_time() < pts[j].get_time();
+        });
+        return order;
+    }
+
+    static std::vector<double> window_starts(const tpoint_list_t &red, const tpoint_list_t &blue, double stride) {
+        assert(stride > 0);
+        std::vector<double> starts;
+        if (red.empty() && blue.empty()) {
+            return starts;
+        }
+        double t_min = std::numeric_limits<double>::infinity();
+        double t_max = -std::numeric_limits<double>::infinity();
+        for (auto const *pts : {&red, &blue}) {
+            for (auto &pt : *pts) {
+                t_min = std::min(t_min, pt.get_time());
+                t_max = std::max(t_max, pt.get_time());
+            }
+        }
+        for (size_t k = 0; t_min + k * stride <= t_max; ++k) {
+            starts.emplace_back(t_min + k * stride);
+        }
+        return starts;
+    }
+
+    /*
+     * Tracks the range [begin, end) of the time order that lies in the current window.
+     */
+    struct WindowRange {
+        const tpoint_list_t &pts;
+        std::vector<size_t> order;
+        size_t begin = 0;
+        size_t end = 0;
+
+        explicit WindowRange(const tpoint_list_t &pts) : pts(pts), order(time_order(pts)) {}
+
+        inline double time(size_t i) const {
+            return pts[order[i]].get_time();
+        }
+
+        /*
+         * Moves the range to [t0, t1) and collects the points that left it and the points that entered it.
+         */
+        void slide(double t0, double t1, PointArray &leaving, PointArray &entering) {
+            leaving.clear();
+            entering.clear();
+            for (; begin < order.size() && time(begin) < t0; ++begin) {
+                // Points past the old end were skipped over entirely by a stride longer than the window.
+                if (begin < end) {
+                    auto &pt = pts[order[begin]];
+                    leaving.push_back(pt(0), pt(1), pt.get_weight());
+                }
+            }
+            end = std::max(end, begin);
+            for (; end < order.size() && time(end) < t1; ++end) {
+                auto &pt = pts[order[end]];
+                entering.push_back(pt(0), pt(1), pt.get_weight());
+            }
+        }
+    };
+
+    std::vector<std::tuple<double, Disk, double>> max_disk_scale_windows(
+            const point_list_t &point_net,
+            const tpoint_list_t &red,
+            const tpoint_list_t &blue,
+            double min_res,
+            double window,
+            double stride,
+            const discrepancy_func_t &f,
+            size_t threads) {
+
+        assert(window > 0);
+        std::vector<std::tuple<double, Disk, double>> results;
+        DiskScanner scanner(point_net, min_res, f, threads);
+        WindowRange red_range(red), blue_range(blue);
+        PointArray red_out, red_in, blue_out, blue_in;
+        for (double t : window_starts(red, blue, stride)) {
+            red_range.slide(t, t + window, red_out, red_in);
+            blue_range.slide(t, t + window, blue_out, blue_in);
+            scanner.update(red_in, blue_in, red_out, blue_out);
+            auto [disk, value] = scanner.current_max();
+            results.emplace_back(t, disk, value);
+        }
+        return results;
+    }
+
+    std::vector<std::tuple<double, Rectangle, double>> max_rectangle_windows(
+            const tpoint_list_t &red,
+            const tpoint_list_t &blue,
+            double eps,
+            double a,
+            double b,
+            double window,
+            double stride) {
+
+        assert(window > 0);
+        std::vector<std::tuple<double, Rectangle, double>> results;
+        auto [m_pts, b_pts, xmap, ymap] = to_epoints(wpoint_list_t(red.begin(), red.end()),
+                                                     wpoint_list_t(blue.begin(), blue.end()));
+        WindowRange red_range(red), blue_range(blue);
+        PointArray red_out, red_in, blue_out, blue_in;
+        epoint_list_t m_window, b_window;
+        for (double t : window_starts(red, blue, stride)) {
+            red_range.slide(t, t + window, red_out, red_in);
+            blue_range.slide(t, t + window, blue_out, blue_in);
+            if (red_range.begin == red_range.end || blue_range.begin == blue_range.end) {
+                results.emplace_back(t, Rectangle(), 0.0);
+                continue;
+            }
+            m_window.clear();
+            b_window.clear();
+            for (size_t i = red_range.begin; i < red_range.end; ++i) {
+                m_window.emplace_back(m_pts[red_range.order[i]]);
+            }
+            for (size_t i = blue_range.begin; i < blue_range.end; ++i) {
+                b_window.emplace_back(b_pts[blue_range.order[i]]);
+            }
+            auto [max_rect, max_v] = max_erectangle(m_window, b_window, eps, a, b);
+            results.emplace_back(t, Rectangle(xmap[max_rect.upX()], ymap[max_rect.upY()],
+                                              xmap[max_rect.lowX()], ymap[max_rect.lowY()]), max_v);
+        }
+        return results;
+    }
+}
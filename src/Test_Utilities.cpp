@@ -117,6 +117,20 @@ namespace pyscantest {
     }
 
 
+    auto randomTPoints2(size_t test_size, double max_time) -> std::vector<pyscan::TPoint<2>> {
+        std::random_device rd;
+        std::default_random_engine generator(rd());
+        std::uniform_real_distribution<double> distribution (0.0, 1.0);
+
+        std::vector<pyscan::TPoint<2>> points;
+        for (size_t i = 0; i < test_size; i++) {
+            double x = distribution(generator);
+            double y = distribution(generator);
+            points.emplace_back(max_time * distribution(generator), 1.0, x, y, 1.0);
+        }
+        return points;
+    }
+
     auto randomLPoints2(size_t test_size, size_t label_count) -> std::vector<pyscan::LPoint<2>> {
         return randomLPoints<2>(test_size, label_count);
     }
@@ -7,6 +7,7 @@
 #include <typeinfo>
 
 #include <pybind11/pybind11.h>
+#include <pybind11/numpy.h>
 #include <pybind11/stl.h>
 
 #include "KernelScanning.hpp"
@@ -22,8 +23,13 @@
 #include "ConvexHull.hpp"
 #include "TrajectoryCoreSet.hpp"
 #include "PartitionSample.hpp"
+#include "PermutationTest.hpp"
 #include "RegionCoreSet.hpp"
 #include "SatScan.hpp"
+#include "TemporalScan.hpp"
+#include "Statistics.hpp"
+#include "BatchEvaluate.hpp"
+#include "RangeIndex.hpp"
 
 
 #define PY_WRAP(FNAME) py::def("FNAME", &pyscan:: FNAME)
@@ -31,6 +37,135 @@
 namespace py = pybind11;
 
 
+namespace pybind11 { namespace detail {
+
+    /*
+     * How a point is built from one row of the numpy arrays. Extra is the type of the third array, the labels of
+     * an LPoint or the times of a TPoint.
+     */
+    template <typename Pt>
+    struct array_point;
+
+    template <>
+    struct array_point<pyscan::Point<2>> {
+        using extra_t = double;
+        static pyscan::Point<2> make(size_t, double x, double y, const double*, const extra_t*) {
+            return pyscan::Point<2>(x, y, 1.0);
+        }
+    };
+
+    template <>
+    struct array_point<pyscan::WPoint<2>> {
+        using extra_t = double;
+        static pyscan::WPoint<2> make(size_t i, double x, double y, const double* w, const extra_t*) {
+            return pyscan::WPoint<2>(w == nullptr ? 1.0 : w[i], x, y, 1.0);
+        }
+    };
+
+    template <>
+    struct array_point<pyscan::LPoint<2>> {
+        using extra_t = int64_t;
+        //Without labels every point is its own label.
+        static pyscan::LPoint<2> make(size_t i, double x, double y, const double* w, const extra_t* labels) {
+            return pyscan::LPoint<2>(labels == nullptr ? i : static_cast<size_t>(labels[i]),
+                                     w == nullptr ? 1.0 : w[i], x, y, 1.0);
+        }
+    };
+
+    template <>
+    struct array_point<pyscan::TPoint<2>> {
+        using extra_t = double;
+        static pyscan::TPoint<2> make(size_t i, double x, double y, const double* w, const extra_t* times) {
+            return pyscan::TPoint<2>(times == nullptr ? 0.0 : times[i], w == nullptr ? 1.0 : w[i], x, y, 1.0);
+        }
+    };
+
+    /*
+     * Point lists load from a sequence of point objects as before, or straight from numpy arrays without creating
+     * a python object per point:
+     *   xy                      an N x 2 array of coordinates
+     *   (xy, weights)           weights is an array of N weights, or None for all ones
+     *   (xy, weights, extra)    extra is N integer labels for labeled points or N times for timestamped points
+     * Any array that is not already C contiguous with the right dtype is converted by numpy first.
+     */
+    template <typename List>
+    class point_array_caster : public list_caster<List, typename List::value_type> {
+        using base = list_caster<List, typename List::value_type>;
+        using pt_t = typename List::value_type;
+        using extra_t = typename array_point<pt_t>::extra_t;
+
+    public:
+        bool load(handle src, bool convert) {
+            if (isinstance<array>(src)) {
+                return load_arrays(src, none(), none());
+            }
+            if (isinstance<tuple>(src)) {
+                auto parts = reinterpret_borrow<tuple>(src);
+                if (parts.size() >= 1 && parts.size() <= 3 && isinstance<array>(parts[0])) {
+                    return load_arrays(parts[0],
+                                       parts.size() > 1 ? object(parts[1]) : none(),
+                                       parts.size() > 2 ? object(parts[2]) : none());
+                }
+            }
+            return base::load(src, convert);
+        }
+
+    private:
+        bool load_arrays(handle xy_obj, object w_obj, object extra_obj) {
+            using dense_t = array_t<double, array::c_style | array::forcecast>;
+            using extra_array_t = array_t<extra_t, array::c_style | array::forcecast>;
+
+            auto xy = dense_t::ensure(xy_obj);
+            if (!xy || xy.ndim() != 2 || xy.shape(1) != 2) {
+                return false;
+            }
+            size_t n = static_cast<size_t>(xy.shape(0));
+
+            const double* w_data = nullptr;
+            dense_t weights;
+            if (!w_obj.is_none()) {
+                weights = dense_t::ensure(w_obj);
+                if (!weights || weights.ndim() != 1 || static_cast<size_t>(weights.shape(0)) != n) {
+                    return false;
+                }
+                w_data = weights.data();
+            }
+            const extra_t* extra_data = nullptr;
+            extra_array_t extra;
+            if (!extra_obj.is_none()) {
+                extra = extra_array_t::ensure(extra_obj);
+                if (!extra || extra.ndim() != 1 || static_cast<size_t>(extra.shape(0)) != n) {
+                    return false;
+                }
+                extra_data = extra.data();
+            }
+
+            const double* xy_data = xy.data();
+            //The arrays stay alive in this frame, so the copy into the point list does not need the GIL.
+            gil_scoped_release release;
+            this->value.clear();
+            this->value.reserve(n);
+            for (size_t i = 0; i < n; i++) {
+                this->value.push_back(array_point<pt_t>::make(i, xy_data[2 * i], xy_data[2 * i + 1], w_data, extra_data));
+            }
+            return true;
+        }
+    };
+
+    template <>
+    struct type_caster<pyscan::point_list_t> : point_array_caster<pyscan::point_list_t> {};
+
+    template <>
+    struct type_caster<pyscan::wpoint_list_t> : point_array_caster<pyscan::wpoint_list_t> {};
+
+    template <>
+    struct type_caster<pyscan::lpoint_list_t> : point_array_caster<pyscan::lpoint_list_t> {};
+
+    template <>
+    struct type_caster<pyscan::tpoint_list_t> : point_array_caster<pyscan::tpoint_list_t> {};
+}}
+
+
 namespace pyscan {
 
     pyscan::Segment to_Segment(Point<2> const& pt) {
@@ -55,9 +190,7 @@ namespace pyscan {
          * Useful for finding a region of a certain size.
          */
 
-        return [a, b] (double mv, double m_total, double bv, double b_total) {
-            return a * mv / m_total + b * bv / b_total;
-        };
+        return LinearStat{a, b};
     }
 
     std::function<double(double, double)> rho_f(std::function<double(double, double, double)> const& f, double rho) {
@@ -119,6 +252,53 @@ double evaluate_halfplane_labeled(pyscan::halfspace2_t const& d1, pyscan::lpoint
     return pyscan::evaluate_range(d1, mpts, bpts, disc);
 }
 
+/*
+ * Hands a vector to numpy without copying it. The array owns the vector through a capsule.
+ */
+template <typename T>
+py::array_t<T> to_numpy(std::vector<T>&& values) {
+    auto owner = new std::vector<T>(std::move(values));
+    py::capsule free_owner(owner, [](void* p) { delete reinterpret_cast<std::vector<T>*>(p); });
+    return py::array_t<T>(owner->size(), owner->data(), free_owner);
+}
+
+template <typename R, typename P>
+py::array_t<double> evaluate_ranges_np(std::vector<R> const& ranges, P const& mpts, P const& bpts, pyscan::discrepancy_func_t const& disc,
+        size_t threads) {
+    std::vector<double> values;
+    {
+        py::gil_scoped_release release;
+        values = pyscan::evaluate_ranges(ranges, mpts, bpts, disc, threads);
+    }
+    return to_numpy(std::move(values));
+}
+
+/*
+ * The per center best disks of satscan_grid as a (columns, rows, 4) array of x, y, radius and statistic. The array
+ * is allocated up front and filled in place without the GIL.
+ */
+py::array_t<double> satscan_grid_profile_np(pyscan::PointArray const& mpts, pyscan::PointArray const& bpts,
+        double grid_res, double disk_r, pyscan::discrepancy_func_t const& disc, size_t threads) {
+    auto [cols, rows] = pyscan::satscan_grid_shape(mpts, bpts, grid_res, disk_r);
+    py::array_t<double> profile(std::vector<size_t>{cols, rows, 4});
+    double* out = profile.mutable_data();
+    {
+        py::gil_scoped_release release;
+        pyscan::satscan_grid_profile(mpts, bpts, grid_res, disk_r, disc, out, threads);
+    }
+    return profile;
+}
+
+template <typename R>
+py::array_t<size_t> spatial_inside_np(pyscan::SpatialIndex const& index, R const& range) {
+    std::vector<size_t> found;
+    {
+        py::gil_scoped_release release;
+        found = index.inside(range);
+    }
+    return to_numpy(std::move(found));
+}
+
 
 
 PYBIND11_MODULE(libpyscan, pyscan_module){
@@ -251,13 +431,23 @@ PYBIND11_MODULE(libpyscan, pyscan_module){
 //    pyscan_module.def("max_annuli_scale_multi", &pyscan::max_annuli_scale_multi);
 
 //    py::class_<pyscan::Bernoulli_Disk>(pyscan_module, "Bernoulli");
-    pyscan_module.def("max_kernel", &pyscan::max_kernel);
-    pyscan_module.def("max_kernel_prune_far", &pyscan::max_kernel_prune_far);
-    pyscan_module.def("max_kernel_adaptive", &pyscan::max_kernel_adaptive);
-    pyscan_module.def("max_kernel_slow2", &pyscan::max_kernel_slow2);
-
-    pyscan_module.def("max_kernel_slow", &pyscan::max_kernel_slow);
-    pyscan_module.def("measure_kernel", &pyscan::measure_kernel);
+    pyscan_module.def("max_kernel", &pyscan::max_kernel,
+            py::call_guard<py::gil_scoped_release>());
+    pyscan_module.def("max_kernel_prune_far", &pyscan::max_kernel_prune_far,
+            py::call_guard<py::gil_scoped_release>());
+    pyscan_module.def("max_kernel_adaptive", &pyscan::max_kernel_adaptive,
+            py::call_guard<py::gil_scoped_release>());
+    pyscan_module.def("max_kernel_slow2", &pyscan::max_kernel_slow2,
+            py::call_guard<py::gil_scoped_release>());
+
+    pyscan_module.def("max_kernel_slow", &pyscan::max_kernel_slow,
+            py::call_guard<py::gil_scoped_release>());
+    pyscan_module.def("measure_kernel", &pyscan::measure_kernel,
+            py::call_guard<py::gil_scoped_release>());
+    pyscan_module.def("max_kernel_truncated", &pyscan::max_kernel_truncated,
+            py::arg("measured"), py::arg("baseline"), py::arg("grid_res"), py::arg("radius_size"),
+            py::arg("bandwidth"), py::arg("cutoff"),
+            py::call_guard<py::gil_scoped_release>());
 
 //    pyscan_module.attr("GAUSSIAN_KERNEL") = pyscan::kernel_func_t(
 //            [](double dist, double bandwidth) {
@@ -318,6 +508,10 @@ PYBIND11_MODULE(libpyscan, pyscan_module){
         .def(py::init<size_t, double, double, double, double>())
         .def("get_label", &pyscan::LPoint<2>::get_label);
 
+    py::class_<pyscan::TPoint<2>, pyscan::WPoint<2>>(pyscan_module, "TPoint")
+        .def(py::init<double, double, double, double, double>())
+        .def("get_time", &pyscan::TPoint<2>::get_time);
+
     py::class_<pyscan::WPoint<3>, pyscan::Point<3>>(pyscan_module, "WPoint3")
         .def(py::init<double, double, double, double, double>())
         .def("get_weight", &pyscan::WPoint<3>::get_weight);
@@ -326,22 +520,28 @@ PYBIND11_MODULE(libpyscan, pyscan_module){
         .def(py::init<size_t, double, double, double, double, double>())
         .def("get_label", &pyscan::LPoint<3>::get_label);
 
+    py::class_<pyscan::PointArray>(pyscan_module, "PointArray")
+        .def(py::init<pyscan::wpoint_list_t const&>())
+        .def(py::init<pyscan::lpoint_list_t const&>())
+        .def(py::init<std::vector<double>, std::vector<double>, std::vector<double>>())
+        .def(py::init<std::vector<double>, std::vector<double>, std::vector<double>, std::vector<size_t>>())
+        .def("__len__", &pyscan::PointArray::size)
+        .def("has_labels", &pyscan::PointArray::has_labels)
+        .def("to_wpoints", &pyscan::PointArray::to_wpoints)
+        .def("to_lpoints", &pyscan::PointArray::to_lpoints)
+        .def_readonly("x", &pyscan::PointArray::x)
+        .def_readonly("y", &pyscan::PointArray::y)
+        .def_readonly("w", &pyscan::PointArray::w)
+        .def_readonly("label", &pyscan::PointArray::label);
+
     py::class_<pyscan::discrepancy_func_t >(pyscan_module, "CFunction");
 
-    pyscan_module.attr("KULLDORF") = pyscan::discrepancy_func_t(
-        [&](double m, double m_tot, double b, double b_tot) {
-            return pyscan::kulldorff(m / m_tot, b / b_tot, .0001);
-    });
+    //These are built from the statistic structs so the scans can find their batch kernels.
+    pyscan_module.attr("KULLDORF") = pyscan::discrepancy_func_t(pyscan::KulldorffStat{.0001});
 
-    pyscan_module.attr("DISC") = pyscan::discrepancy_func_t (
-        [&](double m, double m_tot, double b, double b_tot) {
-            return std::abs(m / m_tot - b / b_tot);
-    });
+    pyscan_module.attr("DISC") = pyscan::discrepancy_func_t(pyscan::DiscStat{});
 
-    pyscan_module.attr("RKULLDORF") = pyscan::discrepancy_func_t(
-        [&](double m, double m_tot, double b, double b_tot) {
-            return pyscan::regularized_kulldorff(m / m_tot, b / b_tot, .0001);
-    });
+    pyscan_module.attr("RKULLDORF") = pyscan::discrepancy_func_t(pyscan::RegularizedKulldorffStat{.0001});
 
     pyscan_module.def("bernoulli", pyscan::get_bernoulli);
     pyscan_module.def("rbernoulli", pyscan::get_bernoulli_single_sample);
@@ -354,24 +554,56 @@ PYBIND11_MODULE(libpyscan, pyscan_module){
     pyscan_module.def("correct_orientation", &pyscan::correct_orientation);
 
 
-    pyscan_module.def("max_subgrid", &pyscan::max_subgrid);
-    pyscan_module.def("max_subgrid_convex", &pyscan::max_subgrid_convex);
-    pyscan_module.def("max_subgrid_linear", &pyscan::max_subgrid_linear);
-    pyscan_module.def("max_rectangle", &pyscan::max_rectangle);
-
-    pyscan_module.def("make_net_grid", &pyscan::make_net_grid);
-    pyscan_module.def("make_exact_grid", &pyscan::make_exact_grid);
+    pyscan_module.def("max_subgrid", &pyscan::max_subgrid,
+            py::arg("grid"), py::arg("disc"), py::arg("threads") = 1,
+            py::call_guard<py::gil_scoped_release>());
+    pyscan_module.def("max_subgrid_convex", &pyscan::max_subgrid_convex,
+            py::arg("grid"), py::arg("eps"), py::arg("disc"), py::arg("threads") = 1,
+            py::call_guard<py::gil_scoped_release>());
+    pyscan_module.def("max_subgrid_linear",
+            py::overload_cast<const pyscan::Grid&, double, double>(&pyscan::max_subgrid_linear),
+            py::call_guard<py::gil_scoped_release>());
+    pyscan_module.def("max_subgrid_linear",
+            py::overload_cast<const pyscan::Grid&, const std::vector<std::tuple<double, double>>&>(
+                    &pyscan::max_subgrid_linear),
+            py::call_guard<py::gil_scoped_release>());
+    pyscan_module.def("max_rectangle", &pyscan::max_rectangle,
+            py::arg("red"), py::arg("blue"), py::arg("eps"), py::arg("a"), py::arg("b"), py::arg("threads") = 1,
+            py::call_guard<py::gil_scoped_release>());
+
+    pyscan_module.def("make_net_grid", &pyscan::make_net_grid,
+            py::call_guard<py::gil_scoped_release>());
+    pyscan_module.def("make_exact_grid", &pyscan::make_exact_grid,
+            py::call_guard<py::gil_scoped_release>());
 
     //Max Halfspace codes
-    pyscan_module.def("max_halfplane", &pyscan::max_halfplane);
-    pyscan_module.def("max_halfplane_labeled", &pyscan::max_halfplane_labeled);
-    pyscan_module.def("max_halfspace", &pyscan::max_halfspace);
-    pyscan_module.def("max_halfspace_labeled", &pyscan::max_halfspace_labeled);
+    pyscan_module.def("max_halfplane",
+            py::overload_cast<const pyscan::point_list_t&, const pyscan::wpoint_list_t&, const pyscan::wpoint_list_t&,
+                    const pyscan::discrepancy_func_t&, size_t>(&pyscan::max_halfplane),
+            py::arg("net"), py::arg("red"), py::arg("blue"), py::arg("disc"), py::arg("threads") = 1,
+            py::call_guard<py::gil_scoped_release>());
+    pyscan_module.def("max_halfplane",
+            py::overload_cast<const pyscan::point_list_t&, const pyscan::PointArray&, const pyscan::PointArray&,
+                    const pyscan::discrepancy_func_t&, size_t>(&pyscan::max_halfplane),
+            py::arg("net"), py::arg("red"), py::arg("blue"), py::arg("disc"), py::arg("threads") = 1,
+            py::call_guard<py::gil_scoped_release>());
+    pyscan_module.def("max_halfplane_labeled", &pyscan::max_halfplane_labeled,
+            py::arg("net"), py::arg("red"), py::arg("blue"), py::arg("disc"), py::arg("threads") = 1,
+            py::call_guard<py::gil_scoped_release>());
+    pyscan_module.def("max_halfspace", &pyscan::max_halfspace,
+            py::arg("net"), py::arg("red"), py::arg("blue"), py::arg("disc"), py::arg("threads") = 1,
+            py::call_guard<py::gil_scoped_release>());
+    pyscan_module.def("max_halfspace_labeled", &pyscan::max_halfspace_labeled,
+            py::arg("net"), py::arg("red"), py::arg("blue"), py::arg("disc"), py::arg("threads") = 1,
+            py::call_guard<py::gil_scoped_release>());
     //pyscan_module.def("max_halfplane_fast", &pyscan::max_halfplane_fast);
-    pyscan_module.def("ham_tree_sample", &pyscan::ham_tree_sample);
+    pyscan_module.def("ham_tree_sample", &pyscan::ham_tree_sample,
+            py::call_guard<py::gil_scoped_release>());
 
-    pyscan_module.def("max_disk", &pyscan::max_disk);
-    pyscan_module.def("max_disk_labeled", &pyscan::max_disk_labeled);
+    pyscan_module.def("max_disk", &pyscan::max_disk,
+            py::call_guard<py::gil_scoped_release>());
+    pyscan_module.def("max_disk_labeled", &pyscan::max_disk_labeled,
+            py::call_guard<py::gil_scoped_release>());
     //pyscan_module.def("max_disk_lift_labeled", &pyscan::max_disk_labeled);
 
 
@@ -388,66 +620,245 @@ PYBIND11_MODULE(libpyscan, pyscan_module){
     pyscan_module.def("evaluate_rectangle_labeled", &evaluate_rectangle_labeled);
     pyscan_module.def("evaluate_rectangle_trajectory", &evaluate_rectangle_traj);
 
+    //Batch evaluation of many ranges against one point set, returned as a numpy array.
+    pyscan_module.def("evaluate_disks", &evaluate_ranges_np<pyscan::Disk, pyscan::wpoint_list_t>,
+            py::arg("ranges"), py::arg("red"), py::arg("blue"), py::arg("disc"), py::arg("threads") = 1);
+    pyscan_module.def("evaluate_disks_labeled", &evaluate_ranges_np<pyscan::Disk, pyscan::lpoint_list_t>,
+            py::arg("ranges"), py::arg("red"), py::arg("blue"), py::arg("disc"), py::arg("threads") = 1);
+    pyscan_module.def("evaluate_disks_trajectory", &evaluate_ranges_np<pyscan::Disk, pyscan::trajectory_set_t>,
+            py::arg("ranges"), py::arg("red"), py::arg("blue"), py::arg("disc"), py::arg("threads") = 1);
+    pyscan_module.def("evaluate_rectangles", &evaluate_ranges_np<pyscan::Rectangle, pyscan::wpoint_list_t>,
+            py::arg("ranges"), py::arg("red"), py::arg("blue"), py::arg("disc"), py::arg("threads") = 1);
+    pyscan_module.def("evaluate_rectangles_labeled", &evaluate_ranges_np<pyscan::Rectangle, pyscan::lpoint_list_t>,
+            py::arg("ranges"), py::arg("red"), py::arg("blue"), py::arg("disc"), py::arg("threads") = 1);
+    pyscan_module.def("evaluate_rectangles_trajectory", &evaluate_ranges_np<pyscan::Rectangle, pyscan::trajectory_set_t>,
+            py::arg("ranges"), py::arg("red"), py::arg("blue"), py::arg("disc"), py::arg("threads") = 1);
+    pyscan_module.def("evaluate_halfplanes", &evaluate_ranges_np<pyscan::halfspace2_t, pyscan::wpoint_list_t>,
+            py::arg("ranges"), py::arg("red"), py::arg("blue"), py::arg("disc"), py::arg("threads") = 1);
+    pyscan_module.def("evaluate_halfplanes_labeled", &evaluate_ranges_np<pyscan::halfspace2_t, pyscan::lpoint_list_t>,
+            py::arg("ranges"), py::arg("red"), py::arg("blue"), py::arg("disc"), py::arg("threads") = 1);
+    pyscan_module.def("evaluate_halfplanes_trajectory", &evaluate_ranges_np<pyscan::halfspace2_t, pyscan::trajectory_set_t>,
+            py::arg("ranges"), py::arg("red"), py::arg("blue"), py::arg("disc"), py::arg("threads") = 1);
+
+
+    //A static index for repeated range counting over one point or trajectory set.
+    py::class_<pyscan::SpatialIndex>(pyscan_module, "SpatialIndex")
+            .def(py::init<const pyscan::wpoint_list_t&>(), py::arg("points"),
+                    py::call_guard<py::gil_scoped_release>())
+            .def(py::init<const pyscan::point_list_t&>(), py::arg("points"),
+                    py::call_guard<py::gil_scoped_release>())
+            .def(py::init<const pyscan::trajectory_set_t&>(), py::arg("trajectories"),
+                    py::call_guard<py::gil_scoped_release>())
+            .def("weight", py::overload_cast<const pyscan::Disk&>(&pyscan::SpatialIndex::weight, py::const_),
+                    py::call_guard<py::gil_scoped_release>())
+            .def("weight", py::overload_cast<const pyscan::Rectangle&>(&pyscan::SpatialIndex::weight, py::const_),
+                    py::call_guard<py::gil_scoped_release>())
+            .def("weight", py::overload_cast<const pyscan::halfspace2_t&>(&pyscan::SpatialIndex::weight, py::const_),
+                    py::call_guard<py::gil_scoped_release>())
+            .def("count", py::overload_cast<const pyscan::Disk&>(&pyscan::SpatialIndex::count, py::const_),
+                    py::call_guard<py::gil_scoped_release>())
+            .def("count", py::overload_cast<const pyscan::Rectangle&>(&pyscan::SpatialIndex::count, py::const_),
+                    py::call_guard<py::gil_scoped_release>())
+            .def("count", py::overload_cast<const pyscan::halfspace2_t&>(&pyscan::SpatialIndex::count, py::const_),
+                    py::call_guard<py::gil_scoped_release>())
+            .def("inside", &spatial_inside_np<pyscan::Disk>)
+            .def("inside", &spatial_inside_np<pyscan::Rectangle>)
+            .def("inside", &spatial_inside_np<pyscan::halfspace2_t>)
+            .def("get_total_weight", &pyscan::SpatialIndex::get_total_weight)
+            .def("__len__", &pyscan::SpatialIndex::size);
 
 //    pyscan_module.def("max_disk_cached", &pyscan::max_disk_cached);
 //    pyscan_module.def("max_disk_cached_labeled", &pyscan::max_disk_cached_labeled);
 
-    pyscan_module.def("max_disk_scale", &pyscan::max_disk_scale);
-    pyscan_module.def("max_disk_scale_labeled", &pyscan::max_disk_scale_labeled);
-    pyscan_module.def("max_disk_scale_labeled_alt", &pyscan::max_disk_scale_labeled_alt);
-
-    pyscan_module.def("max_rect_labeled", &pyscan::max_rect_labeled);
-    pyscan_module.def("max_rectangle", &pyscan::max_rectangle);
-
-
-    pyscan_module.def("max_rect_labeled_scale", pyscan::max_rect_labeled_scale);
-
-
-    pyscan_module.def("max_disk_traj_grid", &pyscan::max_disk_traj_grid);
+    // The worker threads never touch python objects, so the GIL is released while they run.
+    pyscan_module.def("max_disk_scale",
+            py::overload_cast<const pyscan::point_list_t&, const pyscan::wpoint_list_t&, const pyscan::wpoint_list_t&,
+                    double, const pyscan::discrepancy_func_t&, size_t>(&pyscan::max_disk_scale),
+            py::arg("net"), py::arg("red"), py::arg("blue"), py::arg("min_res"), py::arg("disc"),
+            py::arg("threads") = 1,
+            py::call_guard<py::gil_scoped_release>());
+    pyscan_module.def("max_disk_scale",
+            py::overload_cast<const pyscan::point_list_t&, const pyscan::PointArray&, const pyscan::PointArray&,
+                    double, const pyscan::discrepancy_func_t&, size_t>(&pyscan::max_disk_scale),
+            py::arg("net"), py::arg("red"), py::arg("blue"), py::arg("min_res"), py::arg("disc"),
+            py::arg("threads") = 1,
+            py::call_guard<py::gil_scoped_release>());
+    py::class_<pyscan::DiskScanner>(pyscan_module, "DiskScanner")
+            .def(py::init<const pyscan::point_list_t&, double, pyscan::discrepancy_func_t, size_t>(),
+                    py::arg("net"), py::arg("min_res"), py::arg("disc"), py::arg("threads") = 1)
+            .def("insert",
+                    py::overload_cast<const pyscan::wpoint_list_t&, const pyscan::wpoint_list_t&>(
+                            &pyscan::DiskScanner::insert),
+                    py::arg("red"), py::arg("blue"),
+                    py::call_guard<py::gil_scoped_release>())
+            .def("insert",
+                    py::overload_cast<const pyscan::PointArray&, const pyscan::PointArray&>(
+                            &pyscan::DiskScanner::insert),
+                    py::arg("red"), py::arg("blue"),
+                    py::call_guard<py::gil_scoped_release>())
+            .def("remove",
+                    py::overload_cast<const pyscan::wpoint_list_t&, const pyscan::wpoint_list_t&>(
+                            &pyscan::DiskScanner::remove),
+                    py::arg("red"), py::arg("blue"),
+                    py::call_guard<py::gil_scoped_release>())
+            .def("remove",
+                    py::overload_cast<const pyscan::PointArray&, const pyscan::PointArray&>(
+                            &pyscan::DiskScanner::remove),
+                    py::arg("red"), py::arg("blue"),
+                    py::call_guard<py::gil_scoped_release>())
+            .def("update", &pyscan::DiskScanner::update,
+                    py::arg("new_red"), py::arg("new_blue"), py::arg("old_red"), py::arg("old_blue"),
+                    py::call_guard<py::gil_scoped_release>())
+            .def("current_max", &pyscan::DiskScanner::current_max)
+            .def("red_total", &pyscan::DiskScanner::get_red_total)
+            .def("blue_total", &pyscan::DiskScanner::get_blue_total);
+    // Null distributions for significance testing, computed without going back through python per replicate.
+    pyscan_module.def("permutation_test_rectangle", &pyscan::permutation_test_rectangle,
+            py::arg("red"), py::arg("blue"), py::arg("eps"), py::arg("a"), py::arg("b"), py::arg("replicates"),
+            py::arg("seed") = 0, py::arg("threads") = 1,
+            py::call_guard<py::gil_scoped_release>());
+    pyscan_module.def("permutation_test_disk", &pyscan::permutation_test_disk,
+            py::arg("net"), py::arg("red"), py::arg("blue"), py::arg("min_res"), py::arg("disc"),
+            py::arg("replicates"), py::arg("seed") = 0, py::arg("threads") = 1,
+            py::call_guard<py::gil_scoped_release>());
+    pyscan_module.def("permutation_test_halfplane", &pyscan::permutation_test_halfplane,
+            py::arg("net"), py::arg("red"), py::arg("blue"), py::arg("disc"), py::arg("replicates"),
+            py::arg("seed") = 0, py::arg("threads") = 1,
+            py::call_guard<py::gil_scoped_release>());
+    pyscan_module.def("permutation_test_kernel", &pyscan::permutation_test_kernel,
+            py::arg("red"), py::arg("blue"), py::arg("grid_res"), py::arg("radius_size"), py::arg("bandwidth"),
+            py::arg("replicates"), py::arg("seed") = 0, py::arg("threads") = 1,
+            py::call_guard<py::gil_scoped_release>());
+
+    pyscan_module.def("max_disk_scale_windows", &pyscan::max_disk_scale_windows,
+            py::arg("net"), py::arg("red"), py::arg("blue"), py::arg("min_res"), py::arg("window"), py::arg("stride"),
+            py::arg("disc"), py::arg("threads") = 1,
+            py::call_guard<py::gil_scoped_release>());
+    pyscan_module.def("max_rectangle_windows", &pyscan::max_rectangle_windows,
+            py::arg("red"), py::arg("blue"), py::arg("eps"), py::arg("a"), py::arg("b"), py::arg("window"),
+            py::arg("stride"),
+            py::call_guard<py::gil_scoped_release>());
+    pyscan_module.def("max_disk_scale_labeled", &pyscan::max_disk_scale_labeled,
+            py::arg("net"), py::arg("red"), py::arg("blue"), py::arg("compress"), py::arg("min_res"), py::arg("disc"),
+            py::arg("threads") = 1,
+            py::call_guard<py::gil_scoped_release>());
+    pyscan_module.def("max_disk_scale_labeled_alt", &pyscan::max_disk_scale_labeled_alt,
+            py::arg("net"), py::arg("red"), py::arg("blue"), py::arg("min_res"), py::arg("disc"),
+            py::arg("threads") = 1,
+            py::call_guard<py::gil_scoped_release>());
+
+    pyscan_module.def("max_rect_labeled", &pyscan::max_rect_labeled,
+            py::call_guard<py::gil_scoped_release>());
+
+
+    pyscan_module.def("max_rect_labeled_scale", pyscan::max_rect_labeled_scale,
+            py::arg("r"), py::arg("max_r"), py::arg("alpha"), py::arg("net"), py::arg("red"), py::arg("blue"),
+            py::arg("disc"), py::arg("threads") = 1,
+            py::call_guard<py::gil_scoped_release>());
+
+
+    pyscan_module.def("max_disk_traj_grid", &pyscan::max_disk_traj_grid,
+            py::call_guard<py::gil_scoped_release>());
 //
 
     //This simplifies the trajectory by using the dp algorithm.
-    pyscan_module.def("dp_compress", &pyscan::dp_compress);
+    pyscan_module.def("dp_compress", &pyscan::dp_compress,
+            py::call_guard<py::gil_scoped_release>());
     //This grids the trajectory and assigns a single point to each cell.
-    pyscan_module.def("grid_kernel", &pyscan::approx_traj_grid);
-    pyscan_module.def("grid_trajectory", &pyscan::grid_traj);
+    pyscan_module.def("grid_kernel", &pyscan::approx_traj_grid,
+            py::call_guard<py::gil_scoped_release>());
+    pyscan_module.def("grid_trajectory", &pyscan::grid_traj,
+            py::call_guard<py::gil_scoped_release>());
     //This grids the trajectory and creates an alpha hull in each one.
-    pyscan_module.def("grid_direc_kernel", &pyscan::approx_traj_kernel_grid);
+    pyscan_module.def("grid_direc_kernel", &pyscan::approx_traj_kernel_grid,
+            py::call_guard<py::gil_scoped_release>());
     //This is for 2d eps-kernel useful for halfspaces.
-    pyscan_module.def("halfplane_kernel", pyscan::approx_hull);
+    pyscan_module.def("halfplane_kernel", pyscan::approx_hull,
+            py::call_guard<py::gil_scoped_release>());
     pyscan_module.def("convex_hull", pyscan::graham_march);
     //This is a 3d eps-kernel for disks.
-    pyscan_module.def("lifting_kernel", &pyscan::lifting_coreset);
+    pyscan_module.def("lifting_kernel", &pyscan::lifting_coreset,
+            py::call_guard<py::gil_scoped_release>());
 
-    pyscan_module.def("coreset_error_halfplane", &pyscan::error_halfplane_coreset);
+    pyscan_module.def("coreset_error_halfplane", &pyscan::error_halfplane_coreset,
+            py::call_guard<py::gil_scoped_release>());
     //pyscan_module.def("coreset_error_disk", &pyscan::error_disk_coreset);
 
     //This is for partial scanning, but could be used for full scannings.
-    pyscan_module.def("block_sample", &pyscan::block_sample);
-    pyscan_module.def("uniform_sample", &pyscan::uniform_sample);
-    pyscan_module.def("even_sample", &pyscan::even_sample);
-
-    pyscan_module.def("block_sample_error", &pyscan::block_sample_error);
-    pyscan_module.def("uniform_sample_error", &pyscan::uniform_sample_error);
-    pyscan_module.def("even_sample_error", &pyscan::even_sample_error);
-
-    pyscan_module.def("polygon_sample", &pyscan::polygon_sample);
-    pyscan_module.def("polygon_grid", &pyscan::polygon_grid);
-
-    pyscan_module.def("polygon_grid_even", &pyscan::polygon_grid_even);
-    pyscan_module.def("polygon_grid_hull", &pyscan::polygon_grid_hull);
-
-    pyscan_module.def("naive_find_rect", &pyscan::naive_find_rect);
-    pyscan_module.def("naive_scan_grid", &pyscan::naive_scan_grid);
-    pyscan_module.def("naive_approx_find_rect", &pyscan::naive_approx_find_rect);
-    pyscan_module.def("scan_grid", &pyscan::scan_grid);
-    pyscan_module.def("find_rect", &pyscan::find_rect);
+    pyscan_module.def("block_sample", &pyscan::block_sample,
+            py::call_guard<py::gil_scoped_release>());
+    pyscan_module.def("uniform_sample", &pyscan::uniform_sample,
+            py::call_guard<py::gil_scoped_release>());
+    pyscan_module.def("even_sample", &pyscan::even_sample,
+            py::call_guard<py::gil_scoped_release>());
+
+    pyscan_module.def("block_sample_error", &pyscan::block_sample_error,
+            py::call_guard<py::gil_scoped_release>());
+    pyscan_module.def("uniform_sample_error", &pyscan::uniform_sample_error,
+            py::call_guard<py::gil_scoped_release>());
+    pyscan_module.def("even_sample_error", &pyscan::even_sample_error,
+            py::call_guard<py::gil_scoped_release>());
+
+    pyscan_module.def("polygon_sample", &pyscan::polygon_sample,
+            py::call_guard<py::gil_scoped_release>());
+    pyscan_module.def("polygon_grid", &pyscan::polygon_grid,
+            py::call_guard<py::gil_scoped_release>());
+
+    pyscan_module.def("polygon_grid_even", &pyscan::polygon_grid_even,
+            py::call_guard<py::gil_scoped_release>());
+    pyscan_module.def("polygon_grid_hull", &pyscan::polygon_grid_hull,
+            py::call_guard<py::gil_scoped_release>());
+
+    pyscan_module.def("naive_find_rect", &pyscan::naive_find_rect,
+            py::call_guard<py::gil_scoped_release>());
+    pyscan_module.def("naive_scan_grid", &pyscan::naive_scan_grid,
+            py::call_guard<py::gil_scoped_release>());
+    pyscan_module.def("naive_approx_find_rect", &pyscan::naive_approx_find_rect,
+            py::call_guard<py::gil_scoped_release>());
+    pyscan_module.def("scan_grid", &pyscan::scan_grid,
+            py::call_guard<py::gil_scoped_release>());
+    pyscan_module.def("find_rect", &pyscan::find_rect,
+            py::call_guard<py::gil_scoped_release>());
 
 
     //Satscan comparison function
-    pyscan_module.def("satscan_grid", pyscan::satscan_grid);
-    pyscan_module.def("satscan_labeled", pyscan::satscan_grid_labeled);
-
-    pyscan_module.def("kernel_centers", pyscan::kernel_centers_approximate);
+    pyscan_module.def("satscan_grid",
+            py::overload_cast<const pyscan::wpoint_list_t&, const pyscan::wpoint_list_t&, double, double,
+                    const pyscan::discrepancy_func_t&, size_t>(&pyscan::satscan_grid),
+            py::arg("red"), py::arg("blue"), py::arg("grid_res"), py::arg("disk_r"), py::arg("disc"),
+            py::arg("threads") = 1,
+            py::call_guard<py::gil_scoped_release>());
+    pyscan_module.def("satscan_grid",
+            py::overload_cast<const pyscan::PointArray&, const pyscan::PointArray&, double, double,
+                    const pyscan::discrepancy_func_t&, size_t>(&pyscan::satscan_grid),
+            py::arg("red"), py::arg("blue"), py::arg("grid_res"), py::arg("disk_r"), py::arg("disc"),
+            py::arg("threads") = 1,
+            py::call_guard<py::gil_scoped_release>());
+    pyscan_module.def("satscan_labeled", pyscan::satscan_grid_labeled,
+            py::arg("red"), py::arg("blue"), py::arg("grid_res"), py::arg("disk_r"), py::arg("disc"),
+            py::arg("threads") = 1,
+            py::call_guard<py::gil_scoped_release>());
+    pyscan_module.def("satscan_grid_profile", &satscan_grid_profile_np,
+            py::arg("red"), py::arg("blue"), py::arg("grid_res"), py::arg("disk_r"), py::arg("disc"),
+            py::arg("threads") = 1);
+    pyscan_module.def("satscan_grid_profile",
+            [](pyscan::wpoint_list_t const& mpts, pyscan::wpoint_list_t const& bpts, double grid_res, double disk_r,
+                    pyscan::discrepancy_func_t const& disc, size_t threads) {
+                return satscan_grid_profile_np(pyscan::PointArray(mpts), pyscan::PointArray(bpts), grid_res, disk_r,
+                        disc, threads);
+            },
+            py::arg("red"), py::arg("blue"), py::arg("grid_res"), py::arg("disk_r"), py::arg("disc"),
+            py::arg("threads") = 1);
+    pyscan_module.def("satscan_labeled_profile",
+            [](pyscan::lpoint_list_t const& mpts, pyscan::lpoint_list_t const& bpts, double grid_res, double disk_r,
+                    pyscan::discrepancy_func_t const& disc, size_t threads) {
+                return satscan_grid_profile_np(pyscan::PointArray(mpts), pyscan::PointArray(bpts), grid_res, disk_r,
+                        disc, threads);
+            },
+            py::arg("red"), py::arg("blue"), py::arg("grid_res"), py::arg("disk_r"), py::arg("disc"),
+            py::arg("threads") = 1);
+
+    pyscan_module.def("kernel_centers", pyscan::kernel_centers_approximate,
+            py::call_guard<py::gil_scoped_release>());
 
 }
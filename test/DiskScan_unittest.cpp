@@ -5,13 +5,19 @@
 
 //#include "../src/RectangleScan.hpp"
 #include "DiskScan.hpp"
+#include "Gridding.hpp"
+#include "KernelScanning.hpp"
 #include "Range.hpp"
+#include "PermutationTest.hpp"
+#include "SatScan.hpp"
 #include "Statistics.hpp"
+#include "TemporalScan.hpp"
 #include "Test_Utilities.hpp"
 
 #include <tuple>
 #include <limits>
 #include <random>
+#include <thread>
 #include <iostream>
 
 #include "gtest/gtest.h"
@@ -75,6 +81,341 @@ namespace {
         EXPECT_FLOAT_EQ(d1value, evaluate_range(d1, m_pts, b_pts, scan));
     }
 
+    TEST(max_disk_scale, threaded) {
+
+        const static int n_size = 100;
+        const static int s_size = 1000;
+        auto n_pts = pyscantest::randomPoints2(n_size);
+        auto m_pts = pyscantest::randomWPoints2(s_size);
+        auto b_pts = pyscantest::randomWPoints2(s_size);
+
+        auto [d1, d1value] = max_disk_scale(n_pts, m_pts, b_pts, 1 / 16.0, scan, 1);
+        auto [d2, d2value] = max_disk_scale(n_pts, m_pts, b_pts, 1 / 16.0, scan, 4);
+        EXPECT_EQ(d1value, d2value);
+        EXPECT_EQ(d1.getRadius(), d2.getRadius());
+        EXPECT_EQ(d1.getOrigin()(0), d2.getOrigin()(0));
+        EXPECT_EQ(d1.getOrigin()(1), d2.getOrigin()(1));
+        EXPECT_FLOAT_EQ(d2value, evaluate_range(d2, m_pts, b_pts, scan));
+    }
+
+    TEST(max_disk_scale, point_array) {
+
+        const static int n_size = 50;
+        const static int s_size = 500;
+        auto n_pts = pyscantest::randomPoints2(n_size);
+        auto m_pts = pyscantest::randomWPoints2(s_size);
+        auto b_pts = pyscantest::randomWPoints2(s_size);
+
+        auto [d1, d1value] = max_disk_scale(n_pts, m_pts, b_pts, 1 / 16.0, scan);
+        auto [d2, d2value] = max_disk_scale(n_pts, pyscan::PointArray(m_pts), pyscan::PointArray(b_pts), 1 / 16.0, scan);
+        EXPECT_EQ(d1value, d2value);
+        EXPECT_FLOAT_EQ(d2value, evaluate_range(d2, m_pts, b_pts, scan));
+    }
+
+    TEST(DiskScanner, batches) {
+
+        const static int n_size = 50;
+        const static int s_size = 200;
+        auto n_pts = pyscantest::randomPoints2(n_size);
+        pyscan::wpoint_list_t m_pts, b_pts;
+        pyscan::DiskScanner scanner(n_pts, 1 / 16.0, scan, 2);
+        for (size_t i = 0; i < 4; ++i) {
+            auto m_batch = pyscantest::randomWPoints2(s_size);
+            auto b_batch = pyscantest::randomWPoints2(s_size);
+            m_pts.insert(m_pts.end(), m_batch.begin(), m_batch.end());
+            b_pts.insert(b_pts.end(), b_batch.begin(), b_batch.end());
+            scanner.insert(m_batch, b_batch);
+
+            auto [d1, d1value] = scanner.current_max();
+            auto [d2, d2value] = max_disk_scale(n_pts, m_pts, b_pts, 1 / 16.0, scan);
+            EXPECT_FLOAT_EQ(d1value, d2value);
+            EXPECT_FLOAT_EQ(d1value, evaluate_range(d1, m_pts, b_pts, scan));
+        }
+    }
+
+    TEST(DiskScanner, sliding_window) {
+
+        const static int n_size = 50;
+        const static int s_size = 60;
+        const static size_t window = 5;
+        auto n_pts = pyscantest::randomPoints2(n_size);
+        pyscan::discrepancy_func_t stat = pyscan::KulldorffStat{.01};
+        pyscan::DiskScanner scanner(n_pts, 1 / 16.0, stat, 2);
+        std::vector<pyscan::wpoint_list_t> m_batches, b_batches;
+        for (size_t i = 0; i < 40; ++i) {
+            m_batches.push_back(pyscantest::randomWPoints2(s_size));
+            b_batches.push_back(pyscantest::randomWPoints2(s_size));
+            scanner.insert(m_batches.back(), b_batches.back());
+            if (i >= window) {
+                scanner.remove(m_batches[i - window], b_batches[i - window]);
+            }
+            if (i % 8 != 7) continue;
+
+            pyscan::wpoint_list_t m_pts, b_pts;
+            for (size_t j = i + 1 - window; j <= i; ++j) {
+                m_pts.insert(m_pts.end(), m_batches[j].begin(), m_batches[j].end());
+                b_pts.insert(b_pts.end(), b_batches[j].begin(), b_batches[j].end());
+            }
+            auto [d1, d1value] = scanner.current_max();
+            auto [d2, d2value] = max_disk_scale(n_pts, m_pts, b_pts, 1 / 16.0, stat);
+            EXPECT_FLOAT_EQ(d1value, d2value);
+            EXPECT_FLOAT_EQ(d1value, evaluate_range(d1, m_pts, b_pts, stat));
+        }
+    }
+
+    TEST(DiskScanner, nonconvex_statistics) {
+
+        const static int n_size = 50;
+        const static int s_size = 200;
+        auto n_pts = pyscantest::randomPoints2(n_size);
+        //Kulldorff is cut to 0 outside [rho, 1 - rho], so neither statistic is convex in the weights.
+        std::vector<pyscan::discrepancy_func_t> stats{pyscan::KulldorffStat{.05}, pyscan::GammaStat{.05}};
+        for (auto &stat : stats) {
+            pyscan::wpoint_list_t m_pts, b_pts;
+            pyscan::DiskScanner scanner(n_pts, 1 / 16.0, stat, 2);
+            std::vector<pyscan::wpoint_list_t> m_batches, b_batches;
+            for (size_t i = 0; i < 3; ++i) {
+                m_batches.push_back(pyscantest::randomWPoints2(s_size));
+                b_batches.push_back(pyscantest::randomWPoints2(s_size));
+                scanner.insert(m_batches.back(), b_batches.back());
+            }
+            scanner.remove(m_batches[0], b_batches[0]);
+            for (size_t i = 1; i < 3; ++i) {
+                m_pts.insert(m_pts.end(), m_batches[i].begin(), m_batches[i].end());
+                b_pts.insert(b_pts.end(), b_batches[i].begin(), b_batches[i].end());
+            }
+
+            auto [d1, d1value] = scanner.current_max();
+            auto [d2, d2value] = max_disk_scale(n_pts, m_pts, b_pts, 1 / 16.0, stat);
+            EXPECT_FLOAT_EQ(d1value, d2value);
+            EXPECT_FLOAT_EQ(d1value, evaluate_range(d1, m_pts, b_pts, stat));
+        }
+    }
+
+    TEST(permutation_test_disk, deterministic) {
+
+        const static int n_size = 30;
+        const static int s_size = 200;
+        auto n_pts = pyscantest::randomPoints2(n_size);
+        auto m_pts = pyscantest::randomWPoints2(s_size);
+        auto b_pts = pyscantest::randomWPoints2(s_size);
+
+        auto [obs1, null1, p1] = pyscan::permutation_test_disk(n_pts, m_pts, b_pts, 1 / 8.0, scan, 20, 7, 1);
+        auto [obs2, null2, p2] = pyscan::permutation_test_disk(n_pts, m_pts, b_pts, 1 / 8.0, scan, 20, 7, 4);
+        EXPECT_EQ(obs1, std::get<1>(max_disk_scale(n_pts, m_pts, b_pts, 1 / 8.0, scan)));
+        EXPECT_EQ(obs1, obs2);
+        EXPECT_EQ(null1, null2);
+        EXPECT_EQ(p1, p2);
+        EXPECT_TRUE(std::is_sorted(null1.begin(), null1.end()));
+        size_t at_least = std::count_if(null1.begin(), null1.end(), [&](double v) { return v >= obs1; });
+        EXPECT_DOUBLE_EQ(p1, (1.0 + at_least) / 21.0);
+    }
+
+    TEST(max_disk, concurrent_calls) {
+
+        //The python bindings release the GIL, so independent scans can run on several threads at once.
+        const static int n_size = 30;
+        const static int s_size = 300;
+        const static size_t scans = 4;
+        std::vector<pyscan::point_list_t> nets;
+        std::vector<pyscan::wpoint_list_t> reds, blues;
+        for (size_t i = 0; i < scans; i++) {
+            nets.push_back(pyscantest::randomPoints2(n_size));
+            reds.push_back(pyscantest::randomWPoints2(s_size));
+            blues.push_back(pyscantest::randomWPoints2(s_size));
+        }
+        pyscan::discrepancy_func_t f = pyscan::KulldorffStat{.01};
+
+        std::vector<double> serial(scans), concurrent(scans);
+        for (size_t i = 0; i < scans; i++) {
+            serial[i] = std::get<1>(pyscan::max_disk(nets[i], reds[i], blues[i], f));
+        }
+        std::vector<std::thread> workers;
+        for (size_t i = 0; i < scans; i++) {
+            workers.emplace_back([&, i]() {
+                concurrent[i] = std::get<1>(pyscan::max_disk(nets[i], reds[i], blues[i], f));
+            });
+        }
+        for (auto &worker : workers) worker.join();
+        EXPECT_EQ(serial, concurrent);
+    }
+
+    TEST(permutation_test_kernel, deterministic) {
+
+        const static int s_size = 100;
+        auto m_pts = pyscantest::randomWPoints2(s_size);
+        auto b_pts = pyscantest::randomWPoints2(s_size);
+
+        auto [obs1, null1, p1] = pyscan::permutation_test_kernel(m_pts, b_pts, .1, .2, .1, 6, 7, 1);
+        auto [obs2, null2, p2] = pyscan::permutation_test_kernel(m_pts, b_pts, .1, .2, .1, 6, 7, 3);
+        EXPECT_EQ(obs1, std::get<1>(pyscan::max_kernel(m_pts, b_pts, .1, .2, .1)));
+        EXPECT_EQ(obs1, obs2);
+        EXPECT_EQ(null1, null2);
+        EXPECT_EQ(p1, p2);
+        EXPECT_TRUE(std::is_sorted(null1.begin(), null1.end()));
+        size_t at_least = std::count_if(null1.begin(), null1.end(), [&](double v) { return v >= obs1; });
+        EXPECT_DOUBLE_EQ(p1, (1.0 + at_least) / 7.0);
+    }
+
+    TEST(max_disk_scale_windows, matching) {
+
+        const static int n_size = 50;
+        const static int s_size = 400;
+        auto n_pts = pyscantest::randomPoints2(n_size);
+        auto m_pts = pyscantest::randomTPoints2(s_size, 10.0);
+        auto b_pts = pyscantest::randomTPoints2(s_size, 10.0);
+
+        auto in_window = [](const pyscan::tpoint_list_t &pts, double t0, double t1) {
+            pyscan::wpoint_list_t window;
+            for (auto &pt : pts) {
+                if (t0 <= pt.get_time() && pt.get_time() < t1) window.emplace_back(pt);
+            }
+            return window;
+        };
+        auto windows = pyscan::max_disk_scale_windows(n_pts, m_pts, b_pts, 1 / 16.0, 4.0, 1.5, scan);
+        EXPECT_GT(windows.size(), 5u);
+        for (auto &[t, d1, d1value] : windows) {
+            auto m_window = in_window(m_pts, t, t + 4.0);
+            auto b_window = in_window(b_pts, t, t + 4.0);
+            auto [d2, d2value] = max_disk_scale(n_pts, m_window, b_window, 1 / 16.0, scan);
+            EXPECT_FLOAT_EQ(d1value, d2value);
+            EXPECT_FLOAT_EQ(d1value, evaluate_range(d1, m_window, b_window, scan));
+        }
+    }
+
+
+
+    TEST(satscan_grid, matching) {
+
+        const static int s_size = 150;
+        const double grid_res = .1;
+        const double disk_r = .2;
+        auto m_pts = pyscantest::randomLPoints2(s_size, 40);
+        auto b_pts = pyscantest::randomLPoints2(s_size, 40);
+
+        //Every disk of radius at most disk_r around every grid center, summing the points directly.
+        auto brute_force = [&](auto const& red, auto const& blue, bool labeled) {
+            double m_tot = labeled ? pyscan::computeTotal(red) : pyscan::computeTotal(red.begin(), red.end());
+            double b_tot = labeled ? pyscan::computeTotal(blue) : pyscan::computeTotal(blue.begin(), blue.end());
+            auto weight = [&](auto const& pts, double cx, double cy, double r2) {
+                std::unordered_set<size_t> seen;
+                double w = 0;
+                for (auto& pt : pts) {
+                    double dx = pt(0) - cx, dy = pt(1) - cy;
+                    if (dx * dx + dy * dy <= r2 && (!labeled || seen.insert(pt.get_label()).second)) {
+                        w += pt.get_weight();
+                    }
+                }
+                return w;
+            };
+            auto [mnx, mny, mxx, mxy] = pyscan::bbox(red, blue).value();
+            double best = -std::numeric_limits<double>::infinity();
+            grid_scan(std::make_tuple(mnx - disk_r, mny - disk_r, mxx + disk_r, mxy + disk_r), grid_res,
+                    [&](double cx, double cy) {
+                for (auto const* pts : {&red, &blue}) {
+                    for (auto& pt : *pts) {
+                        double dx = pt(0) - cx, dy = pt(1) - cy;
+                        double r2 = dx * dx + dy * dy;
+                        if (r2 <= disk_r * disk_r) {
+                            best = std::max(best, scan(weight(red, cx, cy, r2), m_tot, weight(blue, cx, cy, r2), b_tot));
+                        }
+                    }
+                }
+            });
+            return best;
+        };
+
+        pyscan::wpoint_list_t m_wpts(m_pts.begin(), m_pts.end());
+        pyscan::wpoint_list_t b_wpts(b_pts.begin(), b_pts.end());
+        auto [d1, d1value] = pyscan::satscan_grid(m_wpts, b_wpts, grid_res, disk_r, scan);
+        EXPECT_NEAR(d1value, brute_force(m_pts, b_pts, false), 1e-9);
+        EXPECT_LE(d1.getRadius(), disk_r);
+        auto [d2, d2value] = pyscan::satscan_grid(m_wpts, b_wpts, grid_res, disk_r, scan, 3);
+        EXPECT_EQ(d1value, d2value);
+        EXPECT_EQ(d1.getRadius(), d2.getRadius());
+
+        auto [d3, d3value] = pyscan::satscan_grid_labeled(m_pts, b_pts, grid_res, disk_r, scan, 3);
+        EXPECT_NEAR(d3value, brute_force(m_pts, b_pts, true), 1e-9);
+        EXPECT_LE(d3.getRadius(), disk_r);
+
+        pyscan::PointArray m_arr(m_wpts), b_arr(b_wpts);
+        auto [cols, rows] = pyscan::satscan_grid_shape(m_arr, b_arr, grid_res, disk_r);
+        std::vector<double> profile(4 * cols * rows);
+        auto [d4, d4value] = pyscan::satscan_grid_profile(m_arr, b_arr, grid_res, disk_r, scan, profile.data(), 2);
+        EXPECT_EQ(d1value, d4value);
+        std::vector<std::tuple<double, double>> centers;
+        auto [mnx, mny, mxx, mxy] = pyscan::bbox(m_wpts, b_wpts).value();
+        grid_scan(std::make_tuple(mnx - disk_r, mny - disk_r, mxx + disk_r, mxy + disk_r), grid_res,
+                [&](double cx, double cy) { centers.emplace_back(cx, cy); });
+        ASSERT_EQ(centers.size(), cols * rows);
+        double best = -std::numeric_limits<double>::infinity();
+        for (size_t i = 0; i < centers.size(); i++) {
+            EXPECT_EQ(profile[4 * i], std::get<0>(centers[i]));
+            EXPECT_EQ(profile[4 * i + 1], std::get<1>(centers[i]));
+            EXPECT_LE(profile[4 * i + 2], disk_r);
+            best = std::max(best, profile[4 * i + 3]);
+        }
+        EXPECT_EQ(best, d1value);
+    }
+
+
+
+    TEST(measure_kernel, optimum) {
+
+        const static int s_size = 200;
+        const double bandwidth = .1;
+        auto m_pts = pyscantest::randomWPoints2(s_size);
+        auto b_pts = pyscantest::randomWPoints2(s_size);
+        auto kern = [](double dist, double h) { return exp(-dist * dist / (h * h)); };
+
+        for (size_t c = 0; c < 5; c++) {
+            pyscan::pt2_t center(.1 + .2 * c, .5, 1.0);
+            auto [p, q, fval] = pyscan::measure_kernel(center, m_pts, b_pts, bandwidth);
+            EXPECT_GE(p, 1e-4);
+            EXPECT_LE(p, 1 - 1e-4);
+            EXPECT_GE(q, 1e-4);
+            EXPECT_LE(q, 1 - 1e-4);
+
+            pyscan::Bernoulli_Disk disc(pyscan::computeTotal(m_pts), pyscan::computeTotal(b_pts), bandwidth, kern);
+            std::vector<double> m_w, b_w, m_r, b_r;
+            for (auto& pt : m_pts) {
+                m_w.push_back(pt.get_weight());
+                m_r.push_back(center.dist(pt));
+            }
+            for (auto& pt : b_pts) {
+                b_w.push_back(pt.get_weight());
+                b_r.push_back(center.dist(pt));
+            }
+            disc.set_weights(m_w, b_w);
+            disc.set_radii(m_r, b_r);
+            EXPECT_NEAR(fval, disc.lrt(p, q), 1e-9);
+            //No point of a fine grid over the square may do better than the solver.
+            for (size_t i = 1; i < 200; i++) {
+                for (size_t j = 1; j < 200; j++) {
+                    EXPECT_LE(disc.lrt(i / 200.0, j / 200.0), fval + 1e-9);
+                }
+            }
+        }
+    }
+
+    TEST(max_kernel_truncated, matching) {
+
+        const static int s_size = 300;
+        const double bandwidth = .05;
+        auto m_pts = pyscantest::randomWPoints2(s_size);
+        auto b_pts = pyscantest::randomWPoints2(s_size);
+
+        auto [d1, v1] = pyscan::max_kernel_slow(m_pts, b_pts, .05, .1, bandwidth);
+        auto [d2, v2, err] = pyscan::max_kernel_truncated(m_pts, b_pts, .05, .1, bandwidth, 4 * bandwidth);
+        EXPECT_NEAR(v1, v2, 1e-3);
+        EXPECT_LE(err, 1e-3);
+
+        //A cutoff past the extent of the points is the exact kernel.
+        auto [d3, v3, err3] = pyscan::max_kernel_truncated(m_pts, b_pts, .05, .1, bandwidth, 10.0);
+        EXPECT_NEAR(v1, v3, 1e-6);
+        EXPECT_LE(err3, 1e-9);
+    }
+
 
 
 //    TEST(DiskScan2, matching) {
@@ -68,6 +68,34 @@ TEST(ApproximateHullTest, Kulldorff) {
 
   }
 
+TEST(ApproximateHullTest, KulldorffBatch) {
+    const static int test_size = 10000;
+    double rho = .001;
+    double eps = .01;
+    auto pts = pyscantest::randomVec(test_size);
+
+    double maxV_approx = approximateHullBatch(eps,
+      [&](Vec2 pt) {
+        return regularized_kulldorff(pt[0], pt[1], rho);
+      },
+      [&] (std::vector<Vec2> const& dirs) {
+        std::vector<Vec2> line_maxes;
+        for (auto const& dir : dirs) {
+          line_maxes.push_back(pyscantest::maxVec2(pts, [&](Vec2 const& v) {
+            return dot(v, dir);
+          }));
+        }
+        return line_maxes;
+    });
+
+    auto maxV_exact_pt = pyscantest::maxVec2(pts, [&](Vec2 const& pt){
+      return regularized_kulldorff(pt[0], pt[1], rho);
+    });
+
+    double maxV_exact = regularized_kulldorff(maxV_exact_pt[0], maxV_exact_pt[1], rho);
+    EXPECT_NEAR(maxV_exact, maxV_approx, eps);
+  }
+
 }
 // Step 3. Call RUN_ALL_TESTS() in main().
 //
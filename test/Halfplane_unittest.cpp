@@ -7,6 +7,8 @@
 
 #include "Range.hpp"
 #include "HalfSpaceScan.hpp"
+#include "PermutationTest.hpp"
+#include "Statistics.hpp"
 
 #include "gtest/gtest.h"
 namespace {
@@ -65,6 +67,70 @@ namespace {
         EXPECT_FLOAT_EQ(std::get<1>(d1), std::get<1>(d2));
     }
 
+    TEST(max_halfplane, threaded) {
+
+        const static int n_size = 100;
+        const static int s_size = 1000;
+        auto n_pts = pyscantest::randomPoints2(n_size);
+        auto m_pts = pyscantest::randomWPoints2(s_size);
+        auto b_pts = pyscantest::randomWPoints2(s_size);
+        auto ml_pts = pyscantest::randomLPoints2(s_size, 50);
+        auto bl_pts = pyscantest::randomLPoints2(s_size, 50);
+
+        auto [h1, h1_value] = pyscan::max_halfplane(n_pts, m_pts, b_pts, stat, 1);
+        auto [h2, h2_value] = pyscan::max_halfplane(n_pts, m_pts, b_pts, stat, 4);
+        EXPECT_EQ(h1_value, h2_value);
+        for (size_t i = 0; i < 3; i++) {
+            EXPECT_EQ(h1[i], h2[i]);
+        }
+
+        auto [l1, l1_value] = pyscan::max_halfplane_labeled(n_pts, ml_pts, bl_pts, stat, 1);
+        auto [l2, l2_value] = pyscan::max_halfplane_labeled(n_pts, ml_pts, bl_pts, stat, 4);
+        EXPECT_EQ(l1_value, l2_value);
+        for (size_t i = 0; i < 3; i++) {
+            EXPECT_EQ(l1[i], l2[i]);
+        }
+    }
+
+    TEST(permutation_test_halfplane, deterministic) {
+
+        const static int n_size = 30;
+        const static int s_size = 300;
+        auto n_pts = pyscantest::randomPoints2(n_size);
+        auto m_pts = pyscantest::randomWPoints2(s_size);
+        auto b_pts = pyscantest::randomWPoints2(s_size);
+        pyscan::discrepancy_func_t scan = pyscan::DiscStat{};
+
+        auto [obs1, null1, p1] = pyscan::permutation_test_halfplane(n_pts, m_pts, b_pts, scan, 20, 7, 1);
+        auto [obs2, null2, p2] = pyscan::permutation_test_halfplane(n_pts, m_pts, b_pts, scan, 20, 7, 4);
+        EXPECT_EQ(obs1, std::get<1>(pyscan::max_halfplane(n_pts, m_pts, b_pts, scan)));
+        EXPECT_EQ(obs1, obs2);
+        EXPECT_EQ(null1, null2);
+        EXPECT_EQ(p1, p2);
+        EXPECT_TRUE(std::is_sorted(null1.begin(), null1.end()));
+        size_t at_least = std::count_if(null1.begin(), null1.end(), [&](double v) { return v >= obs1; });
+        EXPECT_DOUBLE_EQ(p1, (1.0 + at_least) / 21.0);
+    }
+
+    TEST(max_halfplane, batch_statistic) {
+
+        const static int n_size = 50;
+        const static int s_size = 500;
+        auto n_pts = pyscantest::randomPoints2(n_size);
+        auto m_pts = pyscantest::randomWPoints2(s_size);
+        auto b_pts = pyscantest::randomWPoints2(s_size);
+
+        //The same statistic through the batch kernel and through a plain std::function.
+        pyscan::discrepancy_func_t kull = pyscan::KulldorffStat{.0001};
+        pyscan::discrepancy_func_t kull_f = [](double m, double m_total, double b, double b_total) {
+            return pyscan::kulldorff(m / m_total, b / b_total, .0001);
+        };
+        auto [h1, h1_value] = pyscan::max_halfplane(n_pts, m_pts, b_pts, kull);
+        auto [h2, h2_value] = pyscan::max_halfplane(n_pts, m_pts, b_pts, kull_f);
+        EXPECT_FLOAT_EQ(h1_value, h2_value);
+        EXPECT_FLOAT_EQ(h1_value, pyscan::evaluate_range(h1, m_pts, b_pts, kull_f));
+    }
+
     TEST(max_halfspace, discrepancy) {
 
         const static int n_size = 25;
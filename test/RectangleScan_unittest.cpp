@@ -2,11 +2,17 @@
 
 
 #include "RectangleScan.hpp"
+#include "TemporalScan.hpp"
+#include "BatchEvaluate.hpp"
+#include "RangeIndex.hpp"
 #include "IntervalScan.hpp"
+#include "PermutationTest.hpp"
 #include "Utilities.hpp"
 
 #include "Test_Utilities.hpp"
 
+#include <thread>
+
 
 #include "gtest/gtest.h"
 
@@ -54,6 +60,30 @@ namespace {
         rect_label_test(2, 2000, 100);
     }
 
+    TEST(max_rectangle_windows, matching) {
+
+        const static int s_size = 1000;
+        auto m_pts = pyscantest::randomTPoints2(s_size, 10.0);
+        auto b_pts = pyscantest::randomTPoints2(s_size, 10.0);
+
+        auto in_window = [](const pyscan::tpoint_list_t &pts, double t0, double t1) {
+            pyscan::wpoint_list_t window;
+            for (auto &pt : pts) {
+                if (t0 <= pt.get_time() && pt.get_time() < t1) window.emplace_back(pt);
+            }
+            return window;
+        };
+        auto windows = pyscan::max_rectangle_windows(m_pts, b_pts, .01, 1.0, -1.0, 4.0, 1.5);
+        EXPECT_GT(windows.size(), 5u);
+        for (auto &[t, r1, r1value] : windows) {
+            auto [r2, r2value] = pyscan::max_rectangle(in_window(m_pts, t, t + 4.0), in_window(b_pts, t, t + 4.0),
+                                                        .01, 1.0, -1.0);
+            EXPECT_FLOAT_EQ(r1value, r2value);
+            EXPECT_EQ(r1.lowX(), r2.lowX());
+            EXPECT_EQ(r1.upY(), r2.upY());
+        }
+    }
+
     TEST(max_rectangle, matching) {
 
         const static int n_size = 50;
@@ -75,6 +105,203 @@ namespace {
 
     }
 
+    TEST(max_subgrid, threads) {
+
+        const static int s_size = 1000;
+        auto m_pts = pyscantest::randomWPoints2(s_size);
+        auto b_pts = pyscantest::randomWPoints2(s_size);
+        pyscan::Grid grid(37, m_pts, b_pts);
+
+        auto single = pyscan::max_subgrid(grid, pyscan::DiscStat{}, 1);
+        auto multi = pyscan::max_subgrid(grid, pyscan::DiscStat{}, 4);
+
+        EXPECT_EQ(single.fValue(), multi.fValue());
+        EXPECT_EQ(single.lowX(), multi.lowX());
+        EXPECT_EQ(single.upX(), multi.upX());
+        EXPECT_EQ(single.lowY(), multi.lowY());
+        EXPECT_EQ(single.upY(), multi.upY());
+    }
+
+    TEST(max_subgrid, threads_partial_blocks) {
+
+        // 67 columns span several lane blocks and leave a partial one at the end.
+        const static int s_size = 4000;
+        auto m_pts = pyscantest::randomWPoints2(s_size);
+        auto b_pts = pyscantest::randomWPoints2(s_size);
+        pyscan::Grid grid(67, m_pts, b_pts);
+
+        auto single = pyscan::max_subgrid(grid, pyscan::KulldorffStat{.001}, 1);
+        for (size_t threads : {2, 3, 5}) {
+            auto multi = pyscan::max_subgrid(grid, pyscan::KulldorffStat{.001}, threads);
+            EXPECT_EQ(single.fValue(), multi.fValue());
+            EXPECT_EQ(single.lowX(), multi.lowX());
+            EXPECT_EQ(single.upX(), multi.upX());
+            EXPECT_EQ(single.lowY(), multi.lowY());
+            EXPECT_EQ(single.upY(), multi.upY());
+        }
+    }
+
+    TEST(max_rectangle, threads) {
+
+        const static int s_size = 2000;
+        auto m_pts = pyscantest::randomWPoints2(s_size);
+        auto b_pts = pyscantest::randomWPoints2(s_size);
+
+        auto [single, single_v] = pyscan::max_rectangle(m_pts, b_pts, .05, 1.0, -1.0, 1);
+        auto [multi, multi_v] = pyscan::max_rectangle(m_pts, b_pts, .05, 1.0, -1.0, 4);
+
+        EXPECT_EQ(single_v, multi_v);
+        EXPECT_EQ(single.lowX(), multi.lowX());
+        EXPECT_EQ(single.upX(), multi.upX());
+        EXPECT_EQ(single.lowY(), multi.lowY());
+        EXPECT_EQ(single.upY(), multi.upY());
+    }
+
+    TEST(max_rectangle, concurrent_calls) {
+
+        const static int s_size = 1000;
+        const static size_t scans = 4;
+        std::vector<pyscan::wpoint_list_t> reds, blues;
+        for (size_t i = 0; i < scans; i++) {
+            reds.push_back(pyscantest::randomWPoints2(s_size));
+            blues.push_back(pyscantest::randomWPoints2(s_size));
+        }
+
+        std::vector<double> serial(scans), concurrent(scans);
+        for (size_t i = 0; i < scans; i++) {
+            serial[i] = std::get<1>(pyscan::max_rectangle(reds[i], blues[i], .05, 1.0, -1.0));
+        }
+        std::vector<std::thread> workers;
+        for (size_t i = 0; i < scans; i++) {
+            workers.emplace_back([&, i]() {
+                concurrent[i] = std::get<1>(pyscan::max_rectangle(reds[i], blues[i], .05, 1.0, -1.0));
+            });
+        }
+        for (auto &worker : workers) worker.join();
+        EXPECT_EQ(serial, concurrent);
+    }
+
+    TEST(permutation_test_rectangle, deterministic) {
+
+        const static int s_size = 300;
+        auto m_pts = pyscantest::randomWPoints2(s_size);
+        auto b_pts = pyscantest::randomWPoints2(s_size);
+
+        auto [obs1, null1, p1] = pyscan::permutation_test_rectangle(m_pts, b_pts, .1, 1.0, -1.0, 20, 7, 1);
+        auto [obs2, null2, p2] = pyscan::permutation_test_rectangle(m_pts, b_pts, .1, 1.0, -1.0, 20, 7, 4);
+        EXPECT_EQ(obs1, std::get<1>(pyscan::max_rectangle(m_pts, b_pts, .1, 1.0, -1.0)));
+        EXPECT_EQ(obs1, obs2);
+        EXPECT_EQ(null1, null2);
+        EXPECT_EQ(p1, p2);
+        EXPECT_TRUE(std::is_sorted(null1.begin(), null1.end()));
+        size_t at_least = std::count_if(null1.begin(), null1.end(), [&](double v) { return v >= obs1; });
+        EXPECT_DOUBLE_EQ(p1, (1.0 + at_least) / 21.0);
+    }
+
+    TEST(max_rect_labeled_scale, threads) {
+
+        auto net = pyscantest::randomPoints2(40);
+        auto m_pts = pyscantest::randomLPoints2(1000, 300);
+        auto b_pts = pyscantest::randomLPoints2(1000, 300);
+        auto scan = [](double m, double m_total, double b, double b_total) {
+            return fabs(m / m_total - b / b_total);
+        };
+
+        auto [single, single_v] = pyscan::max_rect_labeled_scale(10, .1, .2, net, m_pts, b_pts, scan, 1);
+        auto [multi, multi_v] = pyscan::max_rect_labeled_scale(10, .1, .2, net, m_pts, b_pts, scan, 4);
+
+        EXPECT_EQ(single_v, multi_v);
+        EXPECT_EQ(single.lowX(), multi.lowX());
+        EXPECT_EQ(single.upX(), multi.upX());
+        EXPECT_EQ(single.lowY(), multi.lowY());
+        EXPECT_EQ(single.upY(), multi.upY());
+    }
+
+    TEST(evaluate_ranges, matching) {
+
+        auto m_pts = pyscantest::randomWPoints2(5000);
+        auto b_pts = pyscantest::randomWPoints2(5000);
+        auto m_lpts = pyscantest::randomLPoints2(5000, 500);
+        auto b_lpts = pyscantest::randomLPoints2(5000, 500);
+        auto corners = pyscantest::randomPoints2(600);
+        auto scan = [](double m, double m_total, double b, double b_total) {
+            return fabs(m / m_total - b / b_total);
+        };
+
+        std::vector<pyscan::Rectangle> rects;
+        std::vector<pyscan::Disk> disks;
+        std::vector<pyscan::halfspace2_t> planes;
+        for (size_t i = 0; i + 2 < corners.size(); i += 3) {
+            rects.emplace_back(corners[i], corners[i + 1], corners[i + 1], corners[i]);
+            disks.emplace_back(corners[i](0), corners[i](1), corners[i + 2](0) / 2);
+            planes.emplace_back(corners[i], corners[i + 1]);
+        }
+
+        auto check = [&](auto const& ranges, auto const& red, auto const& blue) {
+            auto values = pyscan::evaluate_ranges(ranges, red, blue, scan, 4);
+            ASSERT_EQ(values.size(), ranges.size());
+            for (size_t i = 0; i < ranges.size(); i++) {
+                EXPECT_NEAR(values[i], pyscan::evaluate_range(ranges[i], red, blue, scan), 1e-12);
+            }
+        };
+        check(rects, m_pts, b_pts);
+        check(disks, m_pts, b_pts);
+        check(planes, m_pts, b_pts);
+        check(rects, m_lpts, b_lpts);
+        check(disks, m_lpts, b_lpts);
+        check(planes, m_lpts, b_lpts);
+    }
+
+    TEST(SpatialIndex, matching) {
+
+        auto pts = pyscantest::randomWPoints2(5000);
+        auto corners = pyscantest::randomPoints2(300);
+        pyscan::SpatialIndex index(pts);
+        EXPECT_NEAR(index.get_total_weight(), pyscan::computeTotal(pts), 1e-9);
+
+        auto check = [&](auto const& range) {
+            std::vector<size_t> expected;
+            for (size_t i = 0; i < pts.size(); i++) {
+                if (range.contains(pts[i])) {
+                    expected.push_back(i);
+                }
+            }
+            EXPECT_EQ(index.inside(range), expected);
+            EXPECT_EQ(index.count(range), expected.size());
+            EXPECT_NEAR(index.weight(range), pyscan::range_weight(range, pts), 1e-9);
+        };
+        for (size_t i = 0; i + 2 < corners.size(); i += 3) {
+            check(pyscan::Rectangle(corners[i], corners[i + 1], corners[i + 1], corners[i]));
+            check(pyscan::Disk(corners[i](0), corners[i](1), corners[i + 2](0) / 2));
+            check(pyscan::halfspace2_t(corners[i], corners[i + 1]));
+        }
+    }
+
+    TEST(max_subgrid_linear, batch) {
+
+        const static int s_size = 1000;
+        auto m_pts = pyscantest::randomWPoints2(s_size);
+        auto b_pts = pyscantest::randomWPoints2(s_size);
+        pyscan::Grid grid(40, m_pts, b_pts);
+
+        std::vector<std::tuple<double, double>> coeffs{{1.0, -1.0}, {-1.0, 1.0}, {.3, -.7}, {.9, .1}};
+        auto batch = pyscan::max_subgrid_linear(grid, coeffs);
+        ASSERT_EQ(batch.size(), coeffs.size());
+        for (size_t c = 0; c < coeffs.size(); c++) {
+            auto single = pyscan::max_subgrid_linear(grid, std::get<0>(coeffs[c]), std::get<1>(coeffs[c]));
+            EXPECT_EQ(batch[c].fValue(), single.fValue());
+            EXPECT_EQ(batch[c].lowX(), single.lowX());
+            EXPECT_EQ(batch[c].upX(), single.upX());
+            EXPECT_EQ(batch[c].lowY(), single.lowY());
+            EXPECT_EQ(batch[c].upY(), single.upY());
+        }
+
+        auto exact = pyscan::max_subgrid(grid, pyscan::DiscStat{});
+        auto approx = pyscan::max_subgrid_convex(grid, .01, pyscan::DiscStat{}, 3);
+        auto approx_value = pyscan::DiscStat{}(grid.redSubWeight(approx), 1.0, grid.blueSubWeight(approx), 1.0);
+        EXPECT_NEAR(exact.fValue(), approx_value, .01);
+    }
+
 
     std::tuple<std::vector<size_t>, pyscan::epoint_list_t, pyscan::epoint_list_t> initialize_pts() {
         const static int n_size = 50;
@@ -351,6 +578,53 @@ namespace {
         }
     }
 
+    TEST(SlabTree, compress_on_build) {
+
+        const static int s_size = 2000;
+        const double eps = .05;
+        auto m_wpts = pyscantest::randomWPoints2(s_size);
+        auto b_wpts = pyscantest::randomWPoints2(s_size);
+        auto[m_pts, b_pts, tmp1, tmp2] = pyscan::to_epoints(m_wpts, b_wpts);
+        (void) tmp1;
+        (void) tmp2;
+
+        pyscan::SlabTree tree1(m_pts, b_pts, eps);
+        tree1.even_compress(eps / log(1 / eps));
+        tree1.compute_splits();
+        pyscan::SlabTree tree2(m_pts, b_pts, eps, eps / log(1 / eps));
+        tree2.compute_splits();
+
+        auto same_points = [](pyscan::SlabRun<pyscan::ept_t> const& r1, pyscan::SlabRun<pyscan::ept_t> const& r2) {
+            return std::equal(r1.begin(), r1.end(), r2.begin(), r2.end(),
+                    [](pyscan::ept_t const& p, pyscan::ept_t const& q) {
+                        return p.get_x() == q.get_x() && p.get_y() == q.get_y() && p.get_weight() == q.get_weight();
+                    });
+        };
+        std::vector<pyscan::slab_ptr> stack1{tree1.get_root()}, stack2{tree2.get_root()};
+        while (!stack1.empty()) {
+            auto s1 = stack1.back(), s2 = stack2.back();
+            stack1.pop_back();
+            stack2.pop_back();
+            ASSERT_EQ(s1->top_y, s2->top_y);
+            ASSERT_EQ(s1->bottom_y, s2->bottom_y);
+            ASSERT_TRUE(same_points(s1->m_merges, s2->m_merges));
+            ASSERT_TRUE(same_points(s1->b_merges, s2->b_merges));
+            ASSERT_TRUE(std::equal(s1->global_split_offset.begin(), s1->global_split_offset.end(),
+                    s2->global_split_offset.begin(), s2->global_split_offset.end()));
+            ASSERT_EQ(s1->up == nullptr, s2->up == nullptr);
+            ASSERT_EQ(s1->down == nullptr, s2->down == nullptr);
+            if (s1->up != nullptr) {
+                stack1.push_back(s1->up);
+                stack2.push_back(s2->up);
+            }
+            if (s1->down != nullptr) {
+                stack1.push_back(s1->down);
+                stack2.push_back(s2->down);
+            }
+        }
+        EXPECT_EQ(std::get<1>(tree1.max_rectangle(1.0, -1.0)), std::get<1>(tree2.max_rectangle(1.0, -1.0)));
+    }
+
     TEST(SlabTree, max_rectangle) {
 
         const static int n_size = 20;
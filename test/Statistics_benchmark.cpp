@@ -0,0 +1,78 @@
+#include "RectangleScan.hpp"
+#include "HalfSpaceScan.hpp"
+#include "SatScan.hpp"
+#include "Statistics.hpp"
+#include "Test_Utilities.hpp"
+
+#include <cmath>
+#include <ctime>
+#include <iostream>
+
+/*
+ * Times the scans with a built in statistic against the same statistic hidden behind a lambda, which is what
+ * the scans saw before they could recognize the built in ones. Both paths must find the same maximum; the built
+ * in Kulldorff uses the vectorized log, so the values are compared up to the last few bits. Returns 1 if any
+ * scan disagrees.
+ */
+static bool all_match = true;
+
+template <typename F>
+double time_scan(F scan) {
+    auto begin = std::clock();
+    double value = scan();
+    auto end = std::clock();
+    std::cout << value << " ";
+    return static_cast<double>(end - begin) / CLOCKS_PER_SEC;
+}
+
+template <typename F>
+void compare(const char* name,
+        pyscan::discrepancy_func_t const& builtin,
+        pyscan::discrepancy_func_t const& wrapped,
+        F scan) {
+    double fast_value = 0, slow_value = 0;
+    double fast = time_scan([&]() { return fast_value = scan(builtin); });
+    double slow = time_scan([&]() { return slow_value = scan(wrapped); });
+    if (std::abs(fast_value - slow_value) > 1e-12 * std::abs(slow_value)) {
+        std::cout << std::endl << name << " MISMATCH " << fast_value << " " << slow_value;
+        all_match = false;
+    }
+    std::cout << std::endl << name << " builtin " << fast << "s function " << slow << "s speedup "
+              << slow / fast << std::endl;
+}
+
+pyscan::discrepancy_func_t kulldorff = pyscan::KulldorffStat{.0001};
+pyscan::discrepancy_func_t kulldorff_f = [](double m, double m_total, double b, double b_total) {
+    return pyscan::kulldorff(m / m_total, b / b_total, .0001);
+};
+
+pyscan::discrepancy_func_t disc = pyscan::DiscStat{};
+pyscan::discrepancy_func_t disc_f = [](double m, double m_total, double b, double b_total) {
+    return std::abs(m / m_total - b / b_total);
+};
+
+int main() {
+
+    auto m_pts = pyscantest::randomWPoints2(20000);
+    auto b_pts = pyscantest::randomWPoints2(20000);
+    auto ml_pts = pyscantest::randomLPoints2(1000, 500);
+    auto bl_pts = pyscantest::randomLPoints2(1000, 500);
+    auto n_pts = pyscantest::randomPoints2(200);
+
+    pyscan::Grid grid(80, m_pts, b_pts);
+    compare("max_subgrid disc", disc, disc_f, [&](pyscan::discrepancy_func_t const& f) {
+        return pyscan::max_subgrid(grid, f).fValue();
+    });
+    compare("max_subgrid kulldorff", kulldorff, kulldorff_f, [&](pyscan::discrepancy_func_t const& f) {
+        return pyscan::max_subgrid(grid, f).fValue();
+    });
+
+    compare("satscan_labeled disc", disc, disc_f, [&](pyscan::discrepancy_func_t const& f) {
+        return std::get<1>(pyscan::satscan_grid_labeled(ml_pts, bl_pts, .05, .1, f));
+    });
+
+    compare("max_halfplane kulldorff", kulldorff, kulldorff_f, [&](pyscan::discrepancy_func_t const& f) {
+        return std::get<1>(pyscan::max_halfplane(n_pts, m_pts, b_pts, f));
+    });
+    return all_match ? 0 : 1;
+}